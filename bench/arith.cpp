@@ -0,0 +1,86 @@
+// packed list arithmetic through the vector kernels against the scalar
+// loop, on lists the size of a row, a layer and a whole level. run as
+// bench_arith.
+#include "lingo/vm/vm.hpp"
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <vector>
+
+using namespace lingo;
+
+// nanoseconds per item of the best of a few runs
+static double time_items(size_t n, const std::function<void()> &op) {
+    size_t runs = n >= 1000000 ? 10 : 2000;
+
+    double best = 0.0;
+    for (size_t run = 0; run < runs; ++run) {
+        auto start = std::chrono::steady_clock::now();
+        op();
+        double ns = std::chrono::duration<double, std::nano>(
+            std::chrono::steady_clock::now() - start).count();
+        if (run == 0 || ns < best) best = ns;
+    }
+
+    return best / (double)n;
+}
+
+int main() {
+    const size_t sizes[] = { 1000, 20000, 1120000 };
+    std::mt19937 rng(1);
+
+    printf("%-18s %8s %10s %10s %8s\n", "op", "items", "scalar ns",
+           "vector ns", "speedup");
+
+    for (size_t n : sizes) {
+        std::vector<int32_t> ia(n), ib(n), iout(n);
+        std::vector<double> fa(n), fb(n), fout(n);
+        for (size_t i = 0; i < n; ++i) {
+            ia[i] = (int32_t)(rng() % 2000) - 1000;
+            ib[i] = (int32_t)(rng() % 2000) + 1;
+            fa[i] = ia[i] * 0.25;
+            fb[i] = ib[i] * 0.5;
+        }
+
+        int32_t iscalar = 3;
+        double fscalar = 1.5;
+
+        struct bench_op {
+            const char *name;
+            std::function<void(bool)> run;
+        };
+
+        const bench_op ops[] = {
+            { "int list + list", [&](bool vector) {
+                vm::arith_ints(bc::OP_ADD, ia.data(), 1, ib.data(), 1,
+                               iout.data(), n, vector);
+            } },
+            { "int list * int", [&](bool vector) {
+                vm::arith_ints(bc::OP_MUL, ia.data(), 1, &iscalar, 0,
+                               iout.data(), n, vector);
+            } },
+            { "float list + list", [&](bool vector) {
+                vm::arith_floats(bc::OP_ADD, fa.data(), 1, fb.data(), 1,
+                                 fout.data(), n, vector);
+            } },
+            { "float list * float", [&](bool vector) {
+                vm::arith_floats(bc::OP_MUL, fa.data(), 1, &fscalar, 0,
+                                 fout.data(), n, vector);
+            } },
+            { "float list / list", [&](bool vector) {
+                vm::arith_floats(bc::OP_DIV, fa.data(), 1, fb.data(), 1,
+                                 fout.data(), n, vector);
+            } },
+        };
+
+        for (const bench_op &op : ops) {
+            double scalar = time_items(n, [&] { op.run(false); });
+            double vector = time_items(n, [&] { op.run(true); });
+            printf("%-18s %8zu %10.3f %10.3f %7.2fx\n", op.name, n, scalar,
+                   vector, scalar / vector);
+        }
+    }
+
+    return 0;
+}
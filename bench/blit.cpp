@@ -0,0 +1,120 @@
+// copyPixels on 1400x800 canvases, the size of a rendered level: straight
+// copies, scaled copies, through an ink, and into a rotated quad against
+// thread count. run as bench_blit [max threads].
+#include "lingo/vm/vm.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <thread>
+
+using namespace lingo;
+
+static constexpr int32_t WIDTH = 1400;
+static constexpr int32_t HEIGHT = 800;
+
+static vm::image* noise(vm::gc_heap &heap, int32_t width, int32_t height,
+                        uint8_t depth, std::mt19937 &rng) {
+    vm::image *img = vm::image::alloc(heap, width, height, depth);
+    for (int32_t y = 0; y < height; ++y) {
+        uint8_t *row = img->row(y);
+        for (size_t i = 0; i < (size_t)width * (depth / 8); ++i)
+            row[i] = (uint8_t)rng();
+    }
+
+    return img;
+}
+
+// the best time of a blit over a few runs, in ms
+static double time_blit(const std::function<void()> &blit) {
+    constexpr int RUNS = 20;
+
+    double best = 0.0;
+    for (int run = 0; run < RUNS; ++run) {
+        auto start = std::chrono::steady_clock::now();
+        blit();
+        double ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+        if (run == 0 || ms < best) best = ms;
+    }
+
+    return best;
+}
+
+int main(int argc, const char *argv[]) {
+    size_t max_threads = argc > 1
+        ? strtoul(argv[1], nullptr, 10)
+        : std::max(1u, std::thread::hardware_concurrency());
+
+    vm::gc_heap heap;
+    std::mt19937 rng(1);
+    vm::image *dst32 = noise(heap, WIDTH, HEIGHT, 32, rng);
+    vm::image *src32 = noise(heap, WIDTH, HEIGHT, 32, rng);
+    vm::image *dst8 = noise(heap, WIDTH, HEIGHT, 8, rng);
+    vm::image *src8 = noise(heap, WIDTH, HEIGHT, 8, rng);
+
+    const int32_t full[4] = { 0, 0, WIDTH, HEIGHT };
+    const int32_t half[4] = { 0, 0, WIDTH / 2, HEIGHT / 2 };
+    vm::blit_params copy;
+    vm::blit_params transparent;
+    transparent.ink = vm::INK_BACKGROUND_TRANSPARENT;
+
+    // the rect blits are drawn on the calling thread
+    vm::set_blit_threads(1);
+
+    struct rect_case {
+        const char *name;
+        vm::image *dst, *src;
+        const int32_t *dst_rect, *src_rect;
+        const vm::blit_params *params;
+    };
+
+    const rect_case rect_cases[] = {
+        { "copy 32-bit", dst32, src32, full, full, &copy },
+        { "copy 8-bit", dst8, src8, full, full, &copy },
+        { "copy 8 to 32-bit", dst32, src8, full, full, &copy },
+        { "scale up 2x 32-bit", dst32, src32, full, half, &copy },
+        { "scale down 2x 32-bit", dst32, src32, half, full, &copy },
+        { "scale up 2x 8-bit", dst8, src8, full, half, &copy },
+        { "bg transparent 32-bit", dst32, src32, full, full, &transparent },
+        { "bg transparent scaled", dst32, src32, full, half, &transparent },
+    };
+
+    for (const rect_case &c : rect_cases) {
+        double ms = time_blit([&] {
+            vm::copy_pixels(*c.dst, c.dst_rect, *c.src, c.src_rect,
+                            *c.params);
+        });
+        printf("%-24s %7.2f ms\n", c.name, ms);
+    }
+
+    // the canvas turned by 30 degrees about its center, and the same with
+    // its bottom edge pulled in, into a canvas of the same size
+    double quads[2][8];
+    double angle = 30.0 * 3.14159265358979 / 180.0;
+    for (int i = 0; i < 4; ++i) {
+        double x = (i == 1 || i == 2 ? 0.5 : -0.5) * WIDTH;
+        double y = (i >= 2 ? 0.5 : -0.5) * HEIGHT;
+        quads[0][i * 2] = WIDTH / 2 + x * cos(angle) - y * sin(angle);
+        quads[0][i * 2 + 1] = HEIGHT / 2 + x * sin(angle) + y * cos(angle);
+        quads[1][i * 2] = WIDTH / 2 + x * (i >= 2 ? 0.6 : 1.0);
+        quads[1][i * 2 + 1] = HEIGHT / 2 + y;
+    }
+
+    const char *quad_names[2] = { "rotated quad", "perspective quad" };
+    for (int q = 0; q < 2; ++q) {
+        for (size_t threads = 1; threads <= max_threads; ++threads) {
+            vm::set_blit_threads(threads);
+            double ms = time_blit([&] {
+                vm::copy_pixels_quad(*dst32, quads[q], *src32, full, copy);
+            });
+            printf("%-16s %2zu threads %7.2f ms\n", quad_names[q], threads,
+                   ms);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,118 @@
+// duplicate() of a level shaped list, a matrix of columns of cells, each
+// cell a list holding a number, a string and a packed list. the copy shares
+// the lists in it until something changes, so this times duplicate() itself
+// and the writes that make the copy take lists of its own.
+// run as bench_duplicate [columns] [rows].
+#include "lingo/vm/vm.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+
+using namespace lingo;
+
+static vm::variant ref(bc::vtype type, vm::gc_object *obj) {
+    vm::variant v;
+    v.type = type;
+    v.ref = obj;
+    return v;
+}
+
+static vm::variant number(int32_t i) {
+    vm::variant v;
+    v.type = bc::TYPE_INT;
+    v.i32 = i;
+    return v;
+}
+
+static vm::llist* build_level(vm::gc_heap &heap, size_t columns,
+                              size_t rows) {
+    vm::string *material = vm::string::alloc(heap, "Standard", 8);
+    vm::llist *level = vm::llist::alloc(heap, columns);
+
+    for (size_t x = 0; x < columns; ++x) {
+        vm::llist *column = vm::llist::alloc(heap, rows);
+
+        for (size_t y = 0; y < rows; ++y) {
+            vm::llist *features = vm::llist::alloc(heap, 2);
+            features->add(heap, number((int32_t)x));
+            features->add(heap, number((int32_t)y));
+
+            vm::llist *cell = vm::llist::alloc(heap, 3);
+            cell->add(heap, number((int32_t)((x * 7 + y) % 5)));
+            cell->add(heap, ref(bc::TYPE_STRING, material));
+            cell->add(heap, ref(bc::TYPE_LLIST, features));
+
+            column->add(heap, ref(bc::TYPE_LLIST, cell));
+        }
+
+        level->add(heap, ref(bc::TYPE_LLIST, column));
+    }
+
+    return level;
+}
+
+// list[i], as getAt hands it out
+static vm::llist* item(vm::gc_heap &heap, vm::llist *list, size_t i) {
+    if (list->lazy()) list->unshare(heap);
+    return static_cast<vm::llist*>(list->get(i).ref);
+}
+
+// the time of op, in ms, and what it copied
+static void report(vm::gc_heap &heap, const char *name,
+                   const std::function<void()> &op) {
+    vm::heap_stats before = heap.stats();
+    auto start = std::chrono::steady_clock::now();
+    op();
+    double ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    const vm::heap_stats &after = heap.stats();
+
+    printf("%-36s %10.3f ms %9zu dups %11zu bytes\n", name, ms,
+           after.duplicates - before.duplicates,
+           (after.duplicate_bytes - before.duplicate_bytes) +
+           (after.cow_bytes - before.cow_bytes));
+}
+
+int main(int argc, const char *argv[]) {
+    size_t columns = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1400;
+    size_t rows = argc > 2 ? strtoul(argv[2], nullptr, 10) : 800;
+    size_t x = columns / 2, y = rows / 2;
+
+    vm::gc_heap heap;
+    vm::llist *level = build_level(heap, columns, rows);
+    printf("level: %zu x %zu cells\n", columns, rows);
+
+    vm::variant v = ref(bc::TYPE_LLIST, level);
+    vm::llist *copy = nullptr;
+
+    // a cell taken before the duplicate, as a script holding on to it would
+    vm::llist *cell = item(heap, item(heap, level, x), y);
+
+    report(heap, "duplicate", [&] {
+        copy = static_cast<vm::llist*>(vm::duplicate(heap, v).ref);
+    });
+    report(heap, "write a cell taken before", [&] {
+        cell->set(heap, 0, number(9));
+    });
+    report(heap, "write a cell of the copy", [&] {
+        item(heap, item(heap, copy, x + 1), y)->set(heap, 0, number(9));
+    });
+    report(heap, "hand out every cell of the copy", [&] {
+        for (size_t i = 0; i < columns; ++i) {
+            vm::llist *column = item(heap, copy, i);
+            for (size_t j = 0; j < rows; ++j)
+                item(heap, column, j);
+        }
+    });
+
+    // a column in another list as well can't be followed by its tag, so
+    // the level is then copied eagerly, one list deep
+    vm::llist *other = vm::llist::alloc(heap);
+    other->add(heap, ref(bc::TYPE_LLIST, item(heap, level, 0)));
+    report(heap, "duplicate, a column in another list", [&] {
+        vm::duplicate(heap, v);
+    });
+
+    return 0;
+}
@@ -0,0 +1,135 @@
+// offset() and contains: the vectorized find against a naive byte loop, on
+// a few megabytes of text. the needle is matched in its own case (exact),
+// in another case (folded), and not at all, which scans the whole string.
+// run as bench_find [megabytes].
+#include "lingo/vm/vm.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <string>
+
+using namespace lingo;
+
+// lowercase, as the vm folds characters for comparison
+static inline uint8_t fold(uint8_t ch) {
+    bool upper = (ch >= 'A' && ch <= 'Z') ||
+                 (ch >= 0xC0 && ch <= 0xDE && ch != 0xD7);
+    return upper ? (uint8_t)(ch | 0x20) : ch;
+}
+
+// every position, compared a character at a time
+static bool naive_find(const char *hay, size_t hay_len, const char *needle,
+                       size_t needle_len, size_t *pos) {
+    if (needle_len > hay_len) return false;
+
+    for (size_t i = 0; i <= hay_len - needle_len; ++i) {
+        size_t j = 0;
+        while (j < needle_len &&
+               fold((uint8_t)hay[i + j]) == fold((uint8_t)needle[j]))
+            ++j;
+
+        if (j == needle_len) {
+            *pos = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// the best time over a few runs, in ms
+static double time_find(const std::function<void()> &find) {
+    constexpr int RUNS = 10;
+
+    double best = 0.0;
+    for (int run = 0; run < RUNS; ++run) {
+        auto start = std::chrono::steady_clock::now();
+        find();
+        double ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+        if (run == 0 || ms < best) best = ms;
+    }
+
+    return best;
+}
+
+int main(int argc, const char *argv[]) {
+    size_t megabytes = argc > 1 ? strtoul(argv[1], nullptr, 10) : 4;
+    std::mt19937 rng(1);
+
+    // words of lowercase letters, as in a script or a serialized level
+    std::string hay;
+    hay.reserve(megabytes * 1000000);
+    while (hay.size() < megabytes * 1000000) {
+        size_t len = 2 + rng() % 9;
+        for (size_t i = 0; i < len; ++i)
+            hay += (char)('a' + rng() % 26);
+        hay += rng() % 8 ? ' ' : '\n';
+    }
+
+    // the needles are written into the last 1% of the string. the text has
+    // no #, so they aren't found anywhere before that.
+    const char *needles[] = { "#tile", "#material: \"concrete\"" };
+    size_t at = hay.size() - hay.size() / 100;
+
+    printf("%.1f MB of text\n", hay.size() / 1e6);
+    printf("%-28s %10s %10s %8s\n", "needle", "naive ms", "find ms",
+           "speedup");
+
+    for (const char *needle : needles) {
+        std::string lower = needle;
+        std::string upper = needle;
+        for (char &ch : upper)
+            ch = (ch >= 'a' && ch <= 'z') ? (char)(ch - 32) : ch;
+
+        std::string text = hay;
+        text.replace(at, lower.size(), lower);
+
+        struct bench_case {
+            const char *name;
+            std::string needle;
+            bool found;
+        };
+
+        const bench_case cases[] = {
+            { "exact", lower, true },
+            { "folded", upper, true },
+            { "absent", lower + "!", false },
+        };
+
+        for (const bench_case &c : cases) {
+            size_t naive_pos = 0, find_pos = 0;
+            bool naive_found = false, found = false;
+
+            double naive = time_find([&] {
+                naive_found = naive_find(text.data(), text.size(),
+                                         c.needle.data(), c.needle.size(),
+                                         &naive_pos);
+            });
+
+            double vector = time_find([&] {
+                found = vm::find_nocase(text.data(), text.size(),
+                                        c.needle.data(), c.needle.size(),
+                                        &find_pos);
+            });
+
+            if (found != c.found || naive_found != c.found ||
+                (found && find_pos != naive_pos))
+            {
+                fprintf(stderr, "error: the finds disagree on %s\n",
+                        c.needle.c_str());
+                return 1;
+            }
+
+            char name[64];
+            snprintf(name, sizeof(name), "%s, %zu chars", c.name,
+                     c.needle.size());
+            printf("%-28s %10.2f %10.2f %7.2fx\n", name, naive, vector,
+                   naive / vector);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,95 @@
+// mark time against thread count, on a heap shaped like a loaded level: a
+// matrix of columns of cells, each cell a list holding a number, a string
+// and a packed list. run as bench_gc [columns] [rows] [max threads].
+#include "lingo/vm/vm.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+using namespace lingo;
+
+static vm::variant ref(bc::vtype type, vm::gc_object *obj) {
+    vm::variant v;
+    v.type = type;
+    v.ref = obj;
+    return v;
+}
+
+static vm::llist* build_level(vm::gc_heap &heap, size_t columns,
+                              size_t rows) {
+    vm::string *material = vm::string::alloc(heap, "Standard", 8);
+    vm::llist *level = vm::llist::alloc(heap, vm::llist::STORE_VARIANT,
+                                        columns);
+
+    for (size_t x = 0; x < columns; ++x) {
+        vm::llist *column = vm::llist::alloc(heap, vm::llist::STORE_VARIANT,
+                                             rows);
+
+        for (size_t y = 0; y < rows; ++y) {
+            vm::llist *features = vm::llist::alloc(heap,
+                                                   vm::llist::STORE_INT, 2);
+            features->ints()[0] = (int32_t)x;
+            features->ints()[1] = (int32_t)y;
+
+            vm::llist *cell = vm::llist::alloc(heap,
+                                               vm::llist::STORE_VARIANT, 3);
+            vm::variant *items = cell->variants();
+            items[0].type = bc::TYPE_INT;
+            items[0].i32 = (int32_t)((x * 7 + y) % 5);
+            items[1] = ref(bc::TYPE_STRING, material);
+            items[2] = ref(bc::TYPE_LLIST, features);
+
+            column->variants()[y] = ref(bc::TYPE_LLIST, cell);
+        }
+
+        level->variants()[x] = ref(bc::TYPE_LLIST, column);
+    }
+
+    return level;
+}
+
+int main(int argc, const char *argv[]) {
+    size_t columns = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1400;
+    size_t rows = argc > 2 ? strtoul(argv[2], nullptr, 10) : 800;
+    size_t max_threads = argc > 3
+        ? strtoul(argv[3], nullptr, 10)
+        : std::max(1u, std::thread::hardware_concurrency());
+    constexpr int RUNS = 3;
+
+    vm::gc_heap heap;
+    auto start = std::chrono::steady_clock::now();
+    vm::llist *level = build_level(heap, columns, rows);
+    double build_ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+
+    // each cell is itself and its packed list, and the level and columns
+    // hold one variant per column and cell
+    printf("level: %zu x %zu cells, %zu objects, %zu variants, built in "
+           "%.0f ms\n", columns, rows, columns * rows * 2 + columns + 2,
+           columns * rows * 4 + columns, build_ms);
+
+    // the first collection also sets the threshold from the live size, so
+    // the timed ones see the heap as it is between collections
+    heap.mark(level);
+    heap.collect();
+
+    for (size_t threads = 1; threads <= max_threads; ++threads) {
+        heap.set_mark_threads(threads);
+
+        double best = 0.0;
+        for (int run = 0; run < RUNS; ++run) {
+            size_t before = heap.stats().mark_us;
+            heap.mark(level);
+            heap.collect();
+
+            double ms = (heap.stats().mark_us - before) / 1000.0;
+            if (run == 0 || ms < best) best = ms;
+        }
+
+        printf("%2zu threads: mark %8.1f ms\n", threads, best);
+    }
+
+    return 0;
+}
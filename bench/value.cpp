@@ -0,0 +1,88 @@
+// value() on a serialized level the size of a project file: a property
+// list of geometry, tile and material matrices, a few megabytes of text.
+// run as bench_value [columns] [rows].
+#include "lingo/vm/vm.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+using namespace lingo;
+
+// the level as string() would write it, one cell per column and row of
+// each matrix
+static std::string build_level(size_t columns, size_t rows) {
+    static const char *materials[] = { "Standard", "Concrete", "RainStone",
+                                       "Bricks", "Non-Slip Metal" };
+    std::string out;
+    char buf[128];
+
+    out += "[#geo: [";
+    for (size_t x = 0; x < columns; ++x) {
+        out += x ? ", [" : "[";
+        for (size_t y = 0; y < rows; ++y) {
+            snprintf(buf, sizeof(buf), "%s[%zu, [%zu, %zu]]", y ? ", " : "",
+                     (x * 7 + y) % 5, x % 3, y % 4);
+            out += buf;
+        }
+        out += "]";
+    }
+
+    out += "], #tiles: [";
+    for (size_t x = 0; x < columns; ++x) {
+        out += x ? ", [" : "[";
+        for (size_t y = 0; y < rows; ++y) {
+            snprintf(buf, sizeof(buf),
+                     "%s[#tp: \"material\", #data: \"%s\", "
+                     "#pos: point(%zu, %zu)]",
+                     y ? ", " : "", materials[(x + y) % 5], x, y);
+            out += buf;
+        }
+        out += "]";
+    }
+
+    out += "], #camera: [";
+    for (size_t i = 0; i < columns / 10; ++i) {
+        snprintf(buf, sizeof(buf), "%s[#pos: point(%zu.5, %zu.25), "
+                 "#quad: [0.0, 12.5, 0.75, 3.0]]", i ? ", " : "", i * 20,
+                 i * 3);
+        out += buf;
+    }
+
+    out += "], #name: \"bench level\", #version: 4]";
+    return out;
+}
+
+int main(int argc, const char *argv[]) {
+    size_t columns = argc > 1 ? strtoul(argv[1], nullptr, 10) : 300;
+    size_t rows = argc > 2 ? strtoul(argv[2], nullptr, 10) : 200;
+    constexpr int RUNS = 5;
+
+    std::string level = build_level(columns, rows);
+    printf("level: %zu x %zu cells, %.2f MB of text\n", columns, rows,
+           level.size() / 1e6);
+
+    auto vm = std::make_unique<vm::runner>();
+
+    double best = 0.0;
+    for (int run = 0; run < RUNS; ++run) {
+        vm::variant out;
+
+        auto start = std::chrono::steady_clock::now();
+        bool ok = vm->parse_value(level.data(), level.size(), &out);
+        double ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+
+        if (!ok || out.type != bc::TYPE_PLIST) {
+            fprintf(stderr, "error: the level did not parse\n");
+            return 1;
+        }
+
+        if (run == 0 || ms < best) best = ms;
+    }
+
+    printf("value(): %8.1f ms, %6.1f MB/s\n", best,
+           level.size() / 1e3 / best);
+    return 0;
+}
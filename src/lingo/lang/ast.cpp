@@ -206,6 +206,26 @@ static inline void tok_expect(const token &tok, token_symbol sym) {
 //     return ret;
 // };
 
+// char/word/item/line, followed by the start of the index expression.
+// otherwise the word is a regular identifier.
+static bool is_chunk_expression(const token &tok, token_reader &reader) {
+    if (!tok.is_a(TOKEN_WORD)) return false;
+    if (tok.str != "char" && tok.str != "word" && tok.str != "item" &&
+        tok.str != "line")
+        return false;
+
+    const token &next = reader.peek();
+    if (next.is_a(TOKEN_WORD)) {
+        // put line into x
+        return next.str != "into" && (next.word_id == WORD_ID_UNKNOWN ||
+                                      next.word_id == WORD_ID_THE);
+    }
+
+    return next.is_a(TOKEN_INTEGER) || next.is_a(TOKEN_FLOAT) ||
+           next.is_a(TOKEN_STRING) ||
+           next.is_a(TOKEN_SYMBOL_LITERAL) || next.is_symbol(SYMBOL_LPAREN);
+}
+
 template <unsigned int Lv = 0>
 static std::unique_ptr<ast_expr>
 parse_expression(token_reader &reader, parse_ctx &ctx,
@@ -221,7 +241,7 @@ parse_expression(token_reader &reader, parse_ctx &ctx,
         while ((tok->is_symbol(SYMBOL_EQUAL) && !assignment) ||
               tok->is_symbol(SYMBOL_NEQUAL) || tok->is_symbol(SYMBOL_GT) ||
               tok->is_symbol(SYMBOL_LT) || tok->is_symbol(SYMBOL_GE) ||
-              tok->is_symbol(SYMBOL_LE))
+              tok->is_symbol(SYMBOL_LE) || tok->is_keyword(KEYWORD_CONTAINS))
         {
             const token &op = reader.pop();
             std::unique_ptr<ast_expr> right =
@@ -231,32 +251,37 @@ parse_expression(token_reader &reader, parse_ctx &ctx,
             tmp->pos = op.pos;
             tmp->left = std::move(left);
             tmp->right = std::move(right);
-            switch (op.symbol) {
-                case SYMBOL_EQUAL:
-                    tmp->op = EXPR_BINOP_EQ;
-                    break;
 
-                case SYMBOL_NEQUAL:
-                    tmp->op = EXPR_BINOP_NEQ;
-                    break;
+            if (op.is_keyword(KEYWORD_CONTAINS)) {
+                tmp->op = EXPR_BINOP_CONTAINS;
+            } else {
+                switch (op.symbol) {
+                    case SYMBOL_EQUAL:
+                        tmp->op = EXPR_BINOP_EQ;
+                        break;
 
-                case SYMBOL_GT:
-                    tmp->op = EXPR_BINOP_GT;
-                    break;
+                    case SYMBOL_NEQUAL:
+                        tmp->op = EXPR_BINOP_NEQ;
+                        break;
 
-                case SYMBOL_LT:
-                    tmp->op = EXPR_BINOP_LT;
-                    break;
+                    case SYMBOL_GT:
+                        tmp->op = EXPR_BINOP_GT;
+                        break;
 
-                case SYMBOL_GE:
-                    tmp->op = EXPR_BINOP_GE;
-                    break;
+                    case SYMBOL_LT:
+                        tmp->op = EXPR_BINOP_LT;
+                        break;
 
-                case SYMBOL_LE:
-                    tmp->op = EXPR_BINOP_LE;
-                    break;
+                    case SYMBOL_GE:
+                        tmp->op = EXPR_BINOP_GE;
+                        break;
+
+                    case SYMBOL_LE:
+                        tmp->op = EXPR_BINOP_LE;
+                        break;
 
-                default: throw parse_exception(op.pos, "error parsing Lv0");
+                    default: throw parse_exception(op.pos, "error parsing Lv0");
+                }
             }
 
             left = std::move(tmp);
@@ -497,9 +522,15 @@ parse_expression(token_reader &reader, parse_ctx &ctx,
 
                     expr = std::move(left);
                 } else if (op->is_symbol(SYMBOL_LBRACKET)) {
-                    // TODO: index ranges
                     auto inner = parse_expression<0>(reader, ctx);
 
+                    // index range
+                    std::unique_ptr<ast_expr> inner_to;
+                    if (reader.peek().is_symbol(SYMBOL_RANGE)) {
+                        reader.pop();
+                        inner_to = parse_expression<0>(reader, ctx);
+                    }
+
                     const token &term = reader.pop();
                     if (!term.is_symbol(SYMBOL_RBRACKET)) {
                         throw parse_exception(
@@ -512,7 +543,7 @@ parse_expression(token_reader &reader, parse_ctx &ctx,
                     left->pos = op->pos;
                     left->expr = std::move(expr);
                     left->index_from = std::move(inner);
-                    left->index_to = nullptr;
+                    left->index_to = std::move(inner_to);
 
                     expr = std::move(left);
                 }
@@ -647,6 +678,41 @@ parse_expression(token_reader &reader, parse_ctx &ctx,
             const token &id = reader.pop();
             tok_expect(id, TOKEN_WORD);
 
+            // the number of lines in X, lowered to X.line.count
+            if (id.is_word(WORD_ID_NUMBER) && reader.peek().is_word(WORD_ID_OF)) {
+                reader.pop();
+
+                const token &chunk_tok = reader.pop();
+                tok_expect(chunk_tok, TOKEN_WORD);
+
+                const char *chunk;
+                if (chunk_tok.str == "chars")
+                    chunk = "char";
+                else if (chunk_tok.str == "words")
+                    chunk = "word";
+                else if (chunk_tok.str == "items")
+                    chunk = "item";
+                else if (chunk_tok.str == "lines")
+                    chunk = "line";
+                else
+                    throw parse_exception(
+                        chunk_tok.pos,
+                        std::string("invalid chunk type ") + chunk_tok.str);
+
+                tok_expect(reader.pop(), WORD_ID_IN);
+
+                auto chunks = std::make_unique<ast_expr_dot>();
+                chunks->pos = tok.pos;
+                chunks->expr = parse_expression<5>(reader, ctx);
+                chunks->index = chunk;
+
+                auto ret = std::make_unique<ast_expr_dot>();
+                ret->pos = tok.pos;
+                ret->expr = std::move(chunks);
+                ret->index = "count";
+                return ret;
+            }
+
             auto ret = std::make_unique<ast_expr_the>();
             ret->pos = tok.pos;
 
@@ -658,6 +724,10 @@ parse_expression(token_reader &reader, parse_ctx &ctx,
                 ret->identifier = EXPR_THE_DIR_SEPARATOR;
             } else if (id.str == "randomseed") {
                 ret->identifier = EXPR_THE_RANDOM_SEED;
+            } else if (id.str == "itemdelimiter") {
+                ret->identifier = EXPR_THE_ITEM_DELIMITER;
+            } else if (id.str == "floatprecision") {
+                ret->identifier = EXPR_THE_FLOAT_PRECISION;
             } else {
                 throw parse_exception(
                     id.pos,
@@ -667,6 +737,30 @@ parse_expression(token_reader &reader, parse_ctx &ctx,
             return ret;
         }
 
+        // chunk expressions. lowered into the same tree as S.char[A..B]
+        //   char A of S
+        //   char A to B of S
+        if (is_chunk_expression(tok, reader)) {
+            auto index = std::make_unique<ast_expr_index>();
+            index->pos = tok.pos;
+            index->index_from = parse_expression<2>(reader, ctx);
+
+            if (reader.peek().is_word(WORD_ID_TO)) {
+                reader.pop();
+                index->index_to = parse_expression<2>(reader, ctx);
+            }
+
+            tok_expect(reader.pop(), WORD_ID_OF);
+
+            auto dot = std::make_unique<ast_expr_dot>();
+            dot->pos = tok.pos;
+            dot->expr = parse_expression<5>(reader, ctx);
+            dot->index = tok.str;
+
+            index->expr = std::move(dot);
+            return index;
+        }
+
         if (tok.is_a(TOKEN_WORD)) {
             if (tok.str == "true") {
                 return MAKE_INT(tok.pos, 1);
@@ -804,6 +898,28 @@ parse_statement(token_reader &reader, handler_scope &scope) {
 
         return stm;
     
+    // the property assignment
+    } else if (tok->is_word(WORD_ID_THE) &&
+               reader.peek(1).is_a(TOKEN_WORD) &&
+               reader.peek(2).is_symbol(SYMBOL_EQUAL))
+    {
+        auto the_expr = parse_expression<6>(reader, ctx);
+        if (the_expr->type != EXPR_THE)
+            throw parse_exception(line_pos, "invalid assignment target");
+
+        // pop equals
+        reader.pop();
+
+        auto value_expr = parse_expression(reader, ctx);
+        tok_expect(reader.pop(), TOKEN_LINE_END);
+
+        auto stm = std::make_unique<ast_statement_assign>();
+        stm->lvalue = std::move(the_expr);
+        stm->rvalue = std::move(value_expr);
+        stm->pos = line_pos;
+
+        return stm;
+
     // return statement
     } else if (tok->is_word(WORD_ID_RETURN)) {
         reader.pop();
@@ -1,5 +1,6 @@
 #include "lingo.hpp"
 #include <cassert>
+#include <cctype>
 #include <sstream>
 #include <memory>
 #include <unordered_set>
@@ -193,6 +194,93 @@ static inline bool is_literal_str(const ast::ast_expr *expr, const char **str) {
     return true;
 }
 
+static inline bool is_concat(const ast::ast_expr *expr) {
+    if (expr->type != ast::EXPR_BINOP) return false;
+    const auto *data = static_cast<const ast::ast_expr_binop*>(expr);
+    return data->op == ast::EXPR_BINOP_CONCAT ||
+           data->op == ast::EXPR_BINOP_CONCAT_WITH_SPACE;
+}
+
+// char, word, item or line, the keys that a string is indexed by chunk
+// with. O.k[i] of any other key is a regular index of O.k.
+static bool is_chunk_key(const std::string &key) {
+    static const char *chunk_keys[] = { "char", "word", "item", "line" };
+    if (key.size() != 4) return false;
+
+    for (const char *chunk : chunk_keys) {
+        size_t i = 0;
+        while (i < 4 && tolower((unsigned char)key[i]) == chunk[i])
+            ++i;
+
+        if (i == 4) return true;
+    }
+
+    return false;
+}
+
+// flatten a tree of & and && operations into its list of operands, in
+// order. a nullptr operand stands for the space inserted by &&.
+static void collect_concat(std::unique_ptr<ast::ast_expr> &expr,
+                           std::vector<std::unique_ptr<ast::ast_expr>*> &out) {
+    if (!is_concat(expr.get())) {
+        out.push_back(&expr);
+        return;
+    }
+
+    auto data = static_cast<ast::ast_expr_binop*>(expr.get());
+    collect_concat(data->left, out);
+
+    if (data->op == ast::EXPR_BINOP_CONCAT_WITH_SPACE)
+        out.push_back(nullptr);
+
+    collect_concat(data->right, out);
+}
+
+static void generate_expr(std::unique_ptr<ast::ast_expr> &expr,
+                          expr_gen_ctx &ctx);
+
+// a chain of concatenations is emitted as a single CONCATN, so that the
+// result is sized and copied once instead of once per operator.
+static void generate_concat(std::unique_ptr<ast::ast_expr> &expr,
+                            expr_gen_ctx &ctx) {
+    gen_handler_scope &scope = ctx.scope;
+    auto data = static_cast<ast::ast_expr_binop*>(expr.get());
+
+    // a lone X & Y or X && Y
+    if (!is_concat(data->left.get()) && !is_concat(data->right.get())) {
+        generate_expr(data->left, ctx);
+        generate_expr(data->right, ctx);
+
+        if (data->op == ast::EXPR_BINOP_CONCAT)
+            scope.instrs.push_back(INSTR(bc::OP_CONCAT));
+        else
+            scope.instrs.push_back(INSTR(bc::OP_CONCATSP));
+
+        return;
+    }
+
+    std::vector<std::unique_ptr<ast::ast_expr>*> operands;
+    collect_concat(expr, operands);
+
+    // the result of a full CONCATN is the first operand of the next one
+    size_t pushed = 0;
+    for (auto operand : operands) {
+        if (pushed == UINT8_MAX) {
+            scope.instrs.push_back(INSTR_8(bc::OP_CONCATN, pushed));
+            pushed = 1;
+        }
+
+        if (operand)
+            generate_expr(*operand, ctx);
+        else
+            scope.instrs.push_back(INSTR_16(bc::OP_LOADC, scope.get_literal(" ", 1)));
+
+        ++pushed;
+    }
+
+    scope.instrs.push_back(INSTR_8(bc::OP_CONCATN, pushed));
+}
+
 static void generate_store(std::unique_ptr<ast::ast_expr> &expr,
                            expr_gen_ctx &ctx) {
     gen_handler_scope &scope = ctx.scope;
@@ -226,11 +314,11 @@ static void generate_store(std::unique_ptr<ast::ast_expr> &expr,
             break;
         }
 
-        // case ast::EXPR_THE: {
-        //     auto data = static_cast<ast::ast_expr_the*>(expr.get());
-        //     scope.instrs.push_back(INSTR_8(bc::OP_THE, data->identifier));
-        //     break;
-        // }
+        case ast::EXPR_THE: {
+            auto data = static_cast<ast::ast_expr_the*>(expr.get());
+            scope.instrs.push_back(INSTR_8(bc::OP_THESET, data->identifier));
+            break;
+        }
 
         case ast::EXPR_DOT: {
             assert(false && "lvalue EXPR_DOT not implemented");
@@ -376,23 +464,17 @@ static void generate_expr(std::unique_ptr<ast::ast_expr> &expr,
 
         case ast::EXPR_PROP_LIST: {
             auto data = static_cast<ast::ast_expr_prop_list*>(expr.get());
-            (void)data;
-
-            assert(false && "TODO: ast::EXPR_PROP_LIST");
+            scope.instrs.push_back(INSTR(bc::OP_NEWPLIST));
 
-            // ostream << "lingo.propList(";
-            // bool write_comma = false;
-            // for (auto &pair : data->pairs) {
-            //     if (write_comma)
-            //         ostream << ", ";
+            uint16_t add_str_idx = scope.get_symbol("addprop");
 
-            //     generate_expr(pair.first, ostream, ctx);
-            //     ostream << ",";
-            //     generate_expr(pair.second, ostream, ctx);
-                
-            //     write_comma = true;
-            // }
-            // ostream << ")";
+            for (auto &pair : data->pairs) {
+                scope.instrs.push_back(INSTR(bc::OP_DUP));
+                generate_expr(pair.first, ctx);
+                generate_expr(pair.second, ctx);
+                scope.instrs.push_back(INSTR_16_8(bc::OP_OCALL, add_str_idx, 2));
+                scope.instrs.push_back(INSTR(bc::OP_POP));
+            }
 
             break;
         }
@@ -400,6 +482,11 @@ static void generate_expr(std::unique_ptr<ast::ast_expr> &expr,
         case ast::EXPR_BINOP: {
             auto data = static_cast<ast::ast_expr_binop*>(expr.get());
 
+            if (is_concat(data)) {
+                generate_concat(expr, ctx);
+                break;
+            }
+
             generate_expr(data->left, ctx);
             generate_expr(data->right, ctx);
 
@@ -432,14 +519,6 @@ static void generate_expr(std::unique_ptr<ast::ast_expr> &expr,
                     scope.instrs.push_back(INSTR(bc::OP_MOD));
                     break;
 
-                case ast::EXPR_BINOP_CONCAT:
-                    scope.instrs.push_back(INSTR(bc::OP_CONCAT));
-                    break;
-
-                case ast::EXPR_BINOP_CONCAT_WITH_SPACE:
-                    scope.instrs.push_back(INSTR(bc::OP_CONCATSP));
-                    break;
-                
                 case ast::EXPR_BINOP_EQ:
                     scope.instrs.push_back(INSTR(bc::OP_EQ));
                     break;
@@ -464,6 +543,10 @@ static void generate_expr(std::unique_ptr<ast::ast_expr> &expr,
                 case ast::EXPR_BINOP_LE:
                     scope.instrs.push_back(INSTR(bc::OP_LTE));
                     break;
+
+                case ast::EXPR_BINOP_CONTAINS:
+                    scope.instrs.push_back(INSTR(bc::OP_CONTAINS));
+                    break;
                     
                 default: assert(false); break;
             }
@@ -490,79 +573,102 @@ static void generate_expr(std::unique_ptr<ast::ast_expr> &expr,
         }
 
         case ast::EXPR_CALL: {
-            assert(false && "EXPR_CALL not implemented");
-            // auto data = static_cast<ast::ast_expr_call*>(expr.get());
-            // bool first_comma;
-
-            // if (data->method->type == ast::EXPR_DOT) {
-            //     auto handler_ref =
-            //         static_cast<ast::ast_expr_dot*>(data->method.get());
-                
-            //     generate_expr(handler_ref->expr, ostream, ctx);
-            //     ostream << ":" << handler_ref->index << "(";
-            //     first_comma = false;
-            // } else {
-            //     if (data->method->type != ast::EXPR_IDENTIFIER) {
-            //         throw gen_exception(data->pos, "reference to handler must come from direct identifier or dot index");
-            //     }
+            auto data = static_cast<ast::ast_expr_call*>(expr.get());
+
+            size_t nargs = data->arguments.size();
+            if (nargs > UINT8_MAX)
+                throw gen_exception(data->pos, "too many arguments");
+
+            // O.method(args) passes O as the first argument
+            if (data->method->type == ast::EXPR_DOT) {
+                auto handler_ref =
+                    static_cast<ast::ast_expr_dot*>(data->method.get());
+
+                generate_expr(handler_ref->expr, ctx);
+                for (auto &arg_expr : data->arguments)
+                    generate_expr(arg_expr, ctx);
+
+                scope.instrs.push_back(INSTR_16_8(
+                    bc::OP_OCALL,
+                    scope.get_symbol(handler_ref->index),
+                    nargs));
+                break;
+            }
 
-            //     auto handler_id =
-            //         static_cast<ast::ast_expr_identifier*>(data->method.get());
-            //     const std::string &name = handler_id->identifier;
-                
-            //     // handler name not found in script, dynamic dispatch
-            //     if (!get_handler_ref(name, ostream, ctx)) {
-            //         ostream << "call_handler(";
-            //         write_escaped_str(name, ostream);
-            //         first_comma = true;
-            //     } else {
-            //         ostream << "(";
-            //         first_comma = false;
-            //     }
-            // }
+            if (data->method->type != ast::EXPR_IDENTIFIER) {
+                throw gen_exception(data->pos, "reference to handler must come from direct identifier or dot index");
+            }
 
-            // for (auto &arg_expr : data->arguments) {
-            //     if (first_comma)
-            //         ostream << ", ";
-            //     first_comma = true;
+            auto handler_id =
+                static_cast<ast::ast_expr_identifier*>(data->method.get());
 
-            //     generate_expr(arg_expr, ostream, ctx);
-            // }
+            for (auto &arg_expr : data->arguments)
+                generate_expr(arg_expr, ctx);
 
-            // ostream << ")";
+            scope.instrs.push_back(INSTR_16_8(
+                bc::OP_CALL,
+                scope.get_symbol(handler_id->identifier),
+                nargs));
             break;
         }
 
         case ast::EXPR_DOT: {
-            assert(false && "EXPR_DOT not implemented");
-            // auto data = static_cast<ast::ast_expr_dot*>(expr.get());
+            auto data = static_cast<ast::ast_expr_dot*>(expr.get());
+
+            // O.k.count, where k is a chunk key
+            ast::ast_expr_dot *dot = nullptr;
+            if (data->index == "count" && data->expr->type == ast::EXPR_DOT)
+                dot = static_cast<ast::ast_expr_dot*>(data->expr.get());
+
+            if (dot && is_chunk_key(dot->index)) {
+                generate_expr(dot->expr, ctx);
+                scope.instrs.push_back(INSTR_16(
+                    bc::OP_LOADC,
+                    scope.get_symbol(dot->index)));
+                scope.instrs.push_back(INSTR(bc::OP_OCOUNTK));
+                break;
+            }
 
-            // ostream << "(";
-            // generate_expr(data->expr, ostream, ctx);
-            // ostream << ")." << data->index;
+            generate_expr(data->expr, ctx);
+            scope.instrs.push_back(INSTR_16(
+                bc::OP_LOADC,
+                scope.get_symbol(data->index)));
+            scope.instrs.push_back(INSTR(bc::OP_OIDXG));
             break;
         }
 
         case ast::EXPR_INDEX: {
-            assert(false && "EXPR_INDEX not implemented");
-            // auto data = static_cast<ast::ast_expr_index*>(expr.get());
+            auto data = static_cast<ast::ast_expr_index*>(expr.get());
+
+            // chunk expressions O.k[i] and O.k[a..b] are indexed by key, so
+            // that O.k does not need to be created
+            ast::ast_expr_dot *dot = nullptr;
+            if (data->expr->type == ast::EXPR_DOT)
+                dot = static_cast<ast::ast_expr_dot*>(data->expr.get());
+
+            if (dot && is_chunk_key(dot->index)) {
+                generate_expr(dot->expr, ctx);
+                scope.instrs.push_back(INSTR_16(
+                    bc::OP_LOADC,
+                    scope.get_symbol(dot->index)));
+                generate_expr(data->index_from, ctx);
+
+                if (data->index_to) {
+                    generate_expr(data->index_to, ctx);
+                    scope.instrs.push_back(INSTR(bc::OP_OIDXKR));
+                } else {
+                    scope.instrs.push_back(INSTR(bc::OP_OIDXK));
+                }
 
-            // if (data->index_to) {
-            //     ostream << "(lruntime.range(";
-            //     generate_expr(data->expr, ostream, ctx);
-            //     ostream << ", ";
-            //     generate_expr(data->index_from, ostream, ctx);
-            //     ostream << ", ";
-            //     generate_expr(data->index_to, ostream, ctx);
-            //     ostream << "))";
-            // } else {
-            //     ostream << "(";
-            //     generate_expr(data->expr, ostream, ctx);
-            //     ostream << ")[";
-            //     generate_expr(data->index_from, ostream, ctx);
-            //     ostream << "]";
-            // }
+                break;
+            }
+
+            if (data->index_to)
+                throw gen_exception(data->pos, "index range must follow a chunk key");
 
+            generate_expr(data->expr, ctx);
+            generate_expr(data->index_from, ctx);
+            scope.instrs.push_back(INSTR(bc::OP_OIDXG));
             break;
         }
 
@@ -663,74 +769,16 @@ static void generate_statement(const std::unique_ptr<ast::ast_statement> &stm,
 
         case ast::STATEMENT_PUT_ON: {
             auto data = static_cast<ast::ast_statement_put_on*>(stm.get());
-            (void)data;
-            assert(false && "PUT_ON unimplemented");
-
-            // std::string l, r;
-
-            // switch (object_index_split(data->target, expr_ctx, l, r)) {
-            //     case INDEX_SPLIT_INVALID: {
-            //         std::unique_ptr<ast::ast_expr> *expr_left;
-            //         std::unique_ptr<ast::ast_expr> *expr_right;
-
-            //         if (data->before) {
-            //             expr_left = &data->expr;
-            //             expr_right = &data->target;
-            //         } else {
-            //             expr_left = &data->target;
-            //             expr_right = &data->expr;
-            //         }
-
-            //         generate_expr(data->target, tmp_stream, expr_ctx);
-            //         tmp_stream << " = ";
-            //         generate_expr(*expr_left, tmp_stream, expr_ctx);
-            //         tmp_stream << " .. ";
-            //         generate_expr(*expr_right, tmp_stream, expr_ctx);
-            //         break;
-            //     }
-
-            //     case INDEX_SPLIT_STATIC: {
-            //         // local _tmp0 = target()
-            //         // _tmp0.idx = _tmp0.idx .. expr()
-            //         auto tmp0 = expr_ctx.scope.create_temp_var(func_stream);
-            //         tmp_stream << tmp0.name << " = " << l << "\n";
-            //         tmp_stream << tmp0.name << "." << r << " = ";
-
-            //         if (data->before) {
-            //             generate_expr(data->expr, tmp_stream, expr_ctx);
-            //             tmp_stream << " .. " << tmp0.name << "." << r;
-            //         } else {
-            //             tmp_stream << " " << tmp0.name << "." << r << " .. ";
-            //             generate_expr(data->expr, tmp_stream, expr_ctx);
-            //         }
-
-            //         break;
-            //     }
-
-            //     case INDEX_SPLIT_DYNAMIC: {
-            //         // local _tmp0 = target()
-            //         // local _tmp1 = index()
-            //         // _tmp0[_tmp1] = _tmp0[_tmp1] .. expr()
-            //         auto tmp0 = expr_ctx.scope.create_temp_var(func_stream);
-            //         auto tmp1 = expr_ctx.scope.create_temp_var(func_stream);
-            //         tmp_stream << tmp0.name << " = " << l << " ";
-            //         tmp_stream << tmp1.name << " = " << r << "\n";
-
-            //         if (data->before) {
-            //             tmp_stream << tmp0.name << "[" << tmp1.name << "] = ";
-            //             generate_expr(data->expr, tmp_stream, expr_ctx);
-            //             tmp_stream << " .. " << tmp0.name << "[" << tmp1.name << "]";
-            //         } else {
-            //             tmp_stream << tmp0.name << "[" << tmp1.name << "] = "
-            //                 << tmp0.name << "[" << tmp1.name << "] .. ";
-            //             generate_expr(data->expr, tmp_stream, expr_ctx);
-            //         }
 
-            //         break;
-            //     }
-            // }
+            if (data->target->type != ast::EXPR_IDENTIFIER)
+                throw gen_exception(data->target->pos, "put target must be a variable");
 
-            // body_contents << tmp_stream.rdbuf() << "\n";
+            // the runner appends in-place when it can, so this is not
+            // equivalent to target = target & expr
+            generate_expr(data->target, expr_ctx);
+            generate_expr(data->expr, expr_ctx);
+            scope.instrs.push_back(INSTR(data->before ? bc::OP_PUTBEFORE : bc::OP_PUTAFTER));
+            generate_store(data->target, expr_ctx);
             break;
         }
 
@@ -1290,6 +1338,12 @@ void bc::instr_disasm(const chunk_header *chunk, instr instruction, char *buf,
         OP(NEWPLIST);
         OP_U16(CASE, HINT_NONE);
         OP(PUT);
+        OP(PUTAFTER);
+        OP(PUTBEFORE);
+        OP_U8(CONCATN, HINT_NONE);
+        OP(OCOUNTK);
+        OP_U8(THESET, HINT_THE);
+        OP(CONTAINS);
 
         default:
             snprintf(buf, bufsz, "??");
@@ -49,6 +49,7 @@ struct { token_keyword e; const char *str; } static const keyword_pairs[] = {
     { KEYWORD_OR, "or" },
     { KEYWORD_NOT, "not" },
     { KEYWORD_MOD, "mod" },
+    { KEYWORD_CONTAINS, "contains" },
     // { KEYWORD_TRUE, "true" },
     // { KEYWORD_FALSE, "false" },
     // { KEYWORD_VOID, "void" }
@@ -340,7 +341,10 @@ bool lingo::ast::parse_tokens(std::istream &stream, std::vector<token> &tokens,
             case MODE_NUMBER:
                 make_symlit = false;
 
-                if (!isalnum(ch) && ch != '.') {
+                // the number ends at a range symbol, as in [1..2]
+                if ((!isalnum(ch) && ch != '.') ||
+                    (ch == '.' && stream.peek() == '.'))
+                {
                     wordbuf[wordbuf_i++] = '\0';
 
                     if (num_is_float) {
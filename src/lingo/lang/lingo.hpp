@@ -40,6 +40,7 @@ namespace lingo {
             KEYWORD_OR,
             KEYWORD_NOT,
             KEYWORD_MOD,
+            KEYWORD_CONTAINS,
         };
 
         enum token_word_id : uint8_t {
@@ -218,6 +219,7 @@ namespace lingo {
             EXPR_BINOP_GE, // X >= Y
             EXPR_BINOP_EQ, // X = Y
             EXPR_BINOP_NEQ, // X <> Y
+            EXPR_BINOP_CONTAINS, // X contains Y
 
             EXPR_BINOP_CONCAT, // X & Y
             EXPR_BINOP_CONCAT_WITH_SPACE, // X && Y
@@ -234,7 +236,9 @@ namespace lingo {
             EXPR_THE_DIR_SEPARATOR,
             EXPR_THE_MILLISECONDS,
             EXPR_THE_RANDOM_SEED,
-            EXPR_THE_PLATFORM
+            EXPR_THE_PLATFORM,
+            EXPR_THE_ITEM_DELIMITER,
+            EXPR_THE_FLOAT_PRECISION
         };
 
         enum ast_literal_type : uint8_t {
@@ -512,6 +516,8 @@ namespace lingo {
     } // namespace ast
 
     namespace bc {
+        // new opcodes are added at the end, so that compiled chunks keep
+        // their meaning
         enum opcode : uint8_t {
             OP_RET,     // .          Return from the function. Value will be
                         //            popped from the stack to serve as the
@@ -589,6 +595,18 @@ namespace lingo {
                         //            table identifier.
             OP_PUT,     // .          Pop value from stack and print it to the
                         //            console.
+            OP_PUTAFTER,// .          Pop value, then target. Push the target
+                        //            string with the value appended.
+            OP_PUTBEFORE,// .         Pop value, then target. Push the target
+                        //            string with the value prepended.
+            OP_CONCATN, // [u8]       Pop n values, push the string
+                        //            concatenation of all of them, bottom to
+                        //            top.
+            OP_OCOUNTK, // .          pop: key (string), then object. push
+                        //            result of o.k.count.
+            OP_THESET,  // [u8]       Pop value, and set the "the" value.
+            OP_CONTAINS,// .          Pop 2, push 1 if the string A contains
+                        //            B, ignoring case, 0 if not.
         }; // enum opcode
 
         // extra notes on object indices:
@@ -618,8 +636,11 @@ namespace lingo {
             TYPE_SYMBOL, // ref
             TYPE_LLIST, // linear list, ref
             TYPE_PLIST, // property list, ref
-            TYPE_POINT, // ref
+            TYPE_POINT, // h and v, stored in the variant
             TYPE_QUAD, // ref
+            TYPE_RECT, // ref
+            TYPE_COLOR, // r, g and b, stored in the variant
+            TYPE_IMAGE, // ref
         }; // enum type
 
         // this is a header struct - subsequent characters directly follow
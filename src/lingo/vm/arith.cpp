@@ -0,0 +1,377 @@
+#include "vm.hpp"
+#include <algorithm>
+#include <iostream>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define LINGO_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace lingo;
+
+// arithmetic on values other than two numbers. points, rects, quads and
+// colors are operated on component by component, with either another value
+// of the same type or a number, which applies to every component. lists
+// are operated on item by item in the same way, with another list, whose
+// items are paired up until the shorter list runs out, or with any other
+// value.
+
+static inline bool is_number(const vm::variant &v) {
+    return v.type == bc::TYPE_INT || v.type == bc::TYPE_FLOAT;
+}
+
+static const char* op_name(bc::opcode op) {
+    switch (op) {
+        case bc::OP_ADD: return "add";
+        case bc::OP_SUB: return "sub";
+        case bc::OP_MUL: return "mul";
+        default: return "div";
+    }
+}
+
+// packed list kernels. out[i] = a[i] op b[i], where a side with a step of
+// 0 is a single value used for every item. out may be the same array as a
+// or b.
+
+#ifdef LINGO_SSE2
+// sse2 has no 32-bit multiply that keeps the low halves, so the even and
+// odd lanes are multiplied separately and interleaved
+static inline __m128i mullo_epi32(__m128i a, __m128i b) {
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+#endif
+
+// integer division, which wraps INT32_MIN / -1 back to INT32_MIN as the
+// other ops wrap, rather than trapping. b must not be 0.
+static inline int32_t int_div(int32_t a, int32_t b) {
+    if (b == -1)
+        return (int32_t)(0u - (uint32_t)a);
+    return a / b;
+}
+
+template <bc::opcode OP>
+struct int_op {
+    static inline int32_t apply(int32_t a, int32_t b) {
+        // wrapping, as 32-bit ints do
+        uint32_t x = (uint32_t)a, y = (uint32_t)b;
+        return (int32_t)(OP == bc::OP_ADD ? x + y : OP == bc::OP_SUB ? x - y : x * y);
+    }
+
+#ifdef LINGO_SSE2
+    using vec = __m128i;
+    static constexpr size_t WIDTH = 4;
+    static inline vec load(const int32_t *p) { return _mm_loadu_si128((const vec*)p); }
+    static inline vec set1(int32_t v) { return _mm_set1_epi32(v); }
+    static inline void store(int32_t *p, vec v) { _mm_storeu_si128((vec*)p, v); }
+    static inline vec apply(vec a, vec b) {
+        return OP == bc::OP_ADD ? _mm_add_epi32(a, b)
+             : OP == bc::OP_SUB ? _mm_sub_epi32(a, b)
+             : mullo_epi32(a, b);
+    }
+#endif
+};
+
+template <bc::opcode OP>
+struct float_op {
+    static inline double apply(double a, double b) {
+        return OP == bc::OP_ADD ? a + b
+             : OP == bc::OP_SUB ? a - b
+             : OP == bc::OP_MUL ? a * b
+             : a / b;
+    }
+
+#ifdef LINGO_SSE2
+    using vec = __m128d;
+    static constexpr size_t WIDTH = 2;
+    static inline vec load(const double *p) { return _mm_loadu_pd(p); }
+    static inline vec set1(double v) { return _mm_set1_pd(v); }
+    static inline void store(double *p, vec v) { _mm_storeu_pd(p, v); }
+    static inline vec apply(vec a, vec b) {
+        return OP == bc::OP_ADD ? _mm_add_pd(a, b)
+             : OP == bc::OP_SUB ? _mm_sub_pd(a, b)
+             : OP == bc::OP_MUL ? _mm_mul_pd(a, b)
+             : _mm_div_pd(a, b);
+    }
+#endif
+};
+
+template <typename Op, typename T>
+static void kernel(const T *a, size_t a_step, const T *b, size_t b_step,
+                   T *out, size_t n, bool vector) {
+    size_t i = 0;
+
+#ifdef LINGO_SSE2
+    // unaligned loads and stores, so that out can overlap a or b exactly
+    typename Op::vec va = Op::set1(a[0]);
+    typename Op::vec vb = Op::set1(b[0]);
+    for (; vector && i + Op::WIDTH <= n; i += Op::WIDTH) {
+        if (a_step) va = Op::load(a + i);
+        if (b_step) vb = Op::load(b + i);
+        Op::store(out + i, Op::apply(va, vb));
+    }
+#else
+    (void)vector;
+#endif
+
+    for (; i < n; ++i)
+        out[i] = Op::apply(a[i * a_step], b[i * b_step]);
+}
+
+bool vm::arith_ints(bc::opcode op, const int32_t *a, size_t a_step,
+                    const int32_t *b, size_t b_step, int32_t *out, size_t n,
+                    bool vector) {
+    switch (op) {
+        case bc::OP_ADD: kernel<int_op<bc::OP_ADD>>(a, a_step, b, b_step, out, n, vector); break;
+        case bc::OP_SUB: kernel<int_op<bc::OP_SUB>>(a, a_step, b, b_step, out, n, vector); break;
+        case bc::OP_MUL: kernel<int_op<bc::OP_MUL>>(a, a_step, b, b_step, out, n, vector); break;
+
+        // there is no vector integer division
+        default:
+            for (size_t i = 0; i < n; ++i) {
+                int32_t d = b[i * b_step];
+                if (d == 0) {
+                    std::cerr << "error: division by zero";
+                    return false;
+                }
+
+                out[i] = int_div(a[i * a_step], d);
+            }
+            break;
+    }
+
+    return true;
+}
+
+void vm::arith_floats(bc::opcode op, const double *a, size_t a_step,
+                      const double *b, size_t b_step, double *out, size_t n,
+                      bool vector) {
+    switch (op) {
+        case bc::OP_ADD: kernel<float_op<bc::OP_ADD>>(a, a_step, b, b_step, out, n, vector); break;
+        case bc::OP_SUB: kernel<float_op<bc::OP_SUB>>(a, a_step, b, b_step, out, n, vector); break;
+        case bc::OP_MUL: kernel<float_op<bc::OP_MUL>>(a, a_step, b, b_step, out, n, vector); break;
+        default: kernel<float_op<bc::OP_DIV>>(a, a_step, b, b_step, out, n, vector); break;
+    }
+}
+
+static void ints_to_floats(const int32_t *in, double *out, size_t n) {
+    size_t i = 0;
+#ifdef LINGO_SSE2
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+        _mm_storeu_pd(out + i, _mm_cvtepi32_pd(v));
+        _mm_storeu_pd(out + i + 2, _mm_cvtepi32_pd(_mm_unpackhi_epi64(v, v)));
+    }
+#endif
+    for (; i < n; ++i)
+        out[i] = (double)in[i];
+}
+
+// the components of a geometry value, or a number repeated, as doubles.
+// bit i of float_mask is set if component i is a float.
+struct components {
+    double c[8];
+    uint8_t float_mask;
+};
+
+static void load(const vm::variant &v, size_t n, components *out) {
+    if (is_number(v)) {
+        double x = v.type == bc::TYPE_INT ? (double)v.i32 : v.f64;
+        for (size_t i = 0; i < n; ++i)
+            out->c[i] = x;
+        out->float_mask = v.type == bc::TYPE_FLOAT ? 0xFF : 0;
+    } else {
+        out->float_mask = vm::geom::unpack(v, out->c);
+    }
+}
+
+bool vm::runner::arith(bc::opcode op, const variant *a, const variant *b,
+                       variant *out) {
+    if (a->type == bc::TYPE_LLIST || b->type == bc::TYPE_LLIST)
+        return list_arith(op, a, b, out);
+
+    bc::vtype type;
+    if (geom::is_geom(a->type) &&
+        (b->type == a->type || is_number(*b)))
+    {
+        type = a->type;
+    } else if (geom::is_geom(b->type) && is_number(*a)) {
+        type = b->type;
+    } else {
+        std::cerr << op_name(op) << " invalid operand types";
+        return false;
+    }
+
+    size_t n = geom::component_count(type);
+    components x, y, r;
+    load(*a, n, &x);
+    load(*b, n, &y);
+
+    // ints stay ints, unless the other side is a float. integer components
+    // are integral doubles, so they are exact as int32_t.
+    r.float_mask = (x.float_mask | y.float_mask) & ((1 << n) - 1);
+    for (size_t i = 0; i < n; ++i) {
+        if (r.float_mask & (1 << i)) {
+            switch (op) {
+                case bc::OP_ADD: r.c[i] = x.c[i] + y.c[i]; break;
+                case bc::OP_SUB: r.c[i] = x.c[i] - y.c[i]; break;
+                case bc::OP_MUL: r.c[i] = x.c[i] * y.c[i]; break;
+                default: r.c[i] = x.c[i] / y.c[i]; break;
+            }
+
+            continue;
+        }
+
+        int32_t p = (int32_t)x.c[i];
+        int32_t q = (int32_t)y.c[i];
+        int32_t v;
+        switch (op) {
+            // wrapping, as 32-bit ints do
+            case bc::OP_ADD: v = (int32_t)((uint32_t)p + (uint32_t)q); break;
+            case bc::OP_SUB: v = (int32_t)((uint32_t)p - (uint32_t)q); break;
+            case bc::OP_MUL: v = (int32_t)((uint32_t)p * (uint32_t)q); break;
+            default:
+                if (q == 0) {
+                    std::cerr << "error: division by zero";
+                    return false;
+                }
+
+                v = int_div(p, q);
+                break;
+        }
+
+        r.c[i] = (double)v;
+    }
+
+    // points and colors are built in the variant, and rects and quads come
+    // from the geometry pool, so none of this allocates memory of its own
+    *out = geom::pack(_heap, type, r.c, r.float_mask);
+    return true;
+}
+
+bool vm::runner::negate(variant *v) {
+    if (!geom::is_geom(v->type) && v->type != bc::TYPE_LLIST) {
+        std::cerr << "unm invalid operand";
+        return false;
+    }
+
+    variant zero;
+    zero.type = bc::TYPE_INT;
+    return arith(bc::OP_SUB, &zero, v, v);
+}
+
+// a side of a list operation: a packed list, a number, or something else
+struct operand {
+    const vm::llist *list;
+    bool is_int; // packed ints, or an int
+    bool is_float;
+
+    // the items, or the number as a one-item array
+    const int32_t *ints;
+    const double *floats;
+    size_t step;
+};
+
+static operand classify(const vm::variant &v) {
+    operand o = { nullptr, false, false, nullptr, nullptr, 0 };
+
+    if (v.type == bc::TYPE_LLIST) {
+        o.list = static_cast<vm::llist*>(v.ref);
+        o.is_int = o.list->store() == vm::llist::STORE_INT;
+        o.is_float = o.list->store() == vm::llist::STORE_FLOAT;
+        o.ints = o.list->ints();
+        o.floats = o.list->floats();
+        o.step = 1;
+    } else if (v.type == bc::TYPE_INT) {
+        o.is_int = true;
+        o.ints = &v.i32;
+    } else if (v.type == bc::TYPE_FLOAT) {
+        o.is_float = true;
+        o.floats = &v.f64;
+    }
+
+    return o;
+}
+
+// one item of a list operation, where both are numbers
+static bool number_op(bc::opcode op, const vm::variant &a,
+                      const vm::variant &b, vm::variant *out) {
+    if (a.type == bc::TYPE_INT && b.type == bc::TYPE_INT) {
+        out->type = bc::TYPE_INT;
+        return vm::arith_ints(op, &a.i32, 0, &b.i32, 0, &out->i32, 1);
+    }
+
+    double x = a.type == bc::TYPE_INT ? (double)a.i32 : a.f64;
+    double y = b.type == bc::TYPE_INT ? (double)b.i32 : b.f64;
+    out->type = bc::TYPE_FLOAT;
+    vm::arith_floats(op, &x, 0, &y, 0, &out->f64, 1);
+    return true;
+}
+
+bool vm::runner::list_arith(bc::opcode op, const variant *a, const variant *b,
+                            variant *out) {
+    operand x = classify(*a);
+    operand y = classify(*b);
+
+    size_t n = x.list && y.list ? std::min(x.list->count(), y.list->count())
+             : x.list ? x.list->count()
+             : y.list->count();
+
+    // packed lists and numbers go through the vector kernels. ints stay
+    // ints, and a float on either side makes the result floats.
+    if ((x.is_int || x.is_float) && (y.is_int || y.is_float)) {
+        llist *list;
+
+        if (x.is_int && y.is_int) {
+            list = llist::alloc(_heap, llist::STORE_INT, n);
+            if (n > 0 &&
+                !arith_ints(op, x.ints, x.step, y.ints, y.step, list->ints(), n))
+                return false;
+        } else {
+            list = llist::alloc(_heap, llist::STORE_FLOAT, n);
+            double *items = list->floats();
+            const double *xf = x.floats, *yf = y.floats;
+            double xv = 0.0, yv = 0.0;
+
+            // an int side is converted into the result first, and the
+            // operation then done in place
+            if (x.is_int) {
+                if (x.step) ints_to_floats(x.ints, items, n);
+                else xv = (double)*x.ints;
+                xf = x.step ? items : &xv;
+            } else if (y.is_int) {
+                if (y.step) ints_to_floats(y.ints, items, n);
+                else yv = (double)*y.ints;
+                yf = y.step ? items : &yv;
+            }
+
+            if (n > 0)
+                arith_floats(op, xf, x.step, yf, y.step, items, n);
+        }
+
+        out->type = bc::TYPE_LLIST;
+        out->ref = list;
+        return true;
+    }
+
+    // anything else is done an item at a time. the result is packed if the
+    // items all come out as the same kind of number.
+    llist *list = llist::alloc(_heap, n);
+    for (size_t i = 0; i < n; ++i) {
+        variant p = x.list ? x.list->get(i) : *a;
+        variant q = y.list ? y.list->get(i) : *b;
+        variant r;
+        bool ok = is_number(p) && is_number(q)
+            ? number_op(op, p, q, &r)
+            : arith(op, &p, &q, &r);
+        if (!ok) return false;
+
+        list->add(_heap, r);
+    }
+
+    out->type = bc::TYPE_LLIST;
+    out->ref = list;
+    return true;
+}
@@ -0,0 +1,1289 @@
+#include "vm.hpp"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+using namespace lingo;
+
+void vm::runner::register_builtins() {
+    _builtins = {
+        { "value", &runner::bi_value },
+        { "string", &runner::bi_string },
+        { "offset", &runner::bi_offset },
+        { "point", &runner::bi_point },
+        { "rect", &runner::bi_rect },
+        { "color", &runner::bi_color },
+        { "rgb", &runner::bi_color },
+        { "count", &runner::bi_count },
+        { "getat", &runner::bi_getat },
+        { "setat", &runner::bi_setat },
+        { "getprop", &runner::bi_getprop },
+        { "getaprop", &runner::bi_getaprop },
+        { "setaprop", &runner::bi_setaprop },
+        { "deleteprop", &runner::bi_deleteprop },
+        { "add", &runner::bi_add },
+        { "append", &runner::bi_append },
+        { "addprop", &runner::bi_addprop },
+        { "sort", &runner::bi_sort },
+        { "getpos", &runner::bi_getpos },
+        { "findpos", &runner::bi_findpos },
+        { "duplicate", &runner::bi_duplicate },
+        { "intersect", &runner::bi_intersect },
+        { "union", &runner::bi_union },
+        { "inside", &runner::bi_inside },
+        { "map", &runner::bi_map },
+        { "intersectall", &runner::bi_intersectall },
+        { "insideall", &runner::bi_insideall },
+        { "image", &runner::bi_image },
+        { "copypixels", &runner::bi_copypixels },
+        { "createmask", &runner::bi_createmask },
+        { "creatematte", &runner::bi_creatematte },
+        { "getpixel", &runner::bi_getpixel },
+        { "setpixel", &runner::bi_setpixel },
+        { "fill", &runner::bi_fill },
+        { "getpixelrow", &runner::bi_getpixelrow },
+        { "setpixelrow", &runner::bi_setpixelrow },
+    };
+}
+
+// call the builtin with the given name, with the arguments on top of the
+// stack. they are replaced by the return value.
+bool vm::runner::call(const bc::chunk_const_str *name, uint8_t nargs) {
+    call_cache_entry &e =
+        _call_cache[((uintptr_t)name >> 3) & (CALL_CACHE_SIZE - 1)];
+
+    if (e.name != name || e.key.size() != name->size ||
+        !equal_nocase(e.key.data(), &name->first, name->size))
+    {
+        auto it = _builtins.find(std::string_view(&name->first, name->size));
+        if (it == _builtins.end()) {
+            std::cerr << "error: unknown handler " << &name->first;
+            return false;
+        }
+
+        e.name = name;
+        e.key = it->first;
+        e.fn = it->second;
+    }
+
+    variant *args = _stack_top - nargs;
+    variant ret;
+    if (!(this->*(e.fn))(args, nargs, &ret))
+        return false;
+
+    _stack_top = args;
+    *(_stack_top++) = ret;
+    return true;
+}
+
+static bool check_nargs(const char *name, uint8_t nargs, uint8_t expected) {
+    if (nargs != expected) {
+        std::cerr << "error: " << name << " expects " << (int)expected
+                  << " arguments, got " << (int)nargs;
+        return false;
+    }
+
+    return true;
+}
+
+static inline bool is_number(const vm::variant &v) {
+    return v.type == bc::TYPE_INT || v.type == bc::TYPE_FLOAT;
+}
+
+bool vm::runner::bi_value(variant *args, uint8_t nargs, variant *ret) {
+    if (!check_nargs("value", nargs, 1))
+        return false;
+
+    if (args[0].type != bc::TYPE_STRING) {
+        *ret = args[0];
+        return true;
+    }
+
+    // malformed input evaluates to void
+    if (!parse_value(static_cast<string*>(args[0].ref), ret))
+        ret->type = bc::TYPE_VOID;
+
+    return true;
+}
+
+bool vm::runner::bi_string(variant *args, uint8_t nargs, variant *ret) {
+    if (!check_nargs("string", nargs, 1))
+        return false;
+
+    ret->type = bc::TYPE_STRING;
+    ret->ref = stringify(&args[0]);
+    return true;
+}
+
+// offset(sub, str): the position of the first sub in str, ignoring case, or
+// 0 if there is none. offset(geometry, h, v) is the geometry version.
+bool vm::runner::bi_offset(variant *args, uint8_t nargs, variant *ret) {
+    if (nargs == 3)
+        return offset_geom(args, ret);
+
+    if (!check_nargs("offset", nargs, 2))
+        return false;
+
+    const string *sub = stringify(&args[0]);
+    const string *str = stringify(&args[1]);
+
+    size_t pos;
+    ret->type = bc::TYPE_INT;
+    ret->i32 = find_nocase(str->data(), str->length(),
+                           sub->data(), sub->length(), &pos)
+        ? (int32_t)pos + 1
+        : 0;
+
+    return true;
+}
+
+// point(h, v)
+bool vm::runner::bi_point(variant *args, uint8_t nargs, variant *ret) {
+    if (!check_nargs("point", nargs, 2))
+        return false;
+
+    if (!is_number(args[0]) || !is_number(args[1])) {
+        std::cerr << "error: point expects numbers";
+        return false;
+    }
+
+    *ret = geom::make(_heap, bc::TYPE_POINT, args);
+    return true;
+}
+
+// rect(left, top, right, bottom) or rect(point, point)
+bool vm::runner::bi_rect(variant *args, uint8_t nargs, variant *ret) {
+    variant c[4];
+
+    if (nargs == 2 && args[0].type == bc::TYPE_POINT &&
+        args[1].type == bc::TYPE_POINT)
+    {
+        c[0] = geom::component(args[0], 0);
+        c[1] = geom::component(args[0], 1);
+        c[2] = geom::component(args[1], 0);
+        c[3] = geom::component(args[1], 1);
+    } else {
+        if (!check_nargs("rect", nargs, 4))
+            return false;
+
+        for (int i = 0; i < 4; ++i) {
+            if (!is_number(args[i])) {
+                std::cerr << "error: rect expects numbers";
+                return false;
+            }
+
+            c[i] = args[i];
+        }
+    }
+
+    *ret = geom::make(_heap, bc::TYPE_RECT, c);
+    return true;
+}
+
+// color(r, g, b)
+bool vm::runner::bi_color(variant *args, uint8_t nargs, variant *ret) {
+    if (!check_nargs("color", nargs, 3))
+        return false;
+
+    for (int i = 0; i < 3; ++i) {
+        if (!is_number(args[i])) {
+            std::cerr << "error: color expects numbers";
+            return false;
+        }
+    }
+
+    *ret = geom::make(_heap, bc::TYPE_COLOR, args);
+    return true;
+}
+
+// geometry. a linear list of four points is taken as a quad wherever a quad
+// is, since that is how director gives them.
+
+static bool get_quad(const vm::variant &v, double *q, uint8_t *float_mask) {
+    if (v.type == bc::TYPE_QUAD) {
+        *float_mask = vm::geom::unpack(v, q);
+        return true;
+    }
+
+    if (v.type != bc::TYPE_LLIST)
+        return false;
+
+    const vm::llist *list = static_cast<vm::llist*>(v.ref);
+    if (list->count() != 4)
+        return false;
+
+    *float_mask = 0;
+    for (size_t i = 0; i < 4; ++i) {
+        vm::variant corner = list->get(i);
+        if (corner.type != bc::TYPE_POINT)
+            return false;
+
+        *float_mask |= vm::geom::unpack(corner, q + i * 2) << (i * 2);
+    }
+
+    return true;
+}
+
+// the left, top, right and bottom of a rect, or the bounds of a quad
+static bool get_rect(const vm::variant &v, double *r, uint8_t *float_mask) {
+    if (v.type == bc::TYPE_RECT) {
+        *float_mask = vm::geom::unpack(v, r);
+        return true;
+    }
+
+    double q[8];
+    uint8_t mask;
+    if (!get_quad(v, q, &mask))
+        return false;
+
+    r[0] = r[2] = q[0];
+    r[1] = r[3] = q[1];
+    for (size_t i = 2; i < 8; i += 2) {
+        r[0] = std::min(r[0], q[i]);
+        r[1] = std::min(r[1], q[i + 1]);
+        r[2] = std::max(r[2], q[i]);
+        r[3] = std::max(r[3], q[i + 1]);
+    }
+
+    *float_mask = mask ? 0xF : 0;
+    return true;
+}
+
+static inline bool rects_meet(const double *a, const double *b) {
+    return std::max(a[0], b[0]) < std::min(a[2], b[2]) &&
+           std::max(a[1], b[1]) < std::min(a[3], b[3]);
+}
+
+static inline bool point_in_rect(const double *p, const double *r) {
+    return p[0] >= r[0] && p[0] < r[2] && p[1] >= r[1] && p[1] < r[3];
+}
+
+// even-odd rule, so the quad doesn't need to be convex
+static bool point_in_quad(const double *p, const double *q) {
+    bool in = false;
+    for (size_t i = 0, j = 3; i < 4; j = i++) {
+        double hi = q[i * 2], vi = q[i * 2 + 1];
+        double hj = q[j * 2], vj = q[j * 2 + 1];
+
+        if ((vi > p[1]) != (vj > p[1]) &&
+            p[0] < (hj - hi) * (p[1] - vi) / (vj - vi) + hi)
+            in = !in;
+    }
+
+    return in;
+}
+
+// intersect(rect1, rect2) is the rect where both overlap, or rect(0, 0, 0,
+// 0) if they don't
+bool vm::runner::bi_intersect(variant *args, uint8_t nargs, variant *ret) {
+    if (!check_nargs("intersect", nargs, 2))
+        return false;
+
+    double a[4], b[4];
+    uint8_t ma, mb;
+    if (!get_rect(args[0], a, &ma) || !get_rect(args[1], b, &mb)) {
+        std::cerr << "error: intersect expects rects";
+        return false;
+    }
+
+    double r[4] = { 0.0, 0.0, 0.0, 0.0 };
+    uint8_t mask = 0;
+    if (rects_meet(a, b)) {
+        r[0] = std::max(a[0], b[0]);
+        r[1] = std::max(a[1], b[1]);
+        r[2] = std::min(a[2], b[2]);
+        r[3] = std::min(a[3], b[3]);
+        mask = ma | mb;
+    }
+
+    *ret = geom::pack(_heap, bc::TYPE_RECT, r, mask);
+    return true;
+}
+
+// union(rect1, rect2) is the smallest rect that holds both
+bool vm::runner::bi_union(variant *args, uint8_t nargs, variant *ret) {
+    if (!check_nargs("union", nargs, 2))
+        return false;
+
+    double a[4], b[4];
+    uint8_t ma, mb;
+    if (!get_rect(args[0], a, &ma) || !get_rect(args[1], b, &mb)) {
+        std::cerr << "error: union expects rects";
+        return false;
+    }
+
+    double r[4] = {
+        std::min(a[0], b[0]), std::min(a[1], b[1]),
+        std::max(a[2], b[2]), std::max(a[3], b[3])
+    };
+
+    *ret = geom::pack(_heap, bc::TYPE_RECT, r, ma | mb);
+    return true;
+}
+
+// inside(point, rect) is 1 if the point is in the rect, counting the left
+// and top edges but not the right and bottom. quads are tested against
+// their outline.
+bool vm::runner::bi_inside(variant *args, uint8_t nargs, variant *ret) {
+    if (!check_nargs("inside", nargs, 2))
+        return false;
+
+    double p[2], q[8];
+    uint8_t mask;
+    if (args[0].type != bc::TYPE_POINT) {
+        std::cerr << "error: inside expects a point";
+        return false;
+    }
+    geom::unpack(args[0], p);
+
+    ret->type = bc::TYPE_INT;
+    if (args[1].type == bc::TYPE_RECT) {
+        geom::unpack(args[1], q);
+        ret->i32 = point_in_rect(p, q);
+    } else if (get_quad(args[1], q, &mask)) {
+        ret->i32 = point_in_quad(p, q);
+    } else {
+        std::cerr << "error: inside expects a rect or quad";
+        return false;
+    }
+
+    return true;
+}
+
+// map(geometry, from, to) moves and scales a point, rect or quad from the
+// rect from to the rect to, as they would move and scale together
+bool vm::runner::bi_map(variant *args, uint8_t nargs, variant *ret) {
+    if (!check_nargs("map", nargs, 3))
+        return false;
+
+    double from[4], to[4], c[8];
+    uint8_t m_from, m_to, mask;
+    if (!get_rect(args[1], from, &m_from) || !get_rect(args[2], to, &m_to)) {
+        std::cerr << "error: map expects rects";
+        return false;
+    }
+
+    bc::vtype type = args[0].type;
+    if (type == bc::TYPE_POINT || type == bc::TYPE_RECT) {
+        mask = geom::unpack(args[0], c);
+    } else if (get_quad(args[0], c, &mask)) {
+        type = bc::TYPE_QUAD;
+    } else {
+        std::cerr << "error: map expects a point, rect or quad";
+        return false;
+    }
+
+    // a source with no width or height isn't scaled along it
+    double w = from[2] - from[0], h = from[3] - from[1];
+    double sh = w != 0.0 ? (to[2] - to[0]) / w : 1.0;
+    double sv = h != 0.0 ? (to[3] - to[1]) / h : 1.0;
+
+    // integer components stay integers if the rects are integers too
+    bool floats = m_from || m_to;
+    size_t n = geom::component_count(type);
+    for (size_t i = 0; i < n; i += 2) {
+        c[i] = to[0] + (c[i] - from[0]) * sh;
+        c[i + 1] = to[1] + (c[i + 1] - from[1]) * sv;
+
+        if (!floats) {
+            if (!(mask & (1 << i))) c[i] = std::trunc(c[i]);
+            if (!(mask & (2 << i))) c[i + 1] = std::trunc(c[i + 1]);
+        }
+    }
+
+    if (floats)
+        mask = (uint8_t)((1 << n) - 1);
+
+    *ret = geom::pack(_heap, type, c, mask);
+    return true;
+}
+
+// offset(geometry, h, v) moves a point, rect or quad
+bool vm::runner::offset_geom(variant *args, variant *ret) {
+    double c[8];
+    uint8_t mask;
+    bc::vtype type = args[0].type;
+
+    if (type == bc::TYPE_POINT || type == bc::TYPE_RECT) {
+        mask = geom::unpack(args[0], c);
+    } else if (get_quad(args[0], c, &mask)) {
+        type = bc::TYPE_QUAD;
+    } else {
+        std::cerr << "error: offset expects a point, rect or quad";
+        return false;
+    }
+
+    if (!is_number(args[1]) || !is_number(args[2])) {
+        std::cerr << "error: offset expects numbers";
+        return false;
+    }
+
+    for (size_t i = 0; i < geom::component_count(type); ++i) {
+        const variant &d = args[1 + (i & 1)];
+        if (d.type == bc::TYPE_FLOAT) {
+            c[i] += d.f64;
+            mask |= 1 << i;
+        } else if (mask & (1 << i)) {
+            c[i] += (double)d.i32;
+        } else {
+            c[i] = (double)(int32_t)((uint32_t)(int32_t)c[i] + (uint32_t)d.i32);
+        }
+    }
+
+    *ret = geom::pack(_heap, type, c, mask);
+    return true;
+}
+
+// intersectAll(rects, rect) and insideAll(points, rect) test a whole list
+// against one rect, giving a list of 1s and 0s, so a pass over many props
+// doesn't make a value for each of them
+bool vm::runner::bi_intersectall(variant *args, uint8_t nargs, variant *ret) {
+    if (!check_nargs("intersectAll", nargs, 2))
+        return false;
+
+    double query[4];
+    uint8_t mask;
+    if (args[0].type != bc::TYPE_LLIST || !get_rect(args[1], query, &mask)) {
+        std::cerr << "error: intersectAll expects a list and a rect";
+        return false;
+    }
+
+    const llist *list = static_cast<llist*>(args[0].ref);
+    size_t n = list->count();
+    llist *res = llist::alloc(_heap, llist::STORE_INT, n);
+
+    for (size_t i = 0; i < n; ++i) {
+        double r[4];
+        variant item = list->get(i);
+        if (!get_rect(item, r, &mask)) {
+            std::cerr << "error: intersectAll expects a list of rects";
+            return false;
+        }
+
+        res->ints()[i] = rects_meet(r, query);
+    }
+
+    ret->type = bc::TYPE_LLIST;
+    ret->ref = res;
+    return true;
+}
+
+bool vm::runner::bi_insideall(variant *args, uint8_t nargs, variant *ret) {
+    if (!check_nargs("insideAll", nargs, 2))
+        return false;
+
+    double query[8];
+    uint8_t mask;
+    bool is_rect = args[1].type == bc::TYPE_RECT;
+    if (is_rect)
+        geom::unpack(args[1], query);
+
+    if (args[0].type != bc::TYPE_LLIST ||
+        (!is_rect && !get_quad(args[1], query, &mask)))
+    {
+        std::cerr << "error: insideAll expects a list and a rect or quad";
+        return false;
+    }
+
+    const llist *list = static_cast<llist*>(args[0].ref);
+    size_t n = list->count();
+    llist *res = llist::alloc(_heap, llist::STORE_INT, n);
+
+    for (size_t i = 0; i < n; ++i) {
+        variant item = list->get(i);
+        if (item.type != bc::TYPE_POINT) {
+            std::cerr << "error: insideAll expects a list of points";
+            return false;
+        }
+
+        double p[2];
+        geom::unpack(item, p);
+        res->ints()[i] = is_rect ? point_in_rect(p, query)
+                                 : point_in_quad(p, query);
+    }
+
+    ret->type = bc::TYPE_LLIST;
+    ret->ref = res;
+    return true;
+}
+
+bool vm::runner::bi_count(variant *args, uint8_t nargs, variant *ret) {
+    if (!check_nargs("count", nargs, 1))
+        return false;
+
+    ret->type = bc::TYPE_INT;
+
+    switch (args[0].type) {
+        case bc::TYPE_LLIST:
+            ret->i32 = (int32_t)static_cast<llist*>(args[0].ref)->count();
+            return true;
+
+        case bc::TYPE_PLIST:
+            ret->i32 = (int32_t)static_cast<plist*>(args[0].ref)->count();
+            return true;
+
+        default:
+            std::cerr << "error: count expects a list";
+            return false;
+    }
+}
+
+// list[i] for linear lists, list[i] or list[key] for property lists
+bool vm::runner::get_at(variant *obj, const variant *index) {
+    bool is_count = index->type == bc::TYPE_SYMBOL && index->ref == _sym_count;
+
+    if (obj->type == bc::TYPE_LLIST) {
+        llist *list = static_cast<llist*>(obj->ref);
+
+        if (is_count) {
+            obj->type = bc::TYPE_INT;
+            obj->i32 = (int32_t)list->count();
+            return true;
+        }
+
+        if (index->type != bc::TYPE_INT || index->i32 < 1 ||
+            (size_t)index->i32 > list->count())
+        {
+            std::cerr << "error: index out of range";
+            return false;
+        }
+
+        size_t i = (size_t)index->i32 - 1;
+        *obj = list->get(i);
+
+        // a lazy duplicate hands out lists of its own
+        if (list->lazy() && copied_by_duplicate(obj->type)) {
+            list->unshare(_heap);
+            *obj = list->get(i);
+        }
+
+        return true;
+    }
+
+    if (obj->type == bc::TYPE_PLIST) {
+        const plist *list = static_cast<plist*>(obj->ref);
+
+        if (index->type == bc::TYPE_INT) {
+            if (index->i32 < 1 || (size_t)index->i32 > list->count()) {
+                std::cerr << "error: index out of range";
+                return false;
+            }
+
+            *obj = list->entries()[index->i32 - 1].value;
+            return true;
+        }
+
+        // a #count property is found before the count of the list
+        const plist_entry *e = list->lookup(*index);
+        if (e) {
+            *obj = e->value;
+        } else if (is_count) {
+            obj->type = bc::TYPE_INT;
+            obj->i32 = (int32_t)list->count();
+        } else {
+            obj->type = bc::TYPE_VOID;
+        }
+
+        return true;
+    }
+
+    std::cerr << "error: cannot index value";
+    return false;
+}
+
+bool vm::runner::bi_getat(variant *args, uint8_t nargs, variant *ret) {
+    if (!check_nargs("getAt", nargs, 2))
+        return false;
+
+    *ret = args[0];
+    return get_at(ret, &args[1]);
+}
+
+// setAt(list, i, value). setting past the end of a linear list pads it with
+// zeroes.
+bool vm::runner::bi_setat(variant *args, uint8_t nargs, variant *ret) {
+    if (!check_nargs("setAt", nargs, 3))
+        return false;
+
+    if (args[1].type != bc::TYPE_INT || args[1].i32 < 1) {
+        std::cerr << "error: index out of range";
+        return false;
+    }
+
+    size_t index = (size_t)args[1].i32 - 1;
+
+    if (args[0].type == bc::TYPE_LLIST) {
+        llist *list = static_cast<llist*>(args[0].ref);
+
+        variant zero;
+        zero.type = bc::TYPE_INT;
+        while (list->count() <= index)
+            list->add(_heap, zero);
+
+        list->set(_heap, index, args[2]);
+    } else if (args[0].type == bc::TYPE_PLIST) {
+        plist *list = static_cast<plist*>(args[0].ref);
+        if (index >= list->count()) {
+            std::cerr << "error: index out of range";
+            return false;
+        }
+
+        list->unshare(_heap);
+        list->entries()[index].value = args[2];
+        list->adopt(args[2]);
+    } else {
+        std::cerr << "error: setAt expects a list";
+        return false;
+    }
+
+    ret->type = bc::TYPE_VOID;
+    return true;
+}
+
+bool vm::runner::bi_getprop(variant *args, uint8_t nargs, variant *ret) {
+    if (!check_nargs("getProp", nargs, 2))
+        return false;
+
+    if (args[0].type != bc::TYPE_PLIST) {
+        std::cerr << "error: getProp expects a property list";
+        return false;
+    }
+
+    const plist_entry *e = static_cast<plist*>(args[0].ref)->lookup(args[1]);
+    if (!e) {
+        std::cerr << "error: property not found";
+        return false;
+    }
+
+    *ret = e->value;
+    return true;
+}
+
+// getaProp(list, prop) is getProp, but void if the property is missing
+bool vm::runner::bi_getaprop(variant *args, uint8_t nargs, variant *ret) {
+    if (!check_nargs("getaProp", nargs, 2))
+        return false;
+
+    if (args[0].type != bc::TYPE_PLIST) {
+        std::cerr << "error: getaProp expects a property list";
+        return false;
+    }
+
+    const plist_entry *e = static_cast<plist*>(args[0].ref)->lookup(args[1]);
+    if (!e)
+        ret->type = bc::TYPE_VOID;
+    else
+        *ret = e->value;
+
+    return true;
+}
+
+// setaProp(list, prop, value) changes the property, or adds it if missing
+bool vm::runner::bi_setaprop(variant *args, uint8_t nargs, variant *ret) {
+    if (!check_nargs("setaProp", nargs, 3))
+        return false;
+
+    if (args[0].type != bc::TYPE_PLIST) {
+        std::cerr << "error: setaProp expects a property list";
+        return false;
+    }
+
+    plist *list = static_cast<plist*>(args[0].ref);
+    if (list->sorted() && !list->lookup(args[1]))
+        list->insert(_heap, sorted_bound(list, args[1], true), args[1], args[2]);
+    else
+        list->set(_heap, args[1], args[2]);
+
+    ret->type = bc::TYPE_VOID;
+    return true;
+}
+
+// deleteProp(list, prop) removes the first entry with the property, if any
+bool vm::runner::bi_deleteprop(variant *args, uint8_t nargs, variant *ret) {
+    if (!check_nargs("deleteProp", nargs, 2))
+        return false;
+
+    if (args[0].type != bc::TYPE_PLIST) {
+        std::cerr << "error: deleteProp expects a property list";
+        return false;
+    }
+
+    static_cast<plist*>(args[0].ref)->remove(_heap, args[1]);
+
+    ret->type = bc::TYPE_VOID;
+    return true;
+}
+
+// add(list, value) adds to the end of the list, or in order if the list is
+// sorted
+bool vm::runner::bi_add(variant *args, uint8_t nargs, variant *ret) {
+    if (!check_nargs("add", nargs, 2))
+        return false;
+
+    if (args[0].type != bc::TYPE_LLIST) {
+        std::cerr << "error: add expects a linear list";
+        return false;
+    }
+
+    llist *list = static_cast<llist*>(args[0].ref);
+    if (list->sorted())
+        list->insert(_heap, sorted_bound(list, args[1], true), args[1]);
+    else
+        list->add(_heap, args[1]);
+
+    ret->type = bc::TYPE_VOID;
+    return true;
+}
+
+// append(list, value) always adds to the end, so the list is no longer
+// sorted
+bool vm::runner::bi_append(variant *args, uint8_t nargs, variant *ret) {
+    if (!check_nargs("append", nargs, 2))
+        return false;
+
+    if (args[0].type != bc::TYPE_LLIST) {
+        std::cerr << "error: append expects a linear list";
+        return false;
+    }
+
+    static_cast<llist*>(args[0].ref)->add(_heap, args[1]);
+    ret->type = bc::TYPE_VOID;
+    return true;
+}
+
+bool vm::runner::bi_addprop(variant *args, uint8_t nargs, variant *ret) {
+    if (!check_nargs("addProp", nargs, 3))
+        return false;
+
+    if (args[0].type != bc::TYPE_PLIST) {
+        std::cerr << "error: addProp expects a property list";
+        return false;
+    }
+
+    plist *list = static_cast<plist*>(args[0].ref);
+    if (list->sorted())
+        list->insert(_heap, sorted_bound(list, args[1], true), args[1], args[2]);
+    else
+        list->add(_heap, args[1], args[2]);
+
+    ret->type = bc::TYPE_VOID;
+    return true;
+}
+
+// sort(list) sorts a linear list by value, or a property list by property,
+// and keeps it sorted from then on
+bool vm::runner::bi_sort(variant *args, uint8_t nargs, variant *ret) {
+    if (!check_nargs("sort", nargs, 1))
+        return false;
+
+    if (args[0].type == bc::TYPE_LLIST) {
+        sort_list(static_cast<llist*>(args[0].ref));
+    } else if (args[0].type == bc::TYPE_PLIST) {
+        sort_list(static_cast<plist*>(args[0].ref));
+    } else {
+        std::cerr << "error: sort expects a list";
+        return false;
+    }
+
+    ret->type = bc::TYPE_VOID;
+    return true;
+}
+
+// getPos(list, value) is the position of the first item (or property list
+// value) equal to the value, or 0
+bool vm::runner::bi_getpos(variant *args, uint8_t nargs, variant *ret) {
+    if (!check_nargs("getPos", nargs, 2))
+        return false;
+
+    ret->type = bc::TYPE_INT;
+    ret->i32 = 0;
+
+    if (args[0].type == bc::TYPE_LLIST) {
+        llist *list = static_cast<llist*>(args[0].ref);
+        size_t i = 0;
+
+        // lists and images are found by identity, and a lazy duplicate's
+        // aren't its own yet
+        if (list->lazy() && copied_by_duplicate(args[1].type))
+            list->unshare(_heap);
+
+        // items equal to the value are together in a sorted list, starting
+        // where it would be inserted
+        if (list->sorted())
+            i = sorted_bound(list, args[1], false);
+
+        for (; i < list->count(); ++i) {
+            variant item = list->get(i);
+            if (plist::key_equal(item, args[1])) {
+                ret->i32 = (int32_t)i + 1;
+                break;
+            }
+
+            if (list->sorted() && sort_order(item, args[1]) != 0)
+                break;
+        }
+    } else if (args[0].type == bc::TYPE_PLIST) {
+        const plist *list = static_cast<plist*>(args[0].ref);
+        for (size_t i = 0; i < list->count(); ++i) {
+            if (plist::key_equal(list->entries()[i].value, args[1])) {
+                ret->i32 = (int32_t)i + 1;
+                break;
+            }
+        }
+    } else {
+        std::cerr << "error: getPos expects a list";
+        return false;
+    }
+
+    return true;
+}
+
+// findPos(list, prop) is the position of the property, or void
+bool vm::runner::bi_findpos(variant *args, uint8_t nargs, variant *ret) {
+    if (!check_nargs("findPos", nargs, 2))
+        return false;
+
+    if (args[0].type != bc::TYPE_PLIST) {
+        std::cerr << "error: findPos expects a property list";
+        return false;
+    }
+
+    // sorted or not, large property lists are found through their hash
+    // index, which beats a binary search
+    ptrdiff_t pos = static_cast<plist*>(args[0].ref)->find(args[1]);
+    if (pos < 0) {
+        ret->type = bc::TYPE_VOID;
+    } else {
+        ret->type = bc::TYPE_INT;
+        ret->i32 = (int32_t)pos + 1;
+    }
+
+    return true;
+}
+
+// duplicate(value) copies lists, including the lists inside them. the copy
+// shares its items with the original until either of them is changed.
+bool vm::runner::bi_duplicate(variant *args, uint8_t nargs, variant *ret) {
+    if (!check_nargs("duplicate", nargs, 1))
+        return false;
+
+    *ret = duplicate(_heap, args[0]);
+    return true;
+}
+
+// image(width, height, bitDepth): a new white image, of depth 8 or 32
+bool vm::runner::bi_image(variant *args, uint8_t nargs, variant *ret) {
+    if (!check_nargs("image", nargs, 3))
+        return false;
+
+    for (int i = 0; i < 3; ++i) {
+        if (args[i].type != bc::TYPE_INT) {
+            std::cerr << "error: image expects integers";
+            return false;
+        }
+    }
+
+    if (args[0].i32 <= 0 || args[1].i32 <= 0) {
+        std::cerr << "error: image size must be positive";
+        return false;
+    }
+
+    if (args[2].i32 != 8 && args[2].i32 != 32) {
+        std::cerr << "error: image depth must be 8 or 32";
+        return false;
+    }
+
+    ret->type = bc::TYPE_IMAGE;
+    ret->ref = image::alloc(_heap, args[0].i32, args[1].i32,
+                            (uint8_t)args[2].i32);
+    return true;
+}
+
+static void rect_to_ints(const vm::variant &v, int32_t *r) {
+    double c[4];
+    vm::geom::unpack(v, c);
+    for (int i = 0; i < 4; ++i)
+        r[i] = (int32_t)c[i];
+}
+
+static inline uint32_t color_rgb(const vm::variant &v) {
+    return (uint32_t)v.rgb[0] << 16 | (uint32_t)v.rgb[1] << 8 | v.rgb[2];
+}
+
+// read the #ink, #blend, #color, #bgColor and #maskImage of a copyPixels
+// params list. other params are ignored.
+static bool read_blit_params(const vm::plist *list, const vm::image *src,
+                             vm::blit_params *out) {
+    for (size_t i = 0; i < list->count(); ++i) {
+        const vm::plist_entry &e = list->entries()[i];
+        if (e.key.type != bc::TYPE_SYMBOL) continue;
+
+        const vm::string *key = static_cast<vm::string*>(e.key.ref);
+        auto is = [key](const char *name) {
+            size_t len = strlen(name);
+            return key->length() == len &&
+                   vm::equal_nocase(key->data(), name, len);
+        };
+
+        if (is("ink") || is("blend")) {
+            if (e.value.type != bc::TYPE_INT) {
+                std::cerr << "error: copyPixels expects an integer #ink and #blend";
+                return false;
+            }
+
+            if (is("ink")) out->ink = (uint8_t)e.value.i32;
+            else out->blend = e.value.i32;
+        } else if (is("color") || is("bgcolor")) {
+            if (e.value.type != bc::TYPE_COLOR) {
+                std::cerr << "error: copyPixels expects a color";
+                return false;
+            }
+
+            if (is("color")) {
+                out->color = color_rgb(e.value);
+                out->colorize = true;
+            } else {
+                out->bg_color = color_rgb(e.value);
+            }
+        } else if (is("maskimage")) {
+            const vm::image *mask = e.value.type == bc::TYPE_IMAGE
+                ? static_cast<vm::image*>(e.value.ref)
+                : nullptr;
+
+            if (!mask || mask->depth() != 8 ||
+                mask->width() != src->width() ||
+                mask->height() != src->height())
+            {
+                std::cerr << "error: copyPixels expects an 8-bit #maskImage "
+                             "the size of the source";
+                return false;
+            }
+
+            out->mask = mask;
+        }
+    }
+
+    return true;
+}
+
+// copyPixels(dest, src, destRect, srcRect, [params]): copy the srcRect
+// part of src into the destRect part of dest, scaling it to fit
+bool vm::runner::bi_copypixels(variant *args, uint8_t nargs, variant *ret) {
+    if (nargs != 4 && nargs != 5) {
+        std::cerr << "error: copyPixels expects 4 or 5 arguments, got "
+                  << (int)nargs;
+        return false;
+    }
+
+    if (args[0].type != bc::TYPE_IMAGE || args[1].type != bc::TYPE_IMAGE) {
+        std::cerr << "error: copyPixels expects images";
+        return false;
+    }
+
+    // the destination can also be a quad, or a list of four points
+    double dst_quad[8];
+    uint8_t float_mask;
+    bool quad = args[2].type != bc::TYPE_RECT &&
+                get_quad(args[2], dst_quad, &float_mask);
+    if ((args[2].type != bc::TYPE_RECT && !quad) ||
+        args[3].type != bc::TYPE_RECT) {
+        std::cerr << "error: copyPixels expects a rect or quad and a rect";
+        return false;
+    }
+
+    if (nargs == 5 && args[4].type != bc::TYPE_PLIST) {
+        std::cerr << "error: copyPixels expects a property list of params";
+        return false;
+    }
+
+    image *dst = static_cast<image*>(args[0].ref);
+    image *src = static_cast<image*>(args[1].ref);
+
+    blit_params params;
+    if (nargs == 5 &&
+        !read_blit_params(static_cast<plist*>(args[4].ref), src, &params))
+        return false;
+
+    int32_t dst_rect[4], src_rect[4];
+    rect_to_ints(args[3], src_rect);
+    dst->unshare(_heap);
+
+    bool ok;
+    if (quad) {
+        ok = copy_pixels_quad(*dst, dst_quad, *src, src_rect, params);
+    } else {
+        rect_to_ints(args[2], dst_rect);
+        ok = copy_pixels(*dst, dst_rect, *src, src_rect, params);
+    }
+
+    if (!ok) {
+        std::cerr << "error: copyPixels doesn't support ink "
+                  << (int)params.ink;
+        return false;
+    }
+
+    ret->type = bc::TYPE_VOID;
+    return true;
+}
+
+// a heap copy of one of an image's planes, which are made once and kept
+static bool copy_plane(vm::gc_heap &heap, const char *name,
+                       const vm::variant *args, uint8_t nargs,
+                       vm::variant *ret, bool matte) {
+    if (nargs != 1 || args[0].type != bc::TYPE_IMAGE) {
+        std::cerr << "error: " << name << " expects an image";
+        return false;
+    }
+
+    const vm::image *img = static_cast<vm::image*>(args[0].ref);
+    const vm::image &plane = matte ? img->matte() : img->mask();
+
+    vm::image *copy = vm::image::alloc(heap, plane.width(), plane.height(), 8);
+    memcpy(copy->row(0), plane.row(0), plane.bytes());
+
+    ret->type = bc::TYPE_IMAGE;
+    ret->ref = copy;
+    return true;
+}
+
+bool vm::runner::bi_createmask(variant *args, uint8_t nargs, variant *ret) {
+    return copy_plane(_heap, "createMask", args, nargs, ret, false);
+}
+
+bool vm::runner::bi_creatematte(variant *args, uint8_t nargs, variant *ret) {
+    return copy_plane(_heap, "createMatte", args, nargs, ret, true);
+}
+
+// the x and y of a pixel from either two ints or a point at args[1].
+// returns the number of arguments used, or 0 if there aren't any of those.
+static uint8_t pixel_pos(const vm::variant *args, uint8_t nargs, int32_t *x,
+                         int32_t *y) {
+    if (nargs >= 2 && args[1].type == bc::TYPE_POINT) {
+        int32_t c[2];
+        for (int i = 0; i < 2; ++i) {
+            if (!(args[1].float_mask & (1 << i))) {
+                c[i] = args[1].pt[i].i;
+                continue;
+            }
+
+            // float components too big for an int are outside anyway
+            double f = std::floor(args[1].pt[i].f);
+            c[i] = f >= 0 && f < INT32_MAX ? (int32_t)f : -1;
+        }
+
+        *x = c[0];
+        *y = c[1];
+        return 1;
+    }
+
+    if (nargs >= 3 && args[1].type == bc::TYPE_INT &&
+        args[2].type == bc::TYPE_INT) {
+        *x = args[1].i32;
+        *y = args[2].i32;
+        return 2;
+    }
+
+    return 0;
+}
+
+// the stored form of a color, or of an integer: 0xRRGGBB at 32 bits and a
+// palette index at 8
+static bool pixel_value(const vm::image *img, const vm::variant &v,
+                        uint32_t *out) {
+    if (v.type == bc::TYPE_COLOR) {
+        *out = img->pixel_of(color_rgb(v));
+        return true;
+    }
+
+    if (v.type == bc::TYPE_INT) {
+        *out = img->depth() == 32
+            ? 0xFF000000 | ((uint32_t)v.i32 & 0xFFFFFF)
+            : (uint32_t)std::min(std::max(v.i32, 0), 255);
+        return true;
+    }
+
+    return false;
+}
+
+// getPixel(image, x, y, [#integer]) or getPixel(image, point, [#integer]):
+// the color of a pixel, or void outside the image. with #integer, the
+// color is returned as 0xRRGGBB, or as the palette index of an 8-bit
+// image, which needs no color value to be made.
+bool vm::runner::bi_getpixel(variant *args, uint8_t nargs, variant *ret) {
+    int32_t x, y;
+    uint8_t used = nargs > 0 && args[0].type == bc::TYPE_IMAGE
+        ? pixel_pos(args, nargs, &x, &y)
+        : 0;
+
+    bool as_int = nargs == used + 2 &&
+                  args[used + 1].type == bc::TYPE_SYMBOL &&
+                  args[used + 1].ref == _sym_integer;
+    if (used == 0 || (nargs != used + 1 && !as_int)) {
+        std::cerr << "error: getPixel expects an image and a point";
+        return false;
+    }
+
+    const image *img = static_cast<image*>(args[0].ref);
+    if (x < 0 || y < 0 || x >= img->width() || y >= img->height()) {
+        ret->type = bc::TYPE_VOID;
+        return true;
+    }
+
+    uint32_t pixel = img->pixel(x, y);
+    if (as_int) {
+        ret->type = bc::TYPE_INT;
+        ret->i32 = (int32_t)(img->depth() == 32 ? pixel & 0xFFFFFF : pixel);
+        return true;
+    }
+
+    uint32_t rgb = img->rgb_of(pixel);
+    ret->type = bc::TYPE_COLOR;
+    ret->ref = nullptr; // so that unused bytes of colors compare equal
+    ret->rgb[0] = (uint8_t)(rgb >> 16);
+    ret->rgb[1] = (uint8_t)(rgb >> 8);
+    ret->rgb[2] = (uint8_t)rgb;
+    return true;
+}
+
+// setPixel(image, x, y, color) or setPixel(image, point, color), where
+// color can also be an integer as getPixel returns it. returns 1, or 0 if
+// the pixel is outside the image.
+bool vm::runner::bi_setpixel(variant *args, uint8_t nargs, variant *ret) {
+    int32_t x, y;
+    uint32_t value;
+    uint8_t used = nargs > 0 && args[0].type == bc::TYPE_IMAGE
+        ? pixel_pos(args, nargs, &x, &y)
+        : 0;
+
+    image *img = static_cast<image*>(args[0].ref);
+    if (used == 0 || nargs != used + 2 ||
+        !pixel_value(img, args[used + 1], &value))
+    {
+        std::cerr << "error: setPixel expects an image, a point and a color";
+        return false;
+    }
+
+    bool inside = x >= 0 && y >= 0 && x < img->width() && y < img->height();
+    if (inside) {
+        img->unshare(_heap);
+        img->set_pixel(x, y, value);
+    }
+
+    ret->type = bc::TYPE_INT;
+    ret->i32 = inside;
+    return true;
+}
+
+// fill(image, rect, color): set the pixels of rect to color, which can also
+// be an integer as getPixel returns it
+bool vm::runner::bi_fill(variant *args, uint8_t nargs, variant *ret) {
+    uint32_t value;
+    if (nargs != 3 || args[0].type != bc::TYPE_IMAGE ||
+        args[1].type != bc::TYPE_RECT ||
+        !pixel_value(static_cast<image*>(args[0].ref), args[2], &value))
+    {
+        std::cerr << "error: fill expects an image, a rect and a color";
+        return false;
+    }
+
+    int32_t rect[4];
+    rect_to_ints(args[1], rect);
+
+    image *img = static_cast<image*>(args[0].ref);
+    img->unshare(_heap);
+    img->fill(rect, value);
+
+    ret->type = bc::TYPE_INT;
+    ret->i32 = 1;
+    return true;
+}
+
+// getPixelRow(image, y): the pixels of a row as a list of integers, as
+// getPixel(image, x, y, #integer) returns them
+bool vm::runner::bi_getpixelrow(variant *args, uint8_t nargs, variant *ret) {
+    if (nargs != 2 || args[0].type != bc::TYPE_IMAGE ||
+        args[1].type != bc::TYPE_INT)
+    {
+        std::cerr << "error: getPixelRow expects an image and an integer";
+        return false;
+    }
+
+    const image *img = static_cast<image*>(args[0].ref);
+    int32_t y = args[1].i32;
+    if (y < 0 || y >= img->height()) {
+        std::cerr << "error: getPixelRow row " << y << " is outside the image";
+        return false;
+    }
+
+    size_t n = (size_t)img->width();
+    llist *list = llist::alloc(_heap, llist::STORE_INT, n);
+    int32_t *out = list->ints();
+    if (img->depth() == 32) {
+        const uint32_t *in = (const uint32_t*)img->row(y);
+        for (size_t i = 0; i < n; ++i)
+            out[i] = (int32_t)(in[i] & 0xFFFFFF);
+    } else {
+        const uint8_t *in = img->row(y);
+        for (size_t i = 0; i < n; ++i)
+            out[i] = in[i];
+    }
+
+    ret->type = bc::TYPE_LLIST;
+    ret->ref = list;
+    return true;
+}
+
+// setPixelRow(image, y, list): set the pixels of a row from a list of
+// colors or integers, starting at the left. items past the right edge are
+// ignored.
+bool vm::runner::bi_setpixelrow(variant *args, uint8_t nargs, variant *ret) {
+    if (nargs != 3 || args[0].type != bc::TYPE_IMAGE ||
+        args[1].type != bc::TYPE_INT || args[2].type != bc::TYPE_LLIST)
+    {
+        std::cerr << "error: setPixelRow expects an image, an integer and a "
+                     "list";
+        return false;
+    }
+
+    image *img = static_cast<image*>(args[0].ref);
+    const llist *list = static_cast<llist*>(args[2].ref);
+    int32_t y = args[1].i32;
+    if (y < 0 || y >= img->height()) {
+        std::cerr << "error: setPixelRow row " << y << " is outside the image";
+        return false;
+    }
+
+    size_t n = std::min(list->count(), (size_t)img->width());
+    img->unshare(_heap);
+    uint8_t *out = img->row(y);
+
+    // lists of integers are stored packed, so they need no conversion
+    // item by item
+    if (list->store() == llist::STORE_INT) {
+        const int32_t *in = list->ints();
+        if (img->depth() == 32) {
+            for (size_t i = 0; i < n; ++i)
+                ((uint32_t*)out)[i] = 0xFF000000 | ((uint32_t)in[i] & 0xFFFFFF);
+        } else {
+            for (size_t i = 0; i < n; ++i)
+                out[i] = (uint8_t)std::min(std::max(in[i], 0), 255);
+        }
+    } else {
+        for (size_t i = 0; i < n; ++i) {
+            uint32_t value;
+            if (!pixel_value(img, list->get(i), &value)) {
+                std::cerr << "error: setPixelRow expects colors or integers";
+                img->changed();
+                return false;
+            }
+
+            if (img->depth() == 32)
+                ((uint32_t*)out)[i] = value;
+            else
+                out[i] = (uint8_t)value;
+        }
+    }
+
+    img->changed();
+    ret->type = bc::TYPE_VOID;
+    return true;
+}
@@ -0,0 +1,181 @@
+#include "vm.hpp"
+
+using namespace lingo;
+
+static inline bool is_word_space(char ch) {
+    return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n';
+}
+
+// length of the chunk delimiter at chars[i], or 0 if there is none.
+// lines may be separated by \r, \n or \r\n.
+static inline size_t delim_length(const char *chars, size_t len, size_t i,
+                                  vm::chunk_type type, char item_delim) {
+    if (type == vm::CHUNK_ITEM)
+        return chars[i] == item_delim ? 1 : 0;
+
+    if (chars[i] == '\n') return 1;
+    if (chars[i] == '\r')
+        return (i + 1 < len && chars[i + 1] == '\n') ? 2 : 1;
+
+    return 0;
+}
+
+// call f(start, end) for each word, item or line of the characters, in order,
+// until it returns false. words are runs of characters that are not
+// whitespace. items and lines are the (possibly empty) ranges between
+// delimiters. an empty string has no chunks.
+template <typename F>
+static void scan_chunks(const char *chars, size_t len, vm::chunk_type type,
+                        char item_delim, F &&f) {
+    if (type == vm::CHUNK_WORD) {
+        size_t i = 0;
+
+        while (true) {
+            while (i < len && is_word_space(chars[i])) ++i;
+            if (i == len) return;
+
+            size_t start = i;
+            while (i < len && !is_word_space(chars[i])) ++i;
+
+            if (!f(start, i)) return;
+        }
+    }
+
+    if (len == 0) return;
+
+    size_t start = 0;
+    size_t i = 0;
+
+    while (i < len) {
+        size_t dlen = delim_length(chars, len, i, type, item_delim);
+        if (dlen == 0) {
+            ++i;
+            continue;
+        }
+
+        if (!f(start, i)) return;
+
+        i += dlen;
+        start = i;
+    }
+
+    f(start, len);
+}
+
+const std::vector<size_t>& vm::string::chunk_bounds(gc_heap &heap,
+                                                    chunk_type type,
+                                                    char item_delim) const {
+    assert(type != CHUNK_CHAR);
+
+    if (!_chunks) {
+        _chunks = new chunk_table;
+        heap.grow(sizeof(chunk_table));
+    }
+
+    std::vector<size_t> *bounds;
+
+    if (type == CHUNK_ITEM) {
+        for (size_t i = 0; i < _chunks->item_count; ++i) {
+            if (_chunks->items[i].delim == item_delim)
+                return _chunks->items[i].bounds;
+        }
+
+        // take a free slot, or reuse the oldest one
+        size_t slot;
+        if (_chunks->item_count < chunk_table::ITEM_DELIMS) {
+            slot = _chunks->item_count++;
+        } else {
+            slot = _chunks->item_next;
+            _chunks->item_next = (slot + 1) % chunk_table::ITEM_DELIMS;
+        }
+
+        _chunks->items[slot].delim = item_delim;
+        bounds = &_chunks->items[slot].bounds;
+    } else {
+        bool &built = type == CHUNK_WORD ? _chunks->words_built
+                                         : _chunks->lines_built;
+        bounds = type == CHUNK_WORD ? &_chunks->words : &_chunks->lines;
+
+        if (built) return *bounds;
+        built = true;
+    }
+
+    // a reused slot keeps its memory, so only growth is charged
+    size_t old_capacity = bounds->capacity();
+
+    bounds->clear();
+    scan_chunks(data(), _length, type, item_delim,
+        [&](size_t start, size_t end) {
+            bounds->push_back(start);
+            bounds->push_back(end);
+            return true;
+        });
+
+    if (old_capacity == 0)
+        bounds->shrink_to_fit();
+
+    if (bounds->capacity() > old_capacity)
+        heap.grow((bounds->capacity() - old_capacity) * sizeof(size_t));
+
+    return *bounds;
+}
+
+bool vm::find_chunk(gc_heap &heap, const string *str, chunk_type type,
+                    char item_delim, int32_t from, int32_t to, size_t *start,
+                    size_t *end) {
+    if (to < from) to = from;
+    if (from < 1) return false;
+
+    size_t len = str->length();
+
+    if (type == CHUNK_CHAR) {
+        if ((size_t)from > len) return false;
+        if ((size_t)to > len) to = (int32_t)len;
+
+        *start = (size_t)from - 1;
+        *end = (size_t)to;
+        return true;
+    }
+
+    if (len >= chunk_table::MIN_LENGTH) {
+        const std::vector<size_t> &bounds =
+            str->chunk_bounds(heap, type, item_delim);
+        size_t count = bounds.size() / 2;
+
+        if ((size_t)from > count) return false;
+        if ((size_t)to > count) to = (int32_t)count;
+
+        *start = bounds[((size_t)from - 1) * 2];
+        *end = bounds[((size_t)to - 1) * 2 + 1];
+        return true;
+    }
+
+    int32_t index = 0;
+    scan_chunks(str->data(), len, type, item_delim,
+        [&](size_t chunk_start, size_t chunk_end) {
+            ++index;
+            if (index == from) *start = chunk_start;
+            if (index >= from) *end = chunk_end;
+            return index != to;
+        });
+
+    return index >= from;
+}
+
+size_t vm::count_chunks(gc_heap &heap, const string *str, chunk_type type,
+                        char item_delim) {
+    if (type == CHUNK_CHAR)
+        return str->length();
+
+    if (str->length() >= chunk_table::MIN_LENGTH)
+        return str->chunk_bounds(heap, type, item_delim).size() / 2;
+
+    size_t count = 0;
+    scan_chunks(str->data(), str->length(), type, item_delim,
+        [&](size_t, size_t) {
+            ++count;
+            return true;
+        });
+
+    return count;
+}
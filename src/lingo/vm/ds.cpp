@@ -1,6 +1,1474 @@
 #include "vm.hpp"
+#include <algorithm>
+#include <new>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define LINGO_SSE2
+#include <emmintrin.h>
+#endif
 
 using namespace lingo;
 
+static constexpr uint64_t HASH_K0 = 0x9E3779B97F4A7C15ull;
+static constexpr uint64_t HASH_K1 = 0xFF51AFD7ED558CCDull;
+static constexpr uint64_t HASH_K2 = 0xC4CEB9FE1A85EC53ull;
+
+static inline uint64_t hash_mix(uint64_t h, uint64_t w) {
+    h ^= w * HASH_K0;
+    h = (h << 27) | (h >> 37);
+    return h * HASH_K1 + HASH_K0;
+}
+
+// murmur3 finalizer
+static inline uint64_t hash_fmix(uint64_t h) {
+    h ^= h >> 33;
+    h *= HASH_K1;
+    h ^= h >> 33;
+    h *= HASH_K2;
+    h ^= h >> 33;
+    return h;
+}
+
+size_t vm::hash_bytes(const char *data, size_t len) {
+    uint64_t h = (uint64_t)len * HASH_K2;
+    uint64_t w;
+
+    while (len >= 8) {
+        memcpy(&w, data, 8);
+        h = hash_mix(h, w);
+        data += 8;
+        len -= 8;
+    }
+
+    if (len > 0) {
+        w = 0;
+        memcpy(&w, data, len);
+        h = hash_mix(h, w);
+    }
+
+    return (size_t) hash_fmix(h);
+}
+
+// lingo compares strings without regard to case. ascii letters and the
+// latin-1 letters from 0xC0 to 0xDE (but not the multiplication sign, 0xD7)
+// are folded to lowercase.
+struct fold_table {
+    uint8_t map[256];
+
+    constexpr fold_table() : map() {
+        for (int ch = 0; ch < 256; ++ch) {
+            bool upper = (ch >= 'A' && ch <= 'Z') ||
+                         (ch >= 0xC0 && ch <= 0xDE && ch != 0xD7);
+            map[ch] = (uint8_t)(upper ? ch | 0x20 : ch);
+        }
+    }
+};
+
+static constexpr fold_table FOLD;
+
+static inline uint8_t fold_char(uint8_t ch) {
+    return FOLD.map[ch];
+}
+
+#ifdef LINGO_SSE2
+// fold 16 characters at once. sse2 only has signed byte compares, so each
+// range check is shifted to start at -128.
+static inline __m128i fold16(__m128i v) {
+    const __m128i ascii = _mm_cmplt_epi8(
+        _mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - 'A'))),
+        _mm_set1_epi8((char)(0x80 + 26)));
+
+    const __m128i latin1 = _mm_andnot_si128(
+        _mm_cmpeq_epi8(v, _mm_set1_epi8((char)0xD7)),
+        _mm_cmplt_epi8(
+            _mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - 0xC0))),
+            _mm_set1_epi8((char)(0x80 + 31))));
+
+    const __m128i upper = _mm_or_si128(ascii, latin1);
+    return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+// bit i is set if a[i] and b[i] differ after folding
+static inline unsigned diff16(const char *a, const char *b) {
+    __m128i va = fold16(_mm_loadu_si128((const __m128i*)a));
+    __m128i vb = fold16(_mm_loadu_si128((const __m128i*)b));
+    return ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) & 0xFFFF;
+}
+#endif
+
+// same as hash_bytes over the folded characters
+size_t vm::hash_bytes_nocase(const char *data, size_t len) {
+    uint64_t h = (uint64_t)len * HASH_K2;
+    uint64_t w[2];
+
+#ifdef LINGO_SSE2
+    while (len >= 16) {
+        __m128i v = fold16(_mm_loadu_si128((const __m128i*)data));
+        _mm_storeu_si128((__m128i*)w, v);
+        h = hash_mix(h, w[0]);
+        h = hash_mix(h, w[1]);
+        data += 16;
+        len -= 16;
+    }
+#endif
+
+    uint8_t buf[8];
+    while (len >= 8) {
+        for (int i = 0; i < 8; ++i)
+            buf[i] = fold_char((uint8_t)data[i]);
+        memcpy(w, buf, 8);
+        h = hash_mix(h, w[0]);
+        data += 8;
+        len -= 8;
+    }
+
+    if (len > 0) {
+        memset(buf, 0, 8);
+        for (size_t i = 0; i < len; ++i)
+            buf[i] = fold_char((uint8_t)data[i]);
+        memcpy(w, buf, 8);
+        h = hash_mix(h, w[0]);
+    }
+
+    return (size_t) hash_fmix(h);
+}
+
+bool vm::equal_nocase(const char *a, const char *b, size_t len) {
+    size_t i = 0;
+
+#ifdef LINGO_SSE2
+    for (; i + 16 <= len; i += 16) {
+        if (diff16(a + i, b + i))
+            return false;
+    }
+#endif
+
+    for (; i < len; ++i) {
+        if (fold_char((uint8_t)a[i]) != fold_char((uint8_t)b[i]))
+            return false;
+    }
+
+    return true;
+}
+
+int vm::compare_nocase(const char *a, size_t a_len,
+                       const char *b, size_t b_len) {
+    size_t len = a_len < b_len ? a_len : b_len;
+    size_t i = 0;
+
+#ifdef LINGO_SSE2
+    for (; i + 16 <= len; i += 16) {
+        unsigned diff = diff16(a + i, b + i);
+        if (diff) {
+            i += (size_t)__builtin_ctz(diff);
+            return (int)fold_char((uint8_t)a[i]) - (int)fold_char((uint8_t)b[i]);
+        }
+    }
+#endif
+
+    for (; i < len; ++i) {
+        int d = (int)fold_char((uint8_t)a[i]) - (int)fold_char((uint8_t)b[i]);
+        if (d != 0) return d;
+    }
+
+    return a_len < b_len ? -1 : a_len > b_len ? 1 : 0;
+}
+
+// candidates are positions where both the first and the last character of
+// the needle match, which are then checked in full. with sse2, 16
+// candidates are tested at once.
+bool vm::find_nocase(const char *hay, size_t hay_len,
+                     const char *needle, size_t needle_len, size_t *pos) {
+    if (needle_len == 0) {
+        *pos = 0;
+        return true;
+    }
+
+    if (needle_len > hay_len)
+        return false;
+
+    const size_t last_start = hay_len - needle_len;
+    const uint8_t first_ch = fold_char((uint8_t)needle[0]);
+    const uint8_t last_ch = fold_char((uint8_t)needle[needle_len - 1]);
+    size_t i = 0;
+
+    // the characters between the first and the last
+    auto match_inner = [&](size_t at) {
+        return needle_len <= 2 ||
+               equal_nocase(hay + at + 1, needle + 1, needle_len - 2);
+    };
+
+#ifdef LINGO_SSE2
+    const __m128i first = _mm_set1_epi8((char)first_ch);
+    const __m128i last = _mm_set1_epi8((char)last_ch);
+
+    for (; i + 16 <= last_start + 1; i += 16) {
+        __m128i a = fold16(_mm_loadu_si128((const __m128i*)(hay + i)));
+        __m128i b = fold16(_mm_loadu_si128(
+            (const __m128i*)(hay + i + needle_len - 1)));
+
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(
+            _mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+
+        while (mask) {
+            size_t at = i + (size_t)__builtin_ctz(mask);
+            if (match_inner(at)) {
+                *pos = at;
+                return true;
+            }
+
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    for (; i <= last_start; ++i) {
+        if (fold_char((uint8_t)hay[i]) == first_ch &&
+            fold_char((uint8_t)hay[i + needle_len - 1]) == last_ch &&
+            match_inner(i))
+        {
+            *pos = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+vm::string* vm::string::alloc(gc_heap &heap, size_t len) {
+    void *mem = ::operator new(sizeof(string) + len + 1);
+    string *str = new (mem) string(len, KIND_FLAT);
+    str->_chars = (char*)(str + 1);
+    memset(str->_chars, 0, len + 1);
+    heap.link(str, sizeof(string) + len + 1);
+    return str;
+}
+
+vm::string* vm::string::alloc(gc_heap &heap, const char *src, size_t len) {
+    void *mem = ::operator new(sizeof(string) + len + 1);
+    string *str = new (mem) string(len, KIND_FLAT);
+    str->_chars = (char*)(str + 1);
+    memcpy(str->_chars, src, len);
+    str->_chars[len] = '\0';
+    heap.link(str, sizeof(string) + len + 1);
+    return str;
+}
+
+void vm::string::free(string *str) {
+    if (str->_owns_chars)
+        delete[] str->_chars;
+
+    delete str->_chunks;
+
+    switch (str->_kind) {
+        case KIND_FLAT:
+            str->~string();
+            break;
+
+        case KIND_ROPE:
+            static_cast<rope*>(str)->~rope();
+            break;
+
+        case KIND_BUFFER: {
+            strbuf *buf = static_cast<buffer_string*>(str)->_buf;
+            if (--buf->refs == 0)
+                ::operator delete((void*)buf);
+
+            static_cast<buffer_string*>(str)->~buffer_string();
+            break;
+        }
+
+        case KIND_SLICE:
+            static_cast<slice_string*>(str)->~slice_string();
+            break;
+    }
+
+    ::operator delete((void*)str);
+}
+
+// copies the characters of every leaf of the rope into one buffer. this is
+// done with an explicit stack, as ropes built by appending in a loop are as
+// deep as the number of appends.
+char* vm::string::flatten() const {
+    assert(_kind == KIND_ROPE);
+
+    char *buf = new char[_length + 1];
+    std::vector<std::pair<const string*, size_t>> stack;
+    stack.emplace_back(this, 0);
+
+    while (!stack.empty()) {
+        auto [node, offset] = stack.back();
+        stack.pop_back();
+
+        if (node->_chars) {
+            memcpy(buf + offset, node->_chars, node->_length);
+            continue;
+        }
+
+        auto r = static_cast<const rope*>(node);
+        stack.emplace_back(r->_right, offset + r->_left->_length);
+        stack.emplace_back(r->_left, offset);
+    }
+
+    buf[_length] = '\0';
+
+    auto self = static_cast<rope*>(const_cast<string*>(this));
+    self->_chars = buf;
+    self->_owns_chars = true;
+    self->_left = nullptr;
+    self->_right = nullptr;
+    return buf;
+}
+
+vm::rope* vm::rope::alloc(gc_heap &heap, string *left, string *right) {
+    rope *r = new rope(left, right);
+    heap.link(r, sizeof(rope));
+    return r;
+}
+
+vm::buffer_string::buffer_string(strbuf *buf, size_t offset, size_t len)
+    : string(len, KIND_BUFFER), _buf(buf) {
+    ++buf->refs;
+    _chars = buf->data() + offset;
+}
+
+// allocate a buffer of the given capacity, holding the characters of a
+// followed by the characters of b at the given offset.
+static vm::strbuf* new_strbuf(size_t capacity, size_t offset,
+                              const char *a, size_t alen,
+                              const char *b, size_t blen) {
+    vm::strbuf *buf = (vm::strbuf*) ::operator new(sizeof(vm::strbuf) + capacity);
+    buf->refs = 0;
+    buf->capacity = capacity;
+    buf->begin = offset;
+    buf->end = offset + alen + blen;
+    memcpy(buf->data() + offset, a, alen);
+    memcpy(buf->data() + offset + alen, b, blen);
+    return buf;
+}
+
+vm::string* vm::string::append(gc_heap &heap, string *target,
+                               const char *chars, size_t len) {
+    if (len == 0) return target;
+
+    size_t new_len = target->_length + len;
+
+    if (target->_kind == KIND_BUFFER) {
+        strbuf *buf = static_cast<buffer_string*>(target)->_buf;
+        size_t offset = (size_t)(target->_chars - buf->data());
+
+        if (offset + target->_length == buf->end &&
+            buf->capacity - buf->end >= len)
+        {
+            memcpy(buf->data() + buf->end, chars, len);
+            buf->end += len;
+
+            string *str = new buffer_string(buf, offset, new_len);
+            heap.link(str, sizeof(buffer_string));
+            return str;
+        }
+    }
+
+    // copy into a new buffer, with the free space after the characters
+    size_t capacity = new_len * 2;
+    if (capacity < buffer_string::MIN_CAPACITY)
+        capacity = buffer_string::MIN_CAPACITY;
+
+    strbuf *buf = new_strbuf(capacity, 0, target->data(), target->_length,
+                             chars, len);
+
+    string *str = new buffer_string(buf, 0, new_len);
+    heap.link(str, sizeof(buffer_string) + sizeof(strbuf) + capacity);
+    return str;
+}
+
+vm::string* vm::string::prepend(gc_heap &heap, string *target,
+                                const char *chars, size_t len) {
+    if (len == 0) return target;
+
+    size_t new_len = target->_length + len;
+
+    if (target->_kind == KIND_BUFFER) {
+        strbuf *buf = static_cast<buffer_string*>(target)->_buf;
+        size_t offset = (size_t)(target->_chars - buf->data());
+
+        if (offset == buf->begin && buf->begin >= len) {
+            buf->begin -= len;
+            memcpy(buf->data() + buf->begin, chars, len);
+
+            string *str = new buffer_string(buf, buf->begin, new_len);
+            heap.link(str, sizeof(buffer_string));
+            return str;
+        }
+    }
+
+    // copy into a new buffer, with the free space before the characters
+    size_t capacity = new_len * 2;
+    if (capacity < buffer_string::MIN_CAPACITY)
+        capacity = buffer_string::MIN_CAPACITY;
+
+    size_t offset = capacity - new_len;
+    strbuf *buf = new_strbuf(capacity, offset, chars, len,
+                             target->data(), target->_length);
+
+    string *str = new buffer_string(buf, offset, new_len);
+    heap.link(str, sizeof(buffer_string) + sizeof(strbuf) + capacity);
+    return str;
+}
+
+vm::slice_string::slice_string(string *parent, size_t offset, size_t len)
+    : string(len, KIND_SLICE), _parent(parent) {
+    _chars = parent->data() + offset;
+}
+
+// copy the characters out of the parent, so that the parent can be freed
+void vm::slice_string::detach() {
+    char *buf = new char[_length + 1];
+    memcpy(buf, _chars, _length);
+    buf[_length] = '\0';
+
+    _chars = buf;
+    _owns_chars = true;
+    _parent = nullptr;
+}
+
+vm::string* vm::string::substr(gc_heap &heap, string *src, size_t offset,
+                               size_t len) {
+    assert(offset + len <= src->_length);
+
+    if (offset == 0 && len == src->_length)
+        return src;
+
+    // flattens src if it is a rope
+    const char *chars = src->data() + offset;
+
+    if (len < slice_string::MIN_LENGTH)
+        return alloc(heap, chars, len);
+
+    // slice the string that owns the characters, not another slice
+    string *parent = src;
+    if (src->_kind == KIND_SLICE) {
+        auto slice = static_cast<slice_string*>(src);
+        if (slice->_parent)
+            parent = slice->_parent;
+    }
+
+    string *str = new slice_string(parent, (size_t)(chars - parent->_chars), len);
+    heap.link(str, sizeof(slice_string));
+    return str;
+}
+
+vm::llist* vm::llist::alloc(gc_heap &heap, size_t capacity) {
+    llist *list = new llist;
+    heap.link(list, sizeof(llist));
+    list->reserve(heap, capacity);
+    return list;
+}
+
+vm::llist* vm::llist::alloc(gc_heap &heap, storage s, size_t count) {
+    llist *list = new llist;
+    heap.link(list, sizeof(llist));
+    list->_storage = s;
+    list->reserve(heap, count);
+
+    if (s == STORE_VARIANT) {
+        for (size_t i = 0; i < count; ++i)
+            new (list->variants() + i) variant();
+    } else if (count > 0) {
+        memset(list->_data, 0, count * elem_size(s));
+    }
+
+    list->_count = count;
+    return list;
+}
+
+static void release(vm::listbuf *buf) {
+    if (buf && --buf->refs == 0)
+        ::operator delete((void*)buf);
+}
+
+vm::llist::~llist() {
+    if (_lazy) {
+        llist **link = &_tag->lazy;
+        while (*link != this) link = &(*link)->_next_lazy;
+        *link = _next_lazy;
+    } else if (_tag) {
+        _tag->owner = nullptr;
+    }
+
+    owner_tag::release(_tag);
+    owner_tag::release(_container);
+    release(_buf);
+}
+
+// how far up the lists a list is in are followed. lists can be in
+// themselves, so the chain doesn't always end.
+static constexpr size_t MAX_CONTAINERS = 256;
+
+vm::owner_tag** vm::llist::container_of(const variant &v) {
+    switch (v.type) {
+        case bc::TYPE_LLIST: return &static_cast<llist*>(v.ref)->_container;
+        case bc::TYPE_PLIST: return &static_cast<plist*>(v.ref)->_container;
+        case bc::TYPE_IMAGE: return &static_cast<image*>(v.ref)->_container;
+        default: return nullptr;
+    }
+}
+
+vm::owner_tag* vm::llist::container_of(const gc_object *list) {
+    if (!list) return nullptr;
+
+    return list->type() == OTYPE_LLIST
+        ? static_cast<const llist*>(list)->_container
+        : static_cast<const plist*>(list)->_container;
+}
+
+bool vm::llist::has_lazy(const owner_tag *tag) {
+    for (size_t n = 0; tag && n < MAX_CONTAINERS; ++n) {
+        if (tag->lazy) return true;
+        tag = container_of(tag->owner);
+    }
+
+    return false;
+}
+
+bool& vm::llist::foreign_of(gc_object *list) {
+    return list->type() == OTYPE_LLIST
+        ? static_cast<llist*>(list)->_foreign
+        : static_cast<plist*>(list)->_foreign;
+}
+
+void vm::llist::mark_foreign(gc_object *list) {
+    for (size_t n = 0; list && n < MAX_CONTAINERS; ++n) {
+        bool &foreign = foreign_of(list);
+
+        // the lists it is in already are
+        if (foreign) return;
+        foreign = true;
+
+        owner_tag *tag = container_of(list);
+        list = tag ? tag->owner : nullptr;
+    }
+}
+
+vm::owner_tag* vm::llist::tag() {
+    if (!_tag)
+        _tag = new owner_tag { 1, this, nullptr };
+
+    return _tag;
+}
+
+void vm::llist::adopt(gc_object *list, owner_tag *tag, const variant &v) {
+    owner_tag **container = container_of(v);
+    if (*container == tag) return;
+
+    // a value keeps the tag of one list. while lazy duplicates of the
+    // other list depend on it, it stays there and this list is duplicated
+    // eagerly. otherwise it moves here and the other list is.
+    if (has_lazy(*container)) {
+        mark_foreign(list);
+        return;
+    }
+
+    if (*container && (*container)->owner)
+        mark_foreign((*container)->owner);
+
+    owner_tag::release(*container);
+    *container = tag;
+    ++tag->refs;
+
+    // checked last, as marking the other list reaches the value too when
+    // it is in a list in the value
+    if (v.type != bc::TYPE_IMAGE && foreign_of(v.ref))
+        mark_foreign(list);
+}
+
+void vm::llist::adopt(const variant &v) {
+    if (copied_by_duplicate(v.type))
+        adopt(this, tag(), v);
+}
+
+vm::llist* vm::llist::duplicate(gc_heap &heap) {
+    llist *list = new llist;
+    heap.link(list, sizeof(llist));
+
+    list->_storage = _storage;
+    list->_sorted = _sorted;
+
+    if (_foreign) {
+        list->reserve(heap, _count);
+        const variant *items = variants();
+        variant *copy = list->variants();
+        for (size_t i = 0; i < _count; ++i) {
+            new (copy + i) variant(vm::duplicate(heap, items[i]));
+            list->adopt(copy[i]);
+        }
+
+        list->_count = _count;
+        heap.stats().duplicate_bytes += _count * sizeof(variant);
+        ++heap.stats().duplicates;
+        return list;
+    }
+
+    list->_count = _count;
+    list->_buf = _buf;
+    list->_data = _data;
+    if (_buf) ++_buf->refs;
+
+    // a list of variants may hold lists, so the copy is lazy, on the same
+    // tag as this list if it is lazy itself
+    if (_storage == STORE_VARIANT && _buf) {
+        owner_tag *tag = _lazy ? _tag : this->tag();
+        ++tag->refs;
+        list->_lazy = true;
+        list->_tag = tag;
+        list->_next_lazy = tag->lazy;
+        tag->lazy = list;
+    }
+
+    ++heap.stats().duplicates;
+    return list;
+}
+
+void vm::llist::resolve(gc_heap &heap) {
+    llist **link = &_tag->lazy;
+    while (*link != this) link = &(*link)->_next_lazy;
+    *link = _next_lazy;
+
+    owner_tag::release(_tag);
+    _tag = nullptr;
+    _next_lazy = nullptr;
+    _lazy = false;
+
+    if (_buf->refs > 1)
+        realloc(heap, _buf->capacity);
+
+    variant *items = variants();
+    for (size_t i = 0; i < _count; ++i) {
+        if (copied_by_duplicate(items[i].type)) {
+            items[i] = vm::duplicate(heap, items[i]);
+            adopt(items[i]);
+        }
+    }
+}
+
+void vm::llist::resolve_lazy(gc_heap &heap, owner_tag *tag) {
+    llist *first = tag->lazy;
+    if (!first) return;
+    first->resolve(heap);
+
+    // the rest have the same items as the first had, so they become lazy
+    // on its copy
+    owner_tag *to = first->tag();
+    while (tag->lazy) {
+        llist *list = tag->lazy;
+        tag->lazy = list->_next_lazy;
+
+        ++first->_buf->refs;
+        release(list->_buf);
+        list->_buf = first->_buf;
+        list->_data = first->_data;
+
+        owner_tag::release(list->_tag);
+        list->_tag = to;
+        ++to->refs;
+        list->_next_lazy = to->lazy;
+        to->lazy = list;
+    }
+}
+
+void vm::llist::settle(gc_heap &heap, owner_tag *tag) {
+    if (!has_lazy(tag)) return;
+
+    owner_tag *chain[MAX_CONTAINERS];
+    size_t n = 0;
+    for (; tag && n < MAX_CONTAINERS; ++n) {
+        chain[n] = tag;
+        tag = container_of(tag->owner);
+    }
+
+    while (n > 0) {
+        owner_tag *t = chain[--n];
+        if (t->lazy) resolve_lazy(heap, t);
+    }
+}
+
+void vm::llist::unshare_slow(gc_heap &heap) {
+    // this list is among the items of lazy duplicates
+    if (_container)
+        settle(heap, _container);
+
+    if (_lazy) {
+        resolve(heap);
+    } else if (_buf && _buf->refs > 1) {
+        // the owner keeps its items, and its lazy duplicates move off them
+        if (_tag && _tag->lazy)
+            resolve_lazy(heap, _tag);
+
+        if (_buf->refs > 1)
+            realloc(heap, _buf->capacity);
+    }
+
+    if (_buf) _buf->hash = 0;
+}
+
+// move the items to a new buffer, which this list is the only user of
+void vm::llist::realloc(gc_heap &heap, size_t capacity) {
+    size_t size = elem_size(_storage);
+    listbuf *buf = (listbuf*) ::operator new(sizeof(listbuf) + capacity * size);
+    buf->refs = 1;
+    buf->capacity = capacity;
+    buf->hash = 0;
+
+    if (_count > 0)
+        memcpy(buf->data(), _data, _count * size);
+
+    // copied because of sharing, rather than to make room
+    bool shared = _buf && _buf->refs > 1;
+    if (shared) {
+        ++heap.stats().cow_copies;
+        heap.stats().cow_bytes += _count * size;
+    }
+
+    size_t old_capacity = shared ? 0 : this->capacity();
+    if (capacity > old_capacity)
+        heap.grow((capacity - old_capacity) * size);
+
+    release(_buf);
+    _buf = buf;
+    _data = buf->data();
+}
+
+void vm::llist::reserve(gc_heap &heap, size_t capacity) {
+    size_t cur = this->capacity();
+    if (capacity <= cur) {
+        unshare(heap);
+        return;
+    }
+
+    realloc(heap, capacity);
+}
+
+void vm::llist::convert(gc_heap &heap, storage to) {
+    if (to == _storage) return;
+
+    // only an empty list changes between the packed types
+    size_t capacity = this->capacity();
+    size_t old_size = elem_size(_storage);
+    size_t new_size = elem_size(to);
+    listbuf *buf = (listbuf*) ::operator new(sizeof(listbuf) + capacity * new_size);
+    buf->refs = 1;
+    buf->capacity = capacity;
+    buf->hash = 0;
+
+    if (to == STORE_VARIANT) {
+        variant *items = (variant*)buf->data();
+        for (size_t i = 0; i < _count; ++i)
+            items[i] = get(i);
+    }
+
+    if (_buf && _buf->refs > 1)
+        heap.grow(capacity * new_size);
+    else if (new_size > old_size)
+        heap.grow(capacity * (new_size - old_size));
+
+    release(_buf);
+    _buf = buf;
+    _data = buf->data();
+    _storage = to;
+}
+
+void vm::llist::put(size_t i, const variant &v) {
+    switch (_storage) {
+        case STORE_INT: ints()[i] = v.i32; break;
+        case STORE_FLOAT: floats()[i] = v.f64; break;
+        case STORE_VARIANT: variants()[i] = v; break;
+    }
+}
+
+void vm::llist::set(gc_heap &heap, size_t i, const variant &v) {
+    unshare(heap);
+
+    storage s = storage_for(v);
+    if (s != _storage)
+        convert(heap, s);
+
+    put(i, v);
+    adopt(v);
+    _sorted = false;
+}
+
+void vm::llist::add(gc_heap &heap, const variant &v) {
+    insert(heap, _count, v);
+    _sorted = false;
+}
+
+void vm::llist::insert(gc_heap &heap, size_t i, const variant &v) {
+    unshare(heap);
+
+    storage s = storage_for(v);
+    if (s != _storage)
+        convert(heap, s);
+
+    size_t capacity = this->capacity();
+    if (_count == capacity)
+        reserve(heap, capacity < 4 ? 4 : capacity * 2);
+
+    size_t size = elem_size(_storage);
+    char *data = (char*)_data;
+    memmove(data + (i + 1) * size, data + i * size, (_count - i) * size);
+
+    ++_count;
+    put(i, v);
+    adopt(v);
+}
+
+vm::plist* vm::plist::alloc(gc_heap &heap, size_t capacity) {
+    plist *list = new plist;
+    list->_entries.reserve(capacity);
+    heap.link(list, sizeof(plist) + capacity * sizeof(plist_entry));
+    return list;
+}
+
+vm::plist* vm::plist::duplicate(gc_heap &heap) {
+    plist *list = new plist;
+    list->_entries = _entries;
+    list->_removed = _removed;
+    list->_sorted = _sorted;
+    heap.link(list, sizeof(plist) + _entries.size() * sizeof(plist_entry));
+
+    // keys are left alone, so the index is still right for the copy
+    if (_index) {
+        size_t capacity = _index_mask + 1;
+        list->_index = new uint32_t[capacity];
+        list->_index_mask = _index_mask;
+        memcpy(list->_index, _index, capacity * sizeof(uint32_t));
+        heap.grow(capacity * sizeof(uint32_t));
+    }
+
+    for (plist_entry &e : list->_entries) {
+        e.value = vm::duplicate(heap, e.value);
+        list->adopt(e.value);
+    }
+
+    ++heap.stats().duplicates;
+    heap.stats().duplicate_bytes += _entries.size() * sizeof(plist_entry);
+    return list;
+}
+
+vm::variant vm::duplicate(gc_heap &heap, const variant &v) {
+    variant copy = v;
+    if (!copied_by_duplicate(v.type))
+        return copy;
+
+    if (v.type == bc::TYPE_LLIST)
+        copy.ref = static_cast<llist*>(v.ref)->duplicate(heap);
+    else if (v.type == bc::TYPE_PLIST)
+        copy.ref = static_cast<plist*>(v.ref)->duplicate(heap);
+    else if (v.type == bc::TYPE_IMAGE)
+        copy.ref = static_cast<image*>(v.ref)->duplicate(heap);
+
+    return copy;
+}
+
+vm::plist::~plist() {
+    delete[] _index;
+
+    if (_tag) _tag->owner = nullptr;
+    owner_tag::release(_tag);
+    owner_tag::release(_container);
+}
+
+vm::owner_tag* vm::plist::tag() {
+    if (!_tag)
+        _tag = new owner_tag { 1, this, nullptr };
+
+    return _tag;
+}
+
+void vm::plist::adopt(const variant &v) {
+    if (copied_by_duplicate(v.type))
+        llist::adopt(this, tag(), v);
+}
+
+// lists nested deeper than this are only equal if they are the same list,
+// so that comparing lists which contain themselves ends
+static constexpr int MAX_DEPTH = 256;
+
+// lists nested deeper than this are hashed by their count alone, which
+// equal lists share. a list that is in itself twice would otherwise be
+// visited twice as often at each level down.
+static constexpr int HASH_DEPTH = 2;
+
+static inline size_t count_hash(size_t count) {
+    return (size_t) hash_fmix((uint64_t)count * HASH_K2) | 1;
+}
+
+// the number or text the = operator reads each of two values of different
+// types as
+static bool equal_mixed(const vm::variant &x, const vm::variant &y) {
+    const vm::variant *a = &x;
+    const vm::variant *b = &y;
+    if (b->type < a->type) std::swap(a, b);
+
+    if (b->type == bc::TYPE_STRING &&
+        (a->type == bc::TYPE_INT || a->type == bc::TYPE_FLOAT))
+    {
+        // strings that are not numbers are never equal
+        vm::variant num;
+        if (!static_cast<vm::string*>(b->ref)->to_number(&num))
+            return false;
+
+        if (a->type == bc::TYPE_INT && num.type == bc::TYPE_INT)
+            return a->i32 == num.i32;
+
+        double x = a->type == bc::TYPE_INT ? (double)a->i32 : a->f64;
+        double y = num.type == bc::TYPE_INT ? (double)num.i32 : num.f64;
+        return x == y;
+    }
+
+    if (a->type == bc::TYPE_INT && b->type == bc::TYPE_FLOAT)
+        return (double)a->i32 == b->f64;
+
+    if (a->type == bc::TYPE_STRING && b->type == bc::TYPE_SYMBOL)
+        return *static_cast<vm::string*>(a->ref) ==
+               *static_cast<vm::string*>(b->ref);
+
+    return false;
+}
+
+bool vm::equal(const variant &a, const variant &b, bool strict, int depth) {
+    if (a.type != b.type)
+        return !strict && equal_mixed(a, b);
+
+    switch (a.type) {
+        case bc::TYPE_VOID:
+            return true;
+
+        case bc::TYPE_INT:
+            return a.i32 == b.i32;
+
+        case bc::TYPE_FLOAT:
+            return a.f64 == b.f64;
+
+        case bc::TYPE_STRING:
+            return *static_cast<string*>(a.ref) == *static_cast<string*>(b.ref);
+
+        case bc::TYPE_LLIST:
+            return static_cast<llist*>(a.ref)->equal(
+                *static_cast<llist*>(b.ref), strict, depth);
+
+        case bc::TYPE_PLIST:
+            return static_cast<plist*>(a.ref)->equal(
+                *static_cast<plist*>(b.ref), strict, depth);
+
+        // points and colors are compared by the bits of their components,
+        // and rects and quads by their records, which are packed the same
+        // way. point(1, 2) = point(1.0, 2), but they are different keys.
+        case bc::TYPE_POINT:
+        case bc::TYPE_COLOR:
+            if (a.ref == b.ref && a.float_mask == b.float_mask)
+                return true;
+            break;
+
+        case bc::TYPE_RECT:
+        case bc::TYPE_QUAD: {
+            if (a.ref == b.ref) return true;
+
+            const geom *ga = static_cast<geom*>(a.ref);
+            const geom *gb = static_cast<geom*>(b.ref);
+            if (ga->float_mask() == gb->float_mask() &&
+                memcmp(ga->components(), gb->components(),
+                       geom::component_count(a.type) * sizeof(double)) == 0)
+                return true;
+            break;
+        }
+
+        default:
+            return a.ref == b.ref;
+    }
+
+    if (strict || a.type == bc::TYPE_COLOR)
+        return false;
+
+    double ca[8], cb[8];
+    geom::unpack(a, ca);
+    geom::unpack(b, cb);
+    for (size_t i = 0; i < geom::component_count(a.type); ++i) {
+        if (ca[i] != cb[i]) return false;
+    }
+
+    return true;
+}
+
+// hash_value() before the finalizer, which lists mix their items' hashes
+// from
+static uint64_t hash_word(const vm::variant &v, int depth) {
+    uint64_t bits;
+
+    switch (v.type) {
+        case bc::TYPE_VOID:
+            bits = 0;
+            break;
+
+        case bc::TYPE_INT:
+            bits = (uint64_t)(uint32_t)v.i32;
+            break;
+
+        case bc::TYPE_FLOAT:
+            // 0.0 and -0.0 are the same key
+            if (v.f64 == 0.0) bits = 0;
+            else memcpy(&bits, &v.f64, sizeof(bits));
+            break;
+
+        case bc::TYPE_STRING:
+            return static_cast<vm::string*>(v.ref)->hash();
+
+        case bc::TYPE_LLIST:
+            return static_cast<vm::llist*>(v.ref)->hash(depth);
+
+        case bc::TYPE_PLIST:
+            return static_cast<vm::plist*>(v.ref)->hash(depth);
+
+        case bc::TYPE_POINT:
+        case bc::TYPE_COLOR:
+            bits = (uint64_t)(uintptr_t)v.ref ^ v.float_mask;
+            break;
+
+        case bc::TYPE_RECT:
+        case bc::TYPE_QUAD: {
+            const vm::geom *g = static_cast<vm::geom*>(v.ref);
+            bits = vm::hash_bytes((const char*)g->components(),
+                vm::geom::component_count(v.type) * sizeof(double));
+            bits ^= g->float_mask();
+            break;
+        }
+
+        default:
+            bits = (uint64_t)(uintptr_t)v.ref;
+            break;
+    }
+
+    return bits ^ ((uint64_t)v.type * HASH_K0);
+}
+
+size_t vm::hash_value(const variant &v, int depth) {
+    return (size_t) hash_fmix(hash_word(v, depth));
+}
+
+bool vm::plist::key_equal(const variant &a, const variant &b) {
+    return vm::equal(a, b, true);
+}
+
+size_t vm::plist::key_hash(const variant &key) {
+    return hash_value(key);
+}
+
+bool vm::llist::equal(const llist &other, bool strict, int depth) const {
+    if (this == &other) return true;
+    if (_count != other._count) return false;
+    if (_count == 0 || _data == other._data) return true;
+
+    if (strict && _buf->hash && other._buf->hash &&
+        _buf->hash != other._buf->hash)
+        return false;
+
+    if (_storage == other._storage) {
+        switch (_storage) {
+            case STORE_INT:
+                return memcmp(ints(), other.ints(),
+                              _count * sizeof(int32_t)) == 0;
+
+            // not memcmp, since 0.0 = -0.0
+            case STORE_FLOAT: {
+                const double *a = floats();
+                const double *b = other.floats();
+                bool same = true;
+                for (size_t i = 0; i < _count; ++i)
+                    same &= a[i] == b[i];
+                return same;
+            }
+
+            case STORE_VARIANT:
+                break;
+        }
+    }
+
+    if (depth >= MAX_DEPTH) return false;
+
+    for (size_t i = 0; i < _count; ++i) {
+        if (!vm::equal(get(i), other.get(i), strict, depth + 1))
+            return false;
+    }
+
+    return true;
+}
+
+size_t vm::llist::hash(int depth) const {
+    if (depth >= HASH_DEPTH) return count_hash(_count);
+    if (_buf && _buf->hash) return _buf->hash;
+
+    uint64_t h = (uint64_t)_count * HASH_K2;
+    bool keep = true;
+
+    switch (_storage) {
+        // the same words as hash_word gives the items one by one
+        case STORE_INT: {
+            const uint64_t type = (uint64_t)bc::TYPE_INT * HASH_K0;
+            for (size_t i = 0; i < _count; ++i)
+                h = hash_mix(h, (uint64_t)(uint32_t)ints()[i] ^ type);
+            break;
+        }
+
+        case STORE_FLOAT:
+            for (size_t i = 0; i < _count; ++i)
+                h = hash_mix(h, hash_word(get(i), depth + 1));
+            break;
+
+        case STORE_VARIANT:
+            for (size_t i = 0; i < _count; ++i) {
+                variant v = get(i);
+                keep &= v.type != bc::TYPE_LLIST && v.type != bc::TYPE_PLIST;
+                h = hash_mix(h, hash_word(v, depth + 1));
+            }
+            break;
+    }
+
+    size_t result = (size_t) hash_fmix(h);
+    if (result == 0) result = 1;
+    if (_buf && keep) _buf->hash = result;
+    return result;
+}
+
+bool vm::plist::equal(const plist &other, bool strict, int depth) const {
+    if (this == &other) return true;
+    if (count() != other.count()) return false;
+    if (depth >= MAX_DEPTH) return false;
+
+    compact();
+    other.compact();
+
+    for (size_t i = 0; i < count(); ++i) {
+        const plist_entry &a = _entries[i];
+        const plist_entry &b = other._entries[i];
+        if (!vm::equal(a.key, b.key, strict, depth + 1) ||
+            !vm::equal(a.value, b.value, strict, depth + 1))
+            return false;
+    }
+
+    return true;
+}
+
+size_t vm::plist::hash(int depth) const {
+    if (depth >= HASH_DEPTH) return count_hash(count());
+
+    compact();
+
+    uint64_t h = (uint64_t)count() * HASH_K2;
+    for (const plist_entry &e : _entries) {
+        h = hash_mix(h, hash_word(e.key, depth + 1));
+        h = hash_mix(h, hash_word(e.value, depth + 1));
+    }
+
+    return (size_t) hash_fmix(h);
+}
+
+void vm::plist::build_index(gc_heap &heap, size_t capacity) {
+    size_t old_capacity = _index ? _index_mask + 1 : 0;
+
+    delete[] _index;
+    _index = new uint32_t[capacity];
+    _index_mask = capacity - 1;
+    for (size_t i = 0; i < capacity; ++i)
+        _index[i] = EMPTY;
+
+    if (capacity > old_capacity)
+        heap.grow((capacity - old_capacity) * sizeof(uint32_t));
+
+    // in order, so that the first of equal keys comes first in its probe
+    // sequence
+    for (size_t i = 0; i < _entries.size(); ++i) {
+        if (!removed(_entries[i]))
+            index_insert(i);
+    }
+}
+
+void vm::plist::index_insert(size_t i) const {
+    size_t slot = key_hash(_entries[i].key) & _index_mask;
+    while (_index[slot] != EMPTY)
+        slot = (slot + 1) & _index_mask;
+
+    _index[slot] = (uint32_t)i;
+}
+
+void vm::plist::index_remove(size_t i) {
+    size_t slot = key_hash(_entries[i].key) & _index_mask;
+    while (_index[slot] != (uint32_t)i)
+        slot = (slot + 1) & _index_mask;
+
+    // shift the rest of the probe sequence back over the removed slot,
+    // so that lookups need no tombstones. an entry can move back into
+    // the hole if its home slot is not between the hole and itself.
+    size_t next = (slot + 1) & _index_mask;
+    while (_index[next] != EMPTY) {
+        size_t home = key_hash(_entries[_index[next]].key) & _index_mask;
+
+        if (((next - home) & _index_mask) >= ((next - slot) & _index_mask)) {
+            _index[slot] = _index[next];
+            slot = next;
+        }
+
+        next = (next + 1) & _index_mask;
+    }
+    _index[slot] = EMPTY;
+}
+
+// the entries in slots [from, to) have moved up by one. a few are found
+// through their keys; for more, one pass over the index is cheaper.
+void vm::plist::index_shift(size_t from, size_t to) {
+    if ((to - from) * 4 < _index_mask + 1) {
+        // from the last, so that the slot each one moves to is no longer
+        // in the index
+        for (size_t i = to; i-- > from;) {
+            size_t slot = key_hash(_entries[i + 1].key) & _index_mask;
+            while (_index[slot] != (uint32_t)i)
+                slot = (slot + 1) & _index_mask;
+
+            _index[slot] = (uint32_t)(i + 1);
+        }
+
+        return;
+    }
+
+    for (size_t s = 0; s <= _index_mask; ++s) {
+        if (_index[s] != EMPTY && _index[s] >= from && _index[s] < to)
+            ++_index[s];
+    }
+}
+
+void vm::plist::compact() const {
+    if (_removed == 0) return;
+
+    size_t n = 0;
+    for (size_t i = 0; i < _entries.size(); ++i) {
+        if (!removed(_entries[i]))
+            _entries[n++] = _entries[i];
+    }
+
+    _entries.resize(n);
+    _removed = 0;
+
+    // removed slots are only left by lists with an index, which is rebuilt
+    // at the same capacity
+    for (size_t s = 0; s <= _index_mask; ++s)
+        _index[s] = EMPTY;
+
+    for (size_t i = 0; i < n; ++i)
+        index_insert(i);
+}
+
+ptrdiff_t vm::plist::find_slot(const variant &key) const {
+    if (!_index) {
+        // symbols are interned, so they are the same key only if they are
+        // the same object
+        if (key.type == bc::TYPE_SYMBOL) {
+            for (size_t i = 0; i < _entries.size(); ++i) {
+                const variant &k = _entries[i].key;
+                if (k.type == bc::TYPE_SYMBOL && k.ref == key.ref)
+                    return (ptrdiff_t)i;
+            }
+
+            return -1;
+        }
+
+        for (size_t i = 0; i < _entries.size(); ++i) {
+            if (key_equal(_entries[i].key, key))
+                return (ptrdiff_t)i;
+        }
+
+        return -1;
+    }
+
+    // removed slots are not in the index
+    size_t slot = key_hash(key) & _index_mask;
+    while (_index[slot] != EMPTY) {
+        uint32_t i = _index[slot];
+        if (key_equal(_entries[i].key, key))
+            return (ptrdiff_t)i;
+
+        slot = (slot + 1) & _index_mask;
+    }
+
+    return -1;
+}
+
+ptrdiff_t vm::plist::find(const variant &key) const {
+    compact();
+    return find_slot(key);
+}
+
+vm::plist_entry* vm::plist::lookup(const variant &key) {
+    ptrdiff_t i = find_slot(key);
+    return i < 0 ? nullptr : &_entries[(size_t)i];
+}
+
+const vm::plist_entry* vm::plist::lookup(const variant &key) const {
+    ptrdiff_t i = find_slot(key);
+    return i < 0 ? nullptr : &_entries[(size_t)i];
+}
+
+void vm::plist::add(gc_heap &heap, const variant &key, const variant &value) {
+    // make room from the removed slots before growing
+    if (_removed > 0 && _entries.size() == _entries.capacity())
+        compact();
+
+    insert(heap, _entries.size(), key, value);
+    _sorted = false;
+}
+
+void vm::plist::insert(gc_heap &heap, size_t i, const variant &key,
+                       const variant &value) {
+    unshare(heap);
+    size_t end = _entries.size();
+
+    if (i > 0 && removed(_entries[i - 1])) {
+        --i;
+        --_removed;
+    } else if (i < end && removed(_entries[i])) {
+        --_removed;
+    } else {
+        // the slots up to the next removed one move up into it, or up past
+        // the end
+        size_t to = i;
+        while (to < end && !removed(_entries[to])) ++to;
+
+        if (to == end) {
+            size_t old_capacity = _entries.capacity();
+            _entries.emplace_back();
+
+            if (_entries.capacity() != old_capacity) {
+                heap.grow((_entries.capacity() - old_capacity) *
+                          sizeof(plist_entry));
+            }
+        } else {
+            --_removed;
+        }
+
+        std::move_backward(_entries.begin() + (ptrdiff_t)i,
+                           _entries.begin() + (ptrdiff_t)to,
+                           _entries.begin() + (ptrdiff_t)to + 1);
+
+        if (_index && to > i)
+            index_shift(i, to);
+    }
+
+    _entries[i] = plist_entry { key, value };
+    adopt(value);
+
+    if (_index && count() * 2 <= _index_mask + 1)
+        index_insert(i);
+    else if (count() > INDEX_MIN)
+        reindex(heap);
+}
+
+void vm::plist::reindex(gc_heap &heap) {
+    size_t n = count();
+    if (n <= INDEX_MIN && !_index) return;
+
+    size_t capacity = 16;
+    while (capacity < n * 2) capacity *= 2;
+    build_index(heap, capacity);
+}
+
+void vm::plist::set(gc_heap &heap, const variant &key, const variant &value) {
+    unshare(heap);
+    plist_entry *e = lookup(key);
+    if (e) {
+        e->value = value;
+        adopt(value);
+    } else {
+        add(heap, key, value);
+    }
+}
+
+bool vm::plist::remove(gc_heap &heap, const variant &key) {
+    ptrdiff_t i = find_slot(key);
+    if (i < 0) return false;
+
+    unshare(heap);
+
+    // small lists have no index to keep up to date
+    if (!_index) {
+        _entries.erase(_entries.begin() + i);
+        return true;
+    }
+
+    index_remove((size_t)i);
+
+    variant &value = _entries[(size_t)i].value;
+    value = variant();
+    value.float_mask = REMOVED;
+    ++_removed;
+    return true;
+}
+
+vm::geom* vm::geom::alloc(gc_heap &heap, bc::vtype type, const double *c,
+                          uint8_t float_mask) {
+    size_t n = component_count(type);
+    geom *g = new (heap.alloc_geom(n)) geom(type, float_mask);
+    memcpy((double*)g->components(), c, n * sizeof(double));
+
+    heap.link(g, gc_heap::geom_size(n));
+    return g;
+}
+
+vm::variant vm::geom::make(gc_heap &heap, bc::vtype type, const variant *c) {
+    double comps[8];
+    uint8_t float_mask = 0;
+    for (size_t i = 0; i < component_count(type); ++i) {
+        if (c[i].type == bc::TYPE_FLOAT) {
+            comps[i] = c[i].f64;
+            float_mask |= 1 << i;
+        } else {
+            comps[i] = (double)c[i].i32;
+        }
+    }
+
+    return pack(heap, type, comps, float_mask);
+}
+
+vm::variant vm::geom::component(const variant &g, size_t i) {
+    variant v;
+
+    switch (g.type) {
+        case bc::TYPE_POINT:
+            if (g.float_mask & (1 << i)) {
+                v.type = bc::TYPE_FLOAT;
+                v.f64 = (double)g.pt[i].f;
+            } else {
+                v.type = bc::TYPE_INT;
+                v.i32 = g.pt[i].i;
+            }
+            break;
+
+        case bc::TYPE_COLOR:
+            v.type = bc::TYPE_INT;
+            v.i32 = g.rgb[i];
+            break;
+
+        default: {
+            const geom *obj = static_cast<geom*>(g.ref);
+            double c = obj->components()[i];
+            if (obj->_float_mask & (1 << i)) {
+                v.type = bc::TYPE_FLOAT;
+                v.f64 = c;
+            } else {
+                v.type = bc::TYPE_INT;
+                v.i32 = (int32_t)c;
+            }
+            break;
+        }
+    }
 
-vm::string()
\ No newline at end of file
+    return v;
+}
@@ -0,0 +1,374 @@
+#include "vm.hpp"
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+using namespace lingo;
+
+vm::gc_heap::gc_heap()
+    : _objects(nullptr), _debt(0), _threshold(MIN_THRESHOLD),
+      _live(0), _mark_threads(std::max(1u, std::thread::hardware_concurrency())),
+      _geom_free{ nullptr, nullptr } { }
+
+vm::gc_heap::~gc_heap() {
+    gc_object *obj = _objects;
+    while (obj) {
+        gc_object *next = obj->_gc_next;
+        free_object(obj);
+        obj = next;
+    }
+
+    for (void *block : _geom_blocks)
+        ::operator delete(block);
+}
+
+void* vm::gc_heap::alloc_geom(size_t components) {
+    gc_object *&free = _geom_free[components == 8];
+
+    if (!free) {
+        size_t size = geom_size(components);
+        char *block = (char*) ::operator new(GEOM_BLOCK);
+        _geom_blocks.push_back(block);
+
+        for (size_t i = 0; i + size <= GEOM_BLOCK; i += size) {
+            gc_object *obj = (gc_object*)(block + i);
+            obj->_gc_next = free;
+            free = obj;
+        }
+    }
+
+    gc_object *obj = free;
+    free = obj->_gc_next;
+    return obj;
+}
+
+size_t vm::gc_heap::object_size(const gc_object *obj) {
+    switch (obj->obj_type) {
+        case gc_object::OTYPE_STRING: {
+            auto str = static_cast<const string*>(obj);
+            size_t table = str->_chunks ? str->_chunks->bytes() : 0;
+            switch (str->_kind) {
+                case string::KIND_FLAT:
+                    return table + sizeof(string) + str->_length + 1;
+
+                case string::KIND_ROPE:
+                    return table + sizeof(rope) + (str->_owns_chars ? str->_length + 1 : 0);
+
+                case string::KIND_BUFFER: {
+                    // a buffer is split between the strings viewing it, as
+                    // a shared list buffer is
+                    const strbuf *buf =
+                        static_cast<const buffer_string*>(str)->buffer();
+                    return table + sizeof(buffer_string) +
+                        (sizeof(strbuf) + buf->capacity) / buf->refs;
+                }
+
+                case string::KIND_SLICE:
+                    return table + sizeof(slice_string) + (str->_owns_chars ? str->_length + 1 : 0);
+            }
+
+            break;
+        }
+
+        case gc_object::OTYPE_LLIST: {
+            auto list = static_cast<const llist*>(obj);
+            if (!list->_buf) return sizeof(llist);
+
+            // a shared buffer is split between the lists sharing it
+            return sizeof(llist) + list->_buf->capacity *
+                llist::elem_size(list->_storage) / list->_buf->refs;
+        }
+
+        case gc_object::OTYPE_PLIST: {
+            auto list = static_cast<const plist*>(obj);
+            return sizeof(plist) +
+                list->_entries.capacity() * sizeof(plist_entry) +
+                (list->_index ? (list->_index_mask + 1) * sizeof(uint32_t) : 0);
+        }
+
+        case gc_object::OTYPE_GEOM:
+            return geom_size(geom::component_count(
+                static_cast<const geom*>(obj)->_type));
+
+        case gc_object::OTYPE_IMAGE: {
+            // with the planes cached from it, which it owns
+            auto img = static_cast<const image*>(obj);
+            size_t size = sizeof(image) + img->bytes();
+            if (img->_mask) size += sizeof(image) + img->_mask->bytes();
+            if (img->_matte) size += sizeof(image) + img->_matte->bytes();
+            return size;
+        }
+    }
+
+    return 0;
+}
+
+void vm::gc_heap::free_object(gc_object *obj) {
+    switch (obj->obj_type) {
+        case gc_object::OTYPE_STRING:
+            string::free(static_cast<string*>(obj));
+            break;
+
+        case gc_object::OTYPE_LLIST:
+            delete static_cast<llist*>(obj);
+            break;
+
+        case gc_object::OTYPE_PLIST:
+            delete static_cast<plist*>(obj);
+            break;
+
+        case gc_object::OTYPE_GEOM: {
+            // back to the pool. geoms have nothing to destroy.
+            size_t n = geom::component_count(static_cast<geom*>(obj)->_type);
+            obj->_gc_next = _geom_free[n == 8];
+            _geom_free[n == 8] = obj;
+            break;
+        }
+
+        case gc_object::OTYPE_IMAGE:
+            delete static_cast<image*>(obj);
+            break;
+    }
+}
+
+// mark the children of the task's object with the marker. lists with more
+// than Marker::CHUNK items left push the rest back as another task.
+template <typename Marker>
+void vm::gc_heap::scan(Marker &m, const mark_task &task) {
+    gc_object *obj = task.obj;
+
+    switch (obj->obj_type) {
+        case gc_object::OTYPE_STRING: {
+            auto str = static_cast<string*>(obj);
+
+            if (str->_kind == string::KIND_ROPE) {
+                auto r = static_cast<rope*>(str);
+                if (r->_left) m.mark(r->_left);
+                if (r->_right) m.mark(r->_right);
+            } else if (str->_kind == string::KIND_SLICE) {
+                auto slice = static_cast<slice_string*>(str);
+                if (slice->_parent) m.slices.push_back(slice);
+            }
+
+            break;
+        }
+
+        case gc_object::OTYPE_LLIST: {
+            auto list = static_cast<llist*>(obj);
+
+            // packed lists hold no references
+            if (list->_storage != llist::STORE_VARIANT)
+                break;
+
+            size_t end = list->_count;
+            if (end - task.from > Marker::CHUNK) {
+                end = task.from + Marker::CHUNK;
+                m.push({ obj, end });
+            }
+
+            const variant *items = list->variants();
+            for (size_t i = task.from; i < end; ++i) {
+                if (items[i].is_ref()) m.mark(items[i].ref);
+            }
+            break;
+        }
+
+        case gc_object::OTYPE_PLIST: {
+            const std::vector<plist_entry> &entries =
+                static_cast<plist*>(obj)->_entries;
+
+            size_t end = entries.size();
+            if (end - task.from > Marker::CHUNK) {
+                end = task.from + Marker::CHUNK;
+                m.push({ obj, end });
+            }
+
+            for (size_t i = task.from; i < end; ++i) {
+                if (entries[i].key.is_ref()) m.mark(entries[i].key.ref);
+                if (entries[i].value.is_ref()) m.mark(entries[i].value.ref);
+            }
+            break;
+        }
+
+        case gc_object::OTYPE_GEOM:
+        case gc_object::OTYPE_IMAGE:
+            break;
+    }
+}
+
+struct vm::gc_heap::serial_marker {
+    static constexpr size_t CHUNK = SIZE_MAX;
+
+    gc_heap &heap;
+    std::vector<slice_string*> &slices;
+
+    inline void mark(gc_object *obj) { heap.mark(obj); }
+    inline void push(const mark_task &) { }
+};
+
+void vm::gc_heap::mark_serial() {
+    serial_marker m{ *this, _slices };
+
+    while (!_gray.empty()) {
+        gc_object *obj = _gray.back();
+        _gray.pop_back();
+        scan(m, { obj, 0 });
+    }
+}
+
+// the mark stack of one thread. when the shared part is empty and the
+// private part is big, the older half of the private part is moved to the
+// shared part, for threads that have run out of work to steal.
+struct vm::gc_heap::mark_worker {
+    static constexpr size_t CHUNK = 4096;
+    static constexpr size_t SHARE_MIN = 64;
+
+    std::vector<mark_task> stack;
+    std::vector<slice_string*> slices;
+
+    std::mutex lock;
+    std::vector<mark_task> shared; // guarded by lock
+    std::atomic<size_t> shared_count{ 0 };
+
+    // several threads can reach the same object, so the one that sets the
+    // mark is the one that scans it
+    inline void mark(gc_object *obj) {
+        if (obj->_gc_marked.load(std::memory_order_relaxed)) return;
+        if (obj->_gc_marked.exchange(true, std::memory_order_relaxed)) return;
+        stack.push_back({ obj, 0 });
+    }
+
+    inline void push(const mark_task &task) { stack.push_back(task); }
+
+    void share() {
+        std::lock_guard<std::mutex> guard(lock);
+        size_t half = stack.size() / 2;
+        shared.insert(shared.end(), stack.begin(), stack.begin() + half);
+        stack.erase(stack.begin(), stack.begin() + half);
+        shared_count.store(shared.size(), std::memory_order_release);
+    }
+
+    // take half of the victim's shared tasks
+    bool steal_from(mark_worker &victim) {
+        if (victim.shared_count.load(std::memory_order_acquire) == 0)
+            return false;
+
+        std::lock_guard<std::mutex> guard(victim.lock);
+        size_t n = victim.shared.size();
+        if (n == 0) return false;
+
+        size_t take = (n + 1) / 2;
+        stack.insert(stack.end(), victim.shared.end() - take,
+                     victim.shared.end());
+        victim.shared.resize(n - take);
+        victim.shared_count.store(n - take, std::memory_order_release);
+        return true;
+    }
+};
+
+void vm::gc_heap::mark_thread(mark_worker *workers, size_t count,
+                              size_t self, std::atomic<size_t> &idle) {
+    mark_worker &w = workers[self];
+
+    for (;;) {
+        while (!w.stack.empty()) {
+            mark_task task = w.stack.back();
+            w.stack.pop_back();
+            scan(w, task);
+
+            if (w.stack.size() >= mark_worker::SHARE_MIN &&
+                w.shared_count.load(std::memory_order_relaxed) == 0)
+                w.share();
+        }
+
+        // its own shared tasks first
+        bool stole = false;
+        for (size_t i = 0; i < count && !stole; ++i)
+            stole = w.steal_from(workers[(self + i) % count]);
+        if (stole) continue;
+
+        // a thread only goes idle after finding every shared stack empty,
+        // including its own, which nothing but itself adds to. so once all
+        // of them are idle, there is nothing left anywhere.
+        idle.fetch_add(1);
+        for (;;) {
+            if (idle.load() == count) return;
+
+            bool any = false;
+            for (size_t i = 0; i < count && !any; ++i)
+                any = workers[i].shared_count.load(std::memory_order_relaxed) > 0;
+
+            if (any) break;
+            std::this_thread::yield();
+        }
+        idle.fetch_sub(1);
+    }
+}
+
+void vm::gc_heap::mark_parallel(size_t threads) {
+    std::unique_ptr<mark_worker[]> workers(new mark_worker[threads]);
+    for (size_t i = 0; i < _gray.size(); ++i)
+        workers[i % threads].stack.push_back({ _gray[i], 0 });
+    _gray.clear();
+
+    std::atomic<size_t> idle{ 0 };
+    std::vector<std::thread> pool;
+    for (size_t i = 1; i < threads; ++i)
+        pool.emplace_back(mark_thread, workers.get(), threads, i,
+                          std::ref(idle));
+
+    mark_thread(workers.get(), threads, 0, idle);
+    for (std::thread &t : pool)
+        t.join();
+
+    for (size_t i = 0; i < threads; ++i)
+        _slices.insert(_slices.end(), workers[i].slices.begin(),
+                       workers[i].slices.end());
+
+    ++_stats.parallel_marks;
+}
+
+void vm::gc_heap::collect() {
+    // mark everything reachable from the roots. the heap at this point is
+    // what survived last time plus everything allocated since.
+    auto mark_start = std::chrono::steady_clock::now();
+    if (_mark_threads > 1 && _live + _debt >= PARALLEL_MARK_MIN)
+        mark_parallel(_mark_threads);
+    else
+        mark_serial();
+    _stats.mark_us += std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - mark_start).count();
+
+    // slices of strings that are about to be freed take a copy of their
+    // characters
+    for (slice_string *slice : _slices) {
+        if (!slice->_parent->_gc_marked.load(std::memory_order_relaxed))
+            slice->detach();
+    }
+    _slices.clear();
+
+    // free unmarked objects
+    size_t live = 0;
+    gc_object **link = &_objects;
+    while (*link) {
+        gc_object *obj = *link;
+
+        if (obj->_gc_marked.load(std::memory_order_relaxed)) {
+            obj->_gc_marked.store(false, std::memory_order_relaxed);
+            live += object_size(obj);
+            link = &obj->_gc_next;
+        } else {
+            *link = obj->_gc_next;
+            free_object(obj);
+        }
+    }
+
+    ++_stats.collections;
+    _live = live;
+    _debt = 0;
+    _threshold = live * 2;
+    if (_threshold < MIN_THRESHOLD)
+        _threshold = MIN_THRESHOLD;
+}
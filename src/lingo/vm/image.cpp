@@ -0,0 +1,1182 @@
+#include "vm.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define LINGO_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+using namespace lingo;
+
+vm::image* vm::image::make(int32_t width, int32_t height, uint8_t depth) {
+    image *img = new image(width, height, depth);
+
+    size_t row_bytes = (size_t)width * (depth / 8);
+    img->_stride = (row_bytes + ROW_ALIGN - 1) & ~(ROW_ALIGN - 1);
+    img->_pixels = (uint8_t*) ::operator new(img->bytes(),
+                                             std::align_val_t(ROW_ALIGN));
+    return img;
+}
+
+vm::image* vm::image::alloc(gc_heap &heap, int32_t width, int32_t height,
+                            uint8_t depth) {
+    image *img = make(width, height, depth);
+
+    // white is all ones at 32 bits and index 0 at 8
+    memset(img->_pixels, depth == 32 ? 0xFF : 0x00, img->bytes());
+
+    heap.link(img, sizeof(image) + img->bytes());
+    return img;
+}
+
+vm::image::~image() {
+    drop_planes();
+    ::operator delete(_pixels, std::align_val_t(ROW_ALIGN));
+    owner_tag::release(_container);
+}
+
+void vm::image::drop_planes() {
+    delete _mask;
+    delete _matte;
+    _mask = _matte = nullptr;
+}
+
+void vm::image::fill(const int32_t *rect, uint32_t value) {
+    int32_t x0 = std::max(rect[0], 0), x1 = std::min(rect[2], _width);
+    int32_t y0 = std::max(rect[1], 0), y1 = std::min(rect[3], _height);
+    if (x0 >= x1 || y0 >= y1) return;
+
+    for (int32_t y = y0; y < y1; ++y) {
+        if (_depth == 32)
+            std::fill_n((uint32_t*)row(y) + x0, x1 - x0, value);
+        else
+            memset(row(y) + x0, (uint8_t)value, (size_t)(x1 - x0));
+    }
+
+    changed();
+}
+
+vm::image* vm::image::duplicate(gc_heap &heap) const {
+    image *img = alloc(heap, _width, _height, _depth);
+    memcpy(img->_pixels, _pixels, bytes());
+
+    ++heap.stats().duplicates;
+    heap.stats().duplicate_bytes += bytes();
+    return img;
+}
+
+// ink kernels. inks work on 16 bytes of the destination at a time: 4
+// argb pixels at 32 bits, or 16 gray levels at 8. the gray level of an
+// 8-bit pixel is 255 - its palette index, so that darkest, add and the
+// rest mean the same at both depths. every combination of ink, source and
+// destination depth, mask and colorizing is its own kernel, chosen once
+// per blit.
+
+// the constants of a blit, in the destination's format
+struct ink_consts {
+    uint8_t fg[16]; // the color black is mapped to
+    uint8_t bg[16]; // the color white is mapped to, and the transparent one
+    uint8_t alpha[16]; // the alpha bytes of 32-bit pixels; none at 8
+    int32_t blend; // 0 to 128
+};
+
+static inline uint8_t gray_of(uint32_t rgb) {
+    return vm::image::gray(rgb);
+}
+
+#ifdef LINGO_SSE2
+typedef __m128i block;
+
+static inline block load(const uint8_t *p) {
+    return _mm_loadu_si128((const __m128i*)p);
+}
+
+static inline void store(uint8_t *p, block b) {
+    _mm_storeu_si128((__m128i*)p, b);
+}
+
+static inline block ones() { return _mm_set1_epi8((char)0xFF); }
+static inline block b_and(block a, block b) { return _mm_and_si128(a, b); }
+static inline block b_or(block a, block b) { return _mm_or_si128(a, b); }
+static inline block b_xor(block a, block b) { return _mm_xor_si128(a, b); }
+static inline block b_andnot(block a, block b) { return _mm_andnot_si128(a, b); }
+static inline block eq8(block a, block b) { return _mm_cmpeq_epi8(a, b); }
+static inline block eq32(block a, block b) { return _mm_cmpeq_epi32(a, b); }
+static inline block add8(block a, block b) { return _mm_add_epi8(a, b); }
+static inline block sub8(block a, block b) { return _mm_sub_epi8(a, b); }
+static inline block adds8(block a, block b) { return _mm_adds_epu8(a, b); }
+static inline block subs8(block a, block b) { return _mm_subs_epu8(a, b); }
+static inline block min8(block a, block b) { return _mm_min_epu8(a, b); }
+static inline block max8(block a, block b) { return _mm_max_epu8(a, b); }
+
+// 4 bytes, each repeated 4 times
+static inline block widen4(const uint8_t *p) {
+    int32_t v;
+    memcpy(&v, p, 4);
+    block b = _mm_cvtsi32_si128(v);
+    b = _mm_unpacklo_epi8(b, b);
+    return _mm_unpacklo_epi16(b, b);
+}
+
+// the gray levels of 16 argb pixels
+static inline block gray16(const uint8_t *p) {
+    const block byte = _mm_set1_epi32(0xFF);
+    block y[4];
+    for (int i = 0; i < 4; ++i) {
+        block px = load(p + i * 16);
+        block r = _mm_and_si128(_mm_srli_epi32(px, 16), byte);
+        block g = _mm_and_si128(_mm_srli_epi32(px, 8), byte);
+        block b = _mm_and_si128(px, byte);
+
+        // the products and their sum fit in the low 16 bits of each lane
+        y[i] = _mm_srli_epi32(_mm_add_epi32(
+            _mm_add_epi32(_mm_mullo_epi16(r, _mm_set1_epi32(77)),
+                          _mm_mullo_epi16(g, _mm_set1_epi32(150))),
+            _mm_mullo_epi16(b, _mm_set1_epi32(29))), 8);
+    }
+
+    return _mm_packus_epi16(_mm_packs_epi32(y[0], y[1]),
+                            _mm_packs_epi32(y[2], y[3]));
+}
+
+// d + (s - d) * w / 128
+static inline block blend8(block d, block s, int32_t w) {
+    const block zero = _mm_setzero_si128();
+    const block wv = _mm_set1_epi16((short)w);
+
+    block lo = _mm_sub_epi16(_mm_unpacklo_epi8(s, zero),
+                             _mm_unpacklo_epi8(d, zero));
+    block hi = _mm_sub_epi16(_mm_unpackhi_epi8(s, zero),
+                             _mm_unpackhi_epi8(d, zero));
+    lo = _mm_add_epi16(_mm_unpacklo_epi8(d, zero),
+                       _mm_srai_epi16(_mm_mullo_epi16(lo, wv), 7));
+    hi = _mm_add_epi16(_mm_unpackhi_epi8(d, zero),
+                       _mm_srai_epi16(_mm_mullo_epi16(hi, wv), 7));
+    return _mm_packus_epi16(lo, hi);
+}
+
+// (fg * (255 - s) + bg * s) / 255, rounded
+static inline block colorize8(block s, block fg, block bg) {
+    const block zero = _mm_setzero_si128();
+    const block max = _mm_set1_epi16(255);
+    const block half = _mm_set1_epi16(128);
+
+    block out[2];
+    for (int i = 0; i < 2; ++i) {
+        block sv = i ? _mm_unpackhi_epi8(s, zero) : _mm_unpacklo_epi8(s, zero);
+        block f = i ? _mm_unpackhi_epi8(fg, zero) : _mm_unpacklo_epi8(fg, zero);
+        block b = i ? _mm_unpackhi_epi8(bg, zero) : _mm_unpacklo_epi8(bg, zero);
+
+        block x = _mm_add_epi16(
+            _mm_mullo_epi16(f, _mm_sub_epi16(max, sv)),
+            _mm_mullo_epi16(b, sv));
+        x = _mm_add_epi16(x, half);
+        out[i] = _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+    }
+
+    return _mm_packus_epi16(out[0], out[1]);
+}
+#else
+struct block {
+    uint8_t b[16];
+};
+
+static inline block load(const uint8_t *p) {
+    block r;
+    memcpy(r.b, p, 16);
+    return r;
+}
+
+static inline void store(uint8_t *p, block b) { memcpy(p, b.b, 16); }
+
+template <typename F>
+static inline block each(block a, block b, F f) {
+    block r;
+    for (int i = 0; i < 16; ++i) r.b[i] = (uint8_t)f(a.b[i], b.b[i]);
+    return r;
+}
+
+static inline block ones() {
+    block r;
+    memset(r.b, 0xFF, 16);
+    return r;
+}
+
+static inline block b_and(block a, block b) { return each(a, b, [](int x, int y) { return x & y; }); }
+static inline block b_or(block a, block b) { return each(a, b, [](int x, int y) { return x | y; }); }
+static inline block b_xor(block a, block b) { return each(a, b, [](int x, int y) { return x ^ y; }); }
+static inline block b_andnot(block a, block b) { return each(a, b, [](int x, int y) { return ~x & y; }); }
+static inline block eq8(block a, block b) { return each(a, b, [](int x, int y) { return x == y ? 0xFF : 0; }); }
+static inline block add8(block a, block b) { return each(a, b, [](int x, int y) { return x + y; }); }
+static inline block sub8(block a, block b) { return each(a, b, [](int x, int y) { return x - y; }); }
+static inline block adds8(block a, block b) { return each(a, b, [](int x, int y) { return std::min(x + y, 255); }); }
+static inline block subs8(block a, block b) { return each(a, b, [](int x, int y) { return std::max(x - y, 0); }); }
+static inline block min8(block a, block b) { return each(a, b, [](int x, int y) { return std::min(x, y); }); }
+static inline block max8(block a, block b) { return each(a, b, [](int x, int y) { return std::max(x, y); }); }
+
+static inline block eq32(block a, block b) {
+    block r;
+    for (int i = 0; i < 16; i += 4) {
+        uint8_t m = memcmp(a.b + i, b.b + i, 4) == 0 ? 0xFF : 0;
+        memset(r.b + i, m, 4);
+    }
+    return r;
+}
+
+static inline block widen4(const uint8_t *p) {
+    block r;
+    for (int i = 0; i < 16; ++i) r.b[i] = p[i / 4];
+    return r;
+}
+
+static inline block gray16(const uint8_t *p) {
+    block r;
+    for (int i = 0; i < 16; ++i) {
+        uint32_t px;
+        memcpy(&px, p + i * 4, 4);
+        r.b[i] = gray_of(px);
+    }
+    return r;
+}
+
+static inline block blend8(block d, block s, int32_t w) {
+    block r;
+    for (int i = 0; i < 16; ++i)
+        r.b[i] = (uint8_t)(d.b[i] + (((int)s.b[i] - (int)d.b[i]) * w >> 7));
+    return r;
+}
+
+static inline block colorize8(block s, block fg, block bg) {
+    block r;
+    for (int i = 0; i < 16; ++i) {
+        uint32_t x = fg.b[i] * (255u - s.b[i]) + bg.b[i] * s.b[i] + 128;
+        r.b[i] = (uint8_t)((x + (x >> 8)) >> 8);
+    }
+    return r;
+}
+#endif
+
+static const uint8_t OPAQUE[16] = {
+    0, 0, 0, 0xFF, 0, 0, 0, 0xFF, 0, 0, 0, 0xFF, 0, 0, 0, 0xFF
+};
+
+// the source pixels under 16 bytes of the destination, from pixel p on,
+// in the destination's format
+template <int SD, int DD>
+static inline block load_src(const uint8_t *in, size_t p) {
+    if (SD == DD) {
+        block b = load(in + p * (SD / 8));
+        return DD == 8 ? b_xor(b, ones()) : b;
+    }
+
+    // palette indices to opaque gray argb
+    if (DD == 32)
+        return b_or(b_xor(widen4(in + p), ones()), load(OPAQUE));
+
+    return gray16(in + p * 4);
+}
+
+// the pixels of a mask to draw, from pixel p on
+template <int DD>
+static inline block load_keep(const uint8_t *mask, size_t p) {
+    block m = DD == 8 ? load(mask + p) : widen4(mask + p);
+    block white = b_xor(m, m);
+    return b_xor(eq8(m, white), ones());
+}
+
+template <int INK>
+static inline block ink_op(block s, block d, const ink_consts &k) {
+    switch (INK) {
+        case vm::INK_BLEND: return blend8(d, s, k.blend);
+        case vm::INK_ADD_PIN: return adds8(d, s);
+        case vm::INK_ADD: return add8(d, s);
+        case vm::INK_SUBTRACT_PIN: return subs8(d, s);
+        case vm::INK_SUBTRACT: return sub8(d, s);
+        case vm::INK_LIGHTEST: return max8(d, s);
+        case vm::INK_DARKEST: return min8(d, s);
+        default: return s;
+    }
+}
+
+template <int INK, int SD, int DD, bool MASK, bool COLOR>
+static inline void ink_block(uint8_t *out, const uint8_t *in,
+                             const uint8_t *mask, size_t p,
+                             const ink_consts &k) {
+    constexpr bool REPLACES = INK == vm::INK_COPY ||
+                              INK == vm::INK_BACKGROUND_TRANSPARENT;
+
+    block s = load_src<SD, DD>(in, p);
+    if (COLOR) s = colorize8(s, load(k.fg), load(k.bg));
+
+    block d = load(out);
+    if (DD == 8) d = b_xor(d, ones());
+
+    block r = ink_op<INK>(s, d, k);
+
+    // the arithmetic inks leave the alpha of the source
+    if (!REPLACES && DD == 32) {
+        block alpha = load(k.alpha);
+        r = b_or(b_andnot(alpha, r), b_and(alpha, s));
+    }
+
+    if (INK == vm::INK_BACKGROUND_TRANSPARENT || MASK) {
+        block keep = ones();
+        if (INK == vm::INK_BACKGROUND_TRANSPARENT) {
+            block alpha = load(k.alpha);
+            block same = DD == 8
+                ? eq8(s, load(k.bg))
+                : eq32(b_or(s, alpha), b_or(load(k.bg), alpha));
+            keep = b_xor(same, keep);
+        }
+
+        if (MASK) keep = b_and(keep, load_keep<DD>(mask, p));
+        r = b_or(b_and(keep, r), b_andnot(keep, d));
+    }
+
+    if (DD == 8) r = b_xor(r, ones());
+    store(out, r);
+}
+
+typedef void (*ink_kernel)(uint8_t *out, const uint8_t *in,
+                           const uint8_t *mask, size_t n,
+                           const ink_consts &k);
+
+// n pixels of out from n source pixels, and n mask pixels if MASK
+template <int INK, int SD, int DD, bool MASK, bool COLOR>
+static void ink_row(uint8_t *out, const uint8_t *in, const uint8_t *mask,
+                    size_t n, const ink_consts &k) {
+    constexpr size_t PER_BLOCK = 16 / (DD / 8);
+
+    size_t p = 0;
+    for (; p + PER_BLOCK <= n; p += PER_BLOCK)
+        ink_block<INK, SD, DD, MASK, COLOR>(out + p * (DD / 8), in, mask, p, k);
+
+    // the last few through a padded block
+    size_t left = n - p;
+    if (left == 0) return;
+
+    uint8_t out_tail[16] = {}, in_tail[64] = {}, mask_tail[16] = {};
+    memcpy(out_tail, out + p * (DD / 8), left * (DD / 8));
+    memcpy(in_tail, in + p * (SD / 8), left * (SD / 8));
+    if (MASK) memcpy(mask_tail, mask + p, left);
+
+    ink_block<INK, SD, DD, MASK, COLOR>(out_tail, in_tail, mask_tail, 0, k);
+    memcpy(out + p * (DD / 8), out_tail, left * (DD / 8));
+}
+
+template <int INK, int SD, int DD>
+static constexpr ink_kernel flag_kernels[4] = {
+    ink_row<INK, SD, DD, false, false>,
+    ink_row<INK, SD, DD, false, true>,
+    ink_row<INK, SD, DD, true, false>,
+    ink_row<INK, SD, DD, true, true>
+};
+
+template <int INK>
+static ink_kernel pick_depths(int sd, int dd, bool mask, bool color) {
+    int flags = mask * 2 + color;
+    if (sd == 32)
+        return dd == 32 ? flag_kernels<INK, 32, 32>[flags]
+                        : flag_kernels<INK, 32, 8>[flags];
+    return dd == 32 ? flag_kernels<INK, 8, 32>[flags]
+                    : flag_kernels<INK, 8, 8>[flags];
+}
+
+static ink_kernel pick_kernel(uint8_t ink, int sd, int dd, bool mask,
+                              bool color) {
+    switch (ink) {
+        // matte is copy through a mask made from the source
+        case vm::INK_COPY:
+        case vm::INK_MATTE:
+            return pick_depths<vm::INK_COPY>(sd, dd, mask, color);
+
+        case vm::INK_BLEND:
+            return pick_depths<vm::INK_BLEND>(sd, dd, mask, color);
+        case vm::INK_ADD_PIN:
+            return pick_depths<vm::INK_ADD_PIN>(sd, dd, mask, color);
+        case vm::INK_ADD:
+            return pick_depths<vm::INK_ADD>(sd, dd, mask, color);
+        case vm::INK_SUBTRACT_PIN:
+            return pick_depths<vm::INK_SUBTRACT_PIN>(sd, dd, mask, color);
+        case vm::INK_BACKGROUND_TRANSPARENT:
+            return pick_depths<vm::INK_BACKGROUND_TRANSPARENT>(sd, dd, mask, color);
+        case vm::INK_LIGHTEST:
+            return pick_depths<vm::INK_LIGHTEST>(sd, dd, mask, color);
+        case vm::INK_SUBTRACT:
+            return pick_depths<vm::INK_SUBTRACT>(sd, dd, mask, color);
+        case vm::INK_DARKEST:
+            return pick_depths<vm::INK_DARKEST>(sd, dd, mask, color);
+        default:
+            return nullptr;
+    }
+}
+
+static void fill_consts(ink_consts &k, const vm::blit_params &params,
+                        int dd) {
+    for (int i = 0; i < 16; ++i) {
+        int c = i & 3;
+        if (dd == 8) {
+            k.fg[i] = gray_of(params.color);
+            k.bg[i] = gray_of(params.bg_color);
+            k.alpha[i] = 0;
+        } else if (c == 3) {
+            k.fg[i] = k.bg[i] = k.alpha[i] = 0xFF;
+        } else {
+            k.fg[i] = (uint8_t)(params.color >> (c * 8));
+            k.bg[i] = (uint8_t)(params.bg_color >> (c * 8));
+            k.alpha[i] = 0;
+        }
+    }
+
+    int32_t blend = std::min(std::max(params.blend, 0), 100);
+    k.blend = blend * 128 / 100;
+}
+
+const vm::image& vm::image::mask() const {
+    if (_mask) return *_mask;
+
+    _mask = make(_width, _height, 8);
+    for (int32_t y = 0; y < _height; ++y) {
+        uint8_t *out = _mask->row(y);
+        const uint8_t *in = row(y);
+
+        // 8-bit pixels are already how dark they are
+        if (_depth == 8) {
+            memcpy(out, in, (size_t)_width);
+            continue;
+        }
+
+        size_t x = 0;
+        for (; x + 16 <= (size_t)_width; x += 16)
+            store(out + x, b_xor(gray16(in + x * 4), ones()));
+        for (; x < (size_t)_width; ++x)
+            out[x] = (uint8_t)~gray_of(((const uint32_t*)in)[x]);
+    }
+
+    return *_mask;
+}
+
+const vm::image& vm::image::matte() const {
+    if (_matte) return *_matte;
+
+    image *matte = make(_width, _height, 8);
+    memset(matte->_pixels, 0xFF, matte->bytes());
+    _matte = matte;
+
+    size_t w = (size_t)_width;
+    size_t h = (size_t)_height;
+    auto white = [&](size_t x, size_t y) {
+        return _depth == 32
+            ? (((const uint32_t*)row((int32_t)y))[x] & 0xFFFFFF) == 0xFFFFFF
+            : row((int32_t)y)[x] == 0;
+    };
+
+    std::vector<std::pair<size_t, size_t>> todo;
+    auto visit = [&](size_t x, size_t y) {
+        uint8_t &m = matte->row((int32_t)y)[x];
+        if (m && white(x, y)) {
+            m = 0;
+            todo.push_back({ x, y });
+        }
+    };
+
+    for (size_t x = 0; x < w; ++x) { visit(x, 0); visit(x, h - 1); }
+    for (size_t y = 0; y < h; ++y) { visit(0, y); visit(w - 1, y); }
+
+    while (!todo.empty()) {
+        auto [x, y] = todo.back();
+        todo.pop_back();
+
+        if (x > 0) visit(x - 1, y);
+        if (x + 1 < w) visit(x + 1, y);
+        if (y > 0) visit(x, y - 1);
+        if (y + 1 < h) visit(x, y + 1);
+    }
+
+    return *_matte;
+}
+
+// nearest-neighbour gather of a row through a table of source columns
+static void gather_row(uint32_t *dst, const uint32_t *src, const int32_t *cols,
+                       size_t n) {
+    size_t i = 0;
+#ifdef __AVX2__
+    for (; i + 8 <= n; i += 8) {
+        __m256i idx = _mm256_loadu_si256((const __m256i*)(cols + i));
+        _mm256_storeu_si256((__m256i*)(dst + i),
+            _mm256_i32gather_epi32((const int*)src, idx, 4));
+    }
+#endif
+    for (; i < n; ++i)
+        dst[i] = src[cols[i]];
+}
+
+static void gather_row(uint8_t *dst, const uint8_t *src, const int32_t *cols,
+                       size_t n) {
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = src[cols[i]];
+}
+
+// the source coordinate of each destination coordinate in [from, to) along
+// one axis, trimmed to the run whose sources are inside [0, size). returns
+// the first destination coordinate of the run, and leaves its sources in
+// map.
+static int32_t map_axis(int32_t d0, int32_t d1, int32_t s0, int32_t s1,
+                        int32_t from, int32_t to, int32_t size,
+                        std::vector<int32_t> &map) {
+    int64_t dn = d1 - d0;
+    int64_t sn = s1 - s0;
+
+    map.clear();
+    int32_t first = to;
+    for (int32_t d = from; d < to; ++d) {
+        int32_t s = s0 + (int32_t)((d - d0) * sn / dn);
+        if (s < 0 || s >= size) {
+            // sources only increase, so nothing after an overrun is in
+            if (s >= size) break;
+            continue;
+        }
+
+        if (map.empty()) first = d;
+        map.push_back(s);
+    }
+
+    return first;
+}
+
+// what a blit needs besides its geometry: the kernel, its constants and
+// the mask, if any
+struct blit_setup {
+    ink_kernel kernel;
+    ink_consts k;
+    const uint8_t *pixels = nullptr; // row 0 of the source
+    size_t stride = 0;
+    const uint8_t *mask = nullptr;
+    size_t mask_stride = 0;
+
+    // a plain copy doesn't depend on what it is drawn over, so it can be
+    // done without the kernel
+    bool plain;
+};
+
+static bool setup_blit(blit_setup &b, const vm::image &dst,
+                       const vm::image &src, const vm::blit_params &params) {
+    uint8_t ink = params.ink;
+    if (ink == vm::INK_COPY && params.blend < 100)
+        ink = vm::INK_BLEND;
+
+    b.pixels = src.row(0);
+    b.stride = src.stride();
+    if (params.mask) {
+        b.mask = params.mask->row(0);
+        b.mask_stride = params.mask->stride();
+    } else if (ink == vm::INK_MATTE) {
+        b.mask = src.matte().row(0);
+        b.mask_stride = src.matte().stride();
+    }
+
+    b.kernel = pick_kernel(ink, src.depth(), dst.depth(), b.mask != nullptr,
+                           params.colorize);
+    if (!b.kernel) return false;
+
+    fill_consts(b.k, params, dst.depth());
+    b.plain = ink == vm::INK_COPY && !b.mask && !params.colorize &&
+              src.depth() == dst.depth();
+    return true;
+}
+
+// a blit of an image onto itself would read pixels it has already written,
+// and with threads, pixels that another thread is writing. if the part of
+// dst it writes meets rows [y0, y1) of what it reads, those rows are copied
+// out first and read from the copy. rows above y0 aren't read, and the
+// copies leave them unset.
+struct blit_stage {
+    std::unique_ptr<uint8_t[]> pixels, mask;
+
+    void stage(blit_setup &b, const vm::image &dst, const vm::image &src,
+               const vm::blit_params &params, const int32_t *dst_area,
+               const int32_t *read_area) {
+        if (dst_area[0] >= read_area[2] || read_area[0] >= dst_area[2] ||
+            dst_area[1] >= read_area[3] || read_area[1] >= dst_area[3])
+            return;
+
+        int32_t y0 = read_area[1], y1 = read_area[3];
+        if (&src == &dst) {
+            pixels.reset(copy_rows(src, y0, y1));
+            b.pixels = pixels.get();
+        }
+        if (params.mask == &dst) {
+            mask.reset(copy_rows(dst, y0, y1));
+            b.mask = mask.get();
+        }
+    }
+
+    static uint8_t* copy_rows(const vm::image &img, int32_t y0, int32_t y1) {
+        uint8_t *copy = new uint8_t[(size_t)y1 * img.stride()];
+        memcpy(copy + (size_t)y0 * img.stride(), img.row(y0),
+               (size_t)(y1 - y0) * img.stride());
+        return copy;
+    }
+};
+
+bool vm::copy_pixels(image &dst, const int32_t *dst_rect, const image &src,
+                     const int32_t *src_rect, const blit_params &params) {
+    blit_setup b;
+    if (!setup_blit(b, dst, src, params))
+        return false;
+
+    if (dst_rect[2] <= dst_rect[0] || dst_rect[3] <= dst_rect[1] ||
+        src_rect[2] <= src_rect[0] || src_rect[3] <= src_rect[1])
+        return true;
+
+    // the part of the destination inside dst, and of that, the part whose
+    // sources are inside src
+    std::vector<int32_t> cols, rows;
+    int32_t x0 = map_axis(dst_rect[0], dst_rect[2], src_rect[0], src_rect[2],
+                          std::max(dst_rect[0], 0),
+                          std::min(dst_rect[2], dst.width()),
+                          src.width(), cols);
+    int32_t y0 = map_axis(dst_rect[1], dst_rect[3], src_rect[1], src_rect[3],
+                          std::max(dst_rect[1], 0),
+                          std::min(dst_rect[3], dst.height()),
+                          src.height(), rows);
+    if (cols.empty() || rows.empty()) return true;
+
+    size_t n = cols.size();
+    size_t src_bpp = src.depth() / 8;
+    size_t dst_bpp = dst.depth() / 8;
+
+    // rows and cols only go up
+    int32_t dst_area[4] = {
+        x0, y0, x0 + (int32_t)n, y0 + (int32_t)rows.size()
+    };
+    int32_t read_area[4] = {
+        cols.front(), rows.front(), cols.back() + 1, rows.back() + 1
+    };
+    blit_stage staged;
+    staged.stage(b, dst, src, params, dst_area, read_area);
+
+    const uint8_t *mask = b.mask;
+    size_t mask_stride = b.mask_stride;
+
+    // a plain copy is done with memcpy and repeated rows
+    bool plain = b.plain;
+
+    // unscaled columns are a straight run of the source row
+    bool gather = (size_t)(cols.back() - cols.front()) + 1 != n;
+
+    // a row of gathered source and mask pixels
+    std::unique_ptr<uint8_t[]> src_tmp, mask_tmp;
+    if (gather && !plain) {
+        src_tmp.reset(new uint8_t[n * src_bpp]);
+        if (mask) mask_tmp.reset(new uint8_t[n]);
+    }
+
+    for (size_t j = 0; j < rows.size(); ++j) {
+        uint8_t *out = dst.row(y0 + (int32_t)j) + (size_t)x0 * dst_bpp;
+        bool repeat = j > 0 && rows[j] == rows[j - 1];
+
+        // a source row repeated by vertical scaling is the row above again
+        if (plain && repeat) {
+            memcpy(out, out - dst.stride(), n * dst_bpp);
+            continue;
+        }
+
+        const uint8_t *in = b.pixels + (size_t)rows[j] * b.stride;
+        const uint8_t *mask_row = mask ? mask + rows[j] * mask_stride : nullptr;
+
+        if (plain) {
+            if (gather && src_bpp == 4)
+                gather_row((uint32_t*)out, (const uint32_t*)in, cols.data(), n);
+            else if (gather)
+                gather_row(out, in, cols.data(), n);
+            else
+                memcpy(out, in + (size_t)cols.front() * src_bpp, n * dst_bpp);
+            continue;
+        }
+
+        if (gather) {
+            if (!repeat) {
+                if (src_bpp == 4)
+                    gather_row((uint32_t*)src_tmp.get(), (const uint32_t*)in,
+                               cols.data(), n);
+                else
+                    gather_row(src_tmp.get(), in, cols.data(), n);
+
+                if (mask)
+                    gather_row(mask_tmp.get(), mask_row, cols.data(), n);
+            }
+
+            in = src_tmp.get();
+            mask_row = mask_tmp.get();
+        } else {
+            in += (size_t)cols.front() * src_bpp;
+            if (mask) mask_row += cols.front();
+        }
+
+        b.kernel(out, in, mask_row, n, b.k);
+    }
+
+    dst.changed();
+    return true;
+}
+
+// worker threads for blits that are big enough to split. they are started
+// the first time they are needed and wait for the next blit in between.
+class blit_pool {
+public:
+    ~blit_pool() {
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+            _stop = true;
+        }
+        _wake.notify_all();
+        for (std::thread &t : _threads)
+            t.join();
+    }
+
+    // calls job(i) for every i in [0, count), on up to threads threads
+    // counting the caller
+    void run(size_t count, size_t threads,
+             const std::function<void(size_t)> &job) {
+        std::lock_guard<std::mutex> one_at_a_time(_run_lock);
+
+        std::unique_lock<std::mutex> lock(_lock);
+        while (_threads.size() + 1 < threads)
+            _threads.emplace_back(&blit_pool::work, this);
+
+        _job = &job;
+        _count = count;
+        _next = 0;
+        _wanted = threads - 1;
+        ++_round;
+        lock.unlock();
+        _wake.notify_all();
+
+        drain(job);
+
+        // workers that haven't woken up yet would find nothing left to do
+        lock.lock();
+        _wanted = 0;
+        _done.wait(lock, [this] { return _active == 0; });
+        _job = nullptr;
+    }
+
+private:
+    void drain(const std::function<void(size_t)> &job) {
+        for (size_t i; (i = _next.fetch_add(1)) < _count;)
+            job(i);
+    }
+
+    void work() {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(_lock);
+        for (;;) {
+            _wake.wait(lock, [&] {
+                return _stop || (_round != seen && _wanted > 0);
+            });
+            if (_stop) return;
+
+            seen = _round;
+            --_wanted;
+            ++_active;
+            const std::function<void(size_t)> *job = _job;
+            lock.unlock();
+
+            drain(*job);
+
+            lock.lock();
+            if (--_active == 0)
+                _done.notify_all();
+        }
+    }
+
+    std::mutex _run_lock;
+    std::mutex _lock;
+    std::condition_variable _wake, _done;
+    std::vector<std::thread> _threads;
+
+    const std::function<void(size_t)> *_job = nullptr;
+    std::atomic<size_t> _next{0};
+    size_t _count = 0;
+    size_t _wanted = 0; // workers still to join the round
+    size_t _active = 0; // workers in the round
+    uint64_t _round = 0;
+    bool _stop = false;
+};
+
+static blit_pool pool;
+static std::atomic<size_t> blit_threads{
+    std::max(1u, std::thread::hardware_concurrency())
+};
+
+void vm::set_blit_threads(size_t n) {
+    blit_threads = n > 0 ? n : 1;
+}
+
+// quads are drawn in tiles, so that the source pixels a tile reads stay in
+// cache however the quad is turned. a blit is only split across threads
+// when it covers at least PARALLEL_BLIT_MIN pixels.
+static constexpr int32_t TILE_W = 256;
+static constexpr int32_t TILE_H = 32;
+static constexpr int64_t PARALLEL_BLIT_MIN = 256 * 256;
+static constexpr double TIE_BIAS = 1e-7;
+
+// the projective map from destination pixels to source coordinates: a
+// destination point x, y maps to (sx, sy) / w, where each of sx, sy and w
+// is c[0] * x + c[1] * y + c[2]. affine maps have w = 1.
+struct quad_map {
+    double sx[3], sy[3], w[3];
+    bool projective;
+};
+
+// the map that takes the source rect to the quad, whose corners are its
+// top left, top right, bottom right and bottom left. false if the quad is
+// degenerate.
+static bool make_quad_map(quad_map &m, const double *q,
+                          const int32_t *src_rect) {
+    // the unit square to the quad, as in heckbert's "fundamentals of
+    // texture mapping"
+    double a, b, c, d, e, f, g, h;
+    double ex = q[0] - q[2] + q[4] - q[6];
+    double ey = q[1] - q[3] + q[5] - q[7];
+
+    // turned rects are parallelograms give or take rounding, and are
+    // much cheaper to draw as such
+    double size = 0;
+    for (int i = 2; i < 8; ++i)
+        size = std::max(size, std::fabs(q[i] - q[i & 1]));
+
+    if (std::fabs(ex) <= size * 1e-12 && std::fabs(ey) <= size * 1e-12) {
+        a = q[2] - q[0]; b = q[6] - q[0]; c = q[0];
+        d = q[3] - q[1]; e = q[7] - q[1]; f = q[1];
+        g = h = 0;
+    } else {
+        double dx1 = q[2] - q[4], dx2 = q[6] - q[4];
+        double dy1 = q[3] - q[5], dy2 = q[7] - q[5];
+        double den = dx1 * dy2 - dx2 * dy1;
+        if (den == 0) return false;
+
+        g = (ex * dy2 - dx2 * ey) / den;
+        h = (dx1 * ey - ex * dy1) / den;
+        a = q[2] - q[0] + g * q[2]; b = q[6] - q[0] + h * q[6]; c = q[0];
+        d = q[3] - q[1] + g * q[3]; e = q[7] - q[1] + h * q[7]; f = q[1];
+    }
+
+    // its adjugate takes the quad back to the square. the sign is chosen
+    // so that w is positive inside the quad.
+    double u[3] = { e - f * h, c * h - b, b * f - c * e };
+    double v[3] = { f * g - d, a - c * g, c * d - a * f };
+    double w[3] = { d * h - e * g, b * g - a * h, a * e - b * d };
+    double det = a * u[0] + b * v[0] + c * w[0];
+    if (det == 0 || !std::isfinite(det)) return false;
+
+    double sign = det < 0 ? -1 : 1;
+    double sw = src_rect[2] - src_rect[0];
+    double sh = src_rect[3] - src_rect[1];
+    for (int i = 0; i < 3; ++i) {
+        u[i] *= sign;
+        v[i] *= sign;
+        w[i] *= sign;
+        m.sx[i] = u[i] * sw + w[i] * src_rect[0];
+        m.sy[i] = v[i] * sh + w[i] * src_rect[1];
+        m.w[i] = w[i];
+    }
+
+    // source coordinates that are whole numbers come out of the sums a
+    // hair to either side, so nudge them all up to the one they should be
+    for (int i = 0; i < 3; ++i) {
+        m.sx[i] += TIE_BIAS * m.w[i];
+        m.sy[i] += TIE_BIAS * m.w[i];
+    }
+
+    // parallelograms divide by a constant, which can be done up front
+    m.projective = g != 0 || h != 0;
+    if (!m.projective) {
+        for (int i = 0; i < 3; ++i) {
+            m.sx[i] /= w[2];
+            m.sy[i] /= w[2];
+            m.w[i] = i == 2 ? 1 : 0;
+        }
+    }
+
+    return true;
+}
+
+// the source pixels of a row of destination pixels, from the pixel at x, y.
+// pixel i is inside the source if in(i), and at() gives its column and row.
+// pixels are sampled at their centers.
+
+// affine maps step through the row in 32.32 fixed point, relative to the
+// top left of the source, which is exact from one pixel to the next
+struct fixed_row {
+    static constexpr double ONE = 4294967296.0;
+    static constexpr double LIMIT = 1073741824.0; // 2^30
+
+    int64_t x, y, dx, dy;
+    uint64_t width, height;
+    int32_t left, top;
+
+    // false if the row's source coordinates are too far out to fit
+    bool start(const quad_map &m, int32_t px, int32_t py, int32_t n,
+               const double *lo, const double *hi) {
+        double cx = px + 0.5, cy = py + 0.5;
+        double fx = m.sx[0] * cx + m.sx[1] * cy + m.sx[2] - lo[0];
+        double fy = m.sy[0] * cx + m.sy[1] * cy + m.sy[2] - lo[1];
+        double ex = fx + m.sx[0] * n, ey = fy + m.sy[0] * n;
+        if (!(std::max(std::fabs(fx), std::fabs(ex)) < LIMIT &&
+              std::max(std::fabs(fy), std::fabs(ey)) < LIMIT))
+            return false;
+
+        x = (int64_t)std::floor(fx * ONE);
+        y = (int64_t)std::floor(fy * ONE);
+        dx = (int64_t)std::floor(m.sx[0] * ONE);
+        dy = (int64_t)std::floor(m.sy[0] * ONE);
+        width = (uint64_t)((hi[0] - lo[0]) * ONE);
+        height = (uint64_t)((hi[1] - lo[1]) * ONE);
+        left = (int32_t)lo[0];
+        top = (int32_t)lo[1];
+        return true;
+    }
+
+    inline bool in(int32_t i) const {
+        return (uint64_t)(x + i * dx) < width &&
+               (uint64_t)(y + i * dy) < height;
+    }
+
+    inline void at(int32_t i, int32_t *col, int32_t *row) const {
+        *col = (int32_t)((x + i * dx) >> 32) + left;
+        *row = (int32_t)((y + i * dy) >> 32) + top;
+    }
+};
+
+// the rest divide at every pixel
+struct float_row {
+    double x, y, w, dx, dy, dw;
+    const double *lo, *hi;
+    int32_t max_col, max_row;
+
+    void start(const quad_map &m, int32_t px, int32_t py,
+               const double *lo_, const double *hi_) {
+        double cx = px + 0.5, cy = py + 0.5;
+        x = m.sx[0] * cx + m.sx[1] * cy + m.sx[2];
+        y = m.sy[0] * cx + m.sy[1] * cy + m.sy[2];
+        w = m.w[0] * cx + m.w[1] * cy + m.w[2];
+        dx = m.sx[0];
+        dy = m.sy[0];
+        dw = m.w[0];
+        lo = lo_;
+        hi = hi_;
+        max_col = (int32_t)hi[0] - 1;
+        max_row = (int32_t)hi[1] - 1;
+    }
+
+    inline bool in(int32_t i) const {
+        double ww = w + i * dw;
+        double fx = (x + i * dx) / ww, fy = (y + i * dy) / ww;
+
+        // nan fails these too
+        return ww > 0 && fx >= lo[0] && fx < hi[0] && fy >= lo[1] &&
+               fy < hi[1];
+    }
+
+    // clamped, in case rounding puts a pixel between two inside ones a
+    // hair outside
+    inline void at(int32_t i, int32_t *col, int32_t *row) const {
+        double inv = 1 / (w + i * dw);
+        double fx = std::min(std::max((x + i * dx) * inv, lo[0]), hi[0]);
+        double fy = std::min(std::max((y + i * dy) * inv, lo[1]), hi[1]);
+        *col = std::min((int32_t)fx, max_col);
+        *row = std::min((int32_t)fy, max_row);
+    }
+};
+
+// pixels [i0, i1) of a row, from pixels that are stride bytes to a row
+template <typename PIXEL, typename ROW>
+static void gather_quad(uint8_t *out, const uint8_t *pixels, size_t stride,
+                        const ROW &r, int32_t i0, int32_t i1) {
+    PIXEL *o = (PIXEL*)out;
+    for (int32_t i = i0; i < i1; ++i) {
+        int32_t col, row;
+        r.at(i, &col, &row);
+        *o++ = ((const PIXEL*)(pixels + (size_t)row * stride))[col];
+    }
+}
+
+// the quad covers a convex part of the destination, and what is inside
+// the source is convex too, so the pixels of a row to draw are one run
+// between the ones that fall outside at either end
+template <typename ROW>
+static void draw_quad_row(const ROW &r, int32_t n, uint8_t *out,
+                          const vm::image &dst, const vm::image &src,
+                          const blit_setup &b, uint8_t *src_tmp,
+                          uint8_t *mask_tmp) {
+    int32_t i0 = 0, i1 = n;
+    while (i0 < i1 && !r.in(i0)) ++i0;
+    while (i1 > i0 && !r.in(i1 - 1)) --i1;
+    if (i0 == i1) return;
+
+    size_t dst_bpp = dst.depth() / 8;
+    out += (size_t)i0 * dst_bpp;
+
+    uint8_t *tmp = b.plain ? out : src_tmp;
+    if (src.depth() == 32)
+        gather_quad<uint32_t>(tmp, b.pixels, b.stride, r, i0, i1);
+    else
+        gather_quad<uint8_t>(tmp, b.pixels, b.stride, r, i0, i1);
+
+    if (b.plain) return;
+
+    if (b.mask)
+        gather_quad<uint8_t>(mask_tmp, b.mask, b.mask_stride, r, i0, i1);
+
+    b.kernel(out, src_tmp, mask_tmp, (size_t)(i1 - i0), b.k);
+}
+
+// the columns of row y + 0.5 that the quad may cover, widened by a pixel on
+// each side. map_quad_row decides the exact ones.
+static bool quad_span(const double *q, int32_t y, int32_t *from,
+                      int32_t *to) {
+    double py = y + 0.5;
+    double lo = INFINITY, hi = -INFINITY;
+    for (int i = 0; i < 4; ++i) {
+        const double *a = q + i * 2;
+        const double *b = q + (i + 1) % 4 * 2;
+        if ((a[1] <= py) == (b[1] <= py)) continue;
+
+        double x = a[0] + (py - a[1]) * (b[0] - a[0]) / (b[1] - a[1]);
+        lo = std::min(lo, x);
+        hi = std::max(hi, x);
+    }
+
+    if (!(lo <= hi)) return false;
+    *from = (int32_t)std::max(std::floor(lo) - 1, (double)INT32_MIN);
+    *to = (int32_t)std::min(std::ceil(hi) + 1, (double)INT32_MAX);
+    return true;
+}
+
+bool vm::copy_pixels_quad(image &dst, const double *dst_quad,
+                          const image &src, const int32_t *src_rect,
+                          const blit_params &params) {
+    const double *q = dst_quad;
+
+    // a rect with whole corners samples the same as the rect blit, which
+    // is cheaper
+    bool whole = true;
+    for (int i = 0; i < 8; ++i)
+        whole = whole && q[i] == std::floor(q[i]) && std::fabs(q[i]) < 1e9;
+    if (whole && q[1] == q[3] && q[5] == q[7] && q[0] == q[6] &&
+        q[2] == q[4] && q[0] < q[2] && q[1] < q[7]) {
+        int32_t dst_rect[4] = {
+            (int32_t)q[0], (int32_t)q[1], (int32_t)q[2], (int32_t)q[5]
+        };
+        return copy_pixels(dst, dst_rect, src, src_rect, params);
+    }
+
+    blit_setup b;
+    if (!setup_blit(b, dst, src, params))
+        return false;
+
+    if (src_rect[2] <= src_rect[0] || src_rect[3] <= src_rect[1])
+        return true;
+
+    quad_map m;
+    if (!make_quad_map(m, q, src_rect))
+        return true;
+
+    // the part of dst under the quad
+    double top = q[1], bottom = q[1];
+    for (int i = 3; i < 8; i += 2) {
+        top = std::min(top, q[i]);
+        bottom = std::max(bottom, q[i]);
+    }
+    if (!(top < dst.height() && bottom > 0))
+        return true;
+
+    int32_t y0 = std::max((int32_t)std::floor(top), 0);
+    int32_t y1 = std::min((int32_t)std::ceil(bottom), dst.height());
+    int32_t x0 = dst.width(), x1 = 0;
+    for (int32_t y = y0; y < y1; ++y) {
+        int32_t from, to;
+        if (!quad_span(q, y, &from, &to)) continue;
+        x0 = std::min(x0, std::max(from, 0));
+        x1 = std::max(x1, std::min(to, dst.width()));
+    }
+    if (x0 >= x1) return true;
+
+    // the source coordinates that are inside both src_rect and src
+    double lo[2] = {
+        (double)std::max(src_rect[0], 0), (double)std::max(src_rect[1], 0)
+    };
+    double hi[2] = {
+        (double)std::min(src_rect[2], src.width()),
+        (double)std::min(src_rect[3], src.height())
+    };
+    if (lo[0] >= hi[0] || lo[1] >= hi[1])
+        return true;
+
+    int32_t dst_area[4] = { x0, y0, x1, y1 };
+    int32_t read_area[4] = {
+        (int32_t)lo[0], (int32_t)lo[1], (int32_t)hi[0], (int32_t)hi[1]
+    };
+    blit_stage staged;
+    staged.stage(b, dst, src, params, dst_area, read_area);
+
+    int32_t tiles_x = (x1 - x0 + TILE_W - 1) / TILE_W;
+    int32_t tiles_y = (y1 - y0 + TILE_H - 1) / TILE_H;
+    size_t dst_bpp = dst.depth() / 8;
+
+    auto draw_tile = [&](size_t t) {
+        int32_t tx0 = x0 + (int32_t)(t % tiles_x) * TILE_W;
+        int32_t ty0 = y0 + (int32_t)(t / tiles_x) * TILE_H;
+        int32_t tx1 = std::min(tx0 + TILE_W, x1);
+        int32_t ty1 = std::min(ty0 + TILE_H, y1);
+
+        alignas(16) uint8_t src_tmp[TILE_W * 4];
+        uint8_t mask_tmp[TILE_W];
+
+        for (int32_t y = ty0; y < ty1; ++y) {
+            int32_t from, to;
+            if (!quad_span(q, y, &from, &to)) continue;
+            from = std::max(from, tx0);
+            to = std::min(to, tx1);
+            if (from >= to) continue;
+
+            int32_t n = to - from;
+            uint8_t *out = dst.row(y) + (size_t)from * dst_bpp;
+
+            fixed_row fr;
+            if (!m.projective && fr.start(m, from, y, n, lo, hi)) {
+                draw_quad_row(fr, n, out, dst, src, b, src_tmp, mask_tmp);
+            } else {
+                float_row r;
+                r.start(m, from, y, lo, hi);
+                draw_quad_row(r, n, out, dst, src, b, src_tmp, mask_tmp);
+            }
+        }
+    };
+
+    size_t tiles = (size_t)tiles_x * tiles_y;
+    size_t threads = std::min(blit_threads.load(), tiles);
+    if (threads > 1 && (int64_t)(x1 - x0) * (y1 - y0) >= PARALLEL_BLIT_MIN) {
+        pool.run(tiles, threads, draw_tile);
+    } else {
+        for (size_t t = 0; t < tiles; ++t)
+            draw_tile(t);
+    }
+
+    dst.changed();
+    return true;
+}
@@ -0,0 +1,135 @@
+#include "vm.hpp"
+#include <charconv>
+#include <cmath>
+using namespace lingo;
+
+size_t vm::format_int(char *buf, int32_t v) {
+    return (size_t)(std::to_chars(buf, buf + 16, v).ptr - buf);
+}
+
+// the shortest form that reads back as the same float, with a point or an
+// exponent so that it doesn't read back as an integer
+size_t vm::format_float_shortest(char *buf, double v) {
+    char *end = std::to_chars(buf, buf + 31, v).ptr;
+
+    bool has_point = false;
+    for (char *p = buf; p < end; ++p) {
+        if (*p == '.' || *p == 'e' || *p == 'n' || *p == 'i') {
+            has_point = true;
+            break;
+        }
+    }
+
+    if (!has_point) {
+        *(end++) = '.';
+        *(end++) = '0';
+    }
+
+    return (size_t)(end - buf);
+}
+
+// floats are written in fixed notation with precision decimal places, as
+// Director does with the floatPrecision. a negative precision rounds to
+// that many places as well, and drops the trailing zeros. huge values are
+// written in exponent notation instead of hundreds of digits.
+size_t vm::format_float(char *buf, double v, int precision) {
+    bool trim = precision < 0;
+    if (trim)
+        precision = -precision;
+
+    if (precision > MAX_FLOAT_PRECISION)
+        precision = MAX_FLOAT_PRECISION;
+
+    bool fixed = std::fabs(v) < 1e15;
+    char *end = std::to_chars(buf, buf + 32, v,
+        fixed ? std::chars_format::fixed : std::chars_format::scientific,
+        precision).ptr;
+
+    if (trim && fixed && precision > 0) {
+        while (end[-1] == '0') --end;
+        if (end[-1] == '.') --end;
+    }
+
+    return (size_t)(end - buf);
+}
+
+static inline bool is_space(char ch) {
+    return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n';
+}
+
+bool vm::parse_number(const char *chars, size_t len, variant *out) {
+    const char *p = chars;
+    const char *end = chars + len;
+
+    while (p < end && is_space(*p)) ++p;
+    while (end > p && is_space(end[-1])) --end;
+
+    // from_chars does not accept a leading +
+    if (p < end && *p == '+') {
+        ++p;
+        if (p < end && (*p == '-' || *p == '+')) return false;
+    }
+
+    if (p == end) return false;
+
+    bool is_float = false;
+    for (const char *c = p; c < end; ++c) {
+        if (*c == '.' || *c == 'e' || *c == 'E') {
+            is_float = true;
+            break;
+        }
+    }
+
+    if (!is_float) {
+        int32_t iv;
+        auto res = std::from_chars(p, end, iv);
+        if (res.ec == std::errc() && res.ptr == end) {
+            out->type = bc::TYPE_INT;
+            out->i32 = iv;
+            return true;
+        }
+
+        // too large for an integer, read it as a float
+        if (res.ec != std::errc::result_out_of_range)
+            return false;
+    }
+
+    double fv;
+    auto res = std::from_chars(p, end, fv);
+    if (res.ec != std::errc() || res.ptr != end)
+        return false;
+
+    out->type = bc::TYPE_FLOAT;
+    out->f64 = fv;
+    return true;
+}
+
+bool vm::string::to_number(variant *out) const {
+    if (_num_kind == NUM_UNKNOWN) {
+        variant v;
+        if (!parse_number(data(), _length, &v)) {
+            _num_kind = NUM_NONE;
+        } else if (v.type == bc::TYPE_INT) {
+            _num_kind = NUM_INT;
+            _num = (double)v.i32;
+        } else {
+            _num_kind = NUM_FLOAT;
+            _num = v.f64;
+        }
+    }
+
+    switch (_num_kind) {
+        case NUM_INT:
+            out->type = bc::TYPE_INT;
+            out->i32 = (int32_t)_num;
+            return true;
+
+        case NUM_FLOAT:
+            out->type = bc::TYPE_FLOAT;
+            out->f64 = _num;
+            return true;
+
+        default:
+            return false;
+    }
+}
@@ -0,0 +1,178 @@
+#include "vm.hpp"
+using namespace lingo;
+
+// a list is written as [...] where it comes up again inside itself, and
+// lists nested deeper than this are too
+static constexpr int MAX_DEPTH = 256;
+
+vm::str_writer::~str_writer() {
+    if (_buf)
+        ::operator delete((void*)_buf);
+}
+
+void vm::str_writer::grow(size_t min_free) {
+    size_t used = _buf ? _buf->end : 0;
+    size_t capacity = _buf ? _buf->capacity * 2 : 256;
+    while (capacity - used < min_free)
+        capacity *= 2;
+
+    strbuf *buf = (strbuf*) ::operator new(sizeof(strbuf) + capacity);
+    buf->refs = 0;
+    buf->capacity = capacity;
+    buf->begin = 0;
+    buf->end = used;
+
+    if (_buf) {
+        memcpy(buf->data(), _buf->data(), used);
+        ::operator delete((void*)_buf);
+    }
+
+    _buf = buf;
+}
+
+vm::string* vm::str_writer::finish(gc_heap &heap) {
+    if (!_buf)
+        return string::alloc(heap, "", 0);
+
+    string *str = buffer_string::alloc(heap, _buf);
+    _buf = nullptr;
+    return str;
+}
+
+vm::string* vm::buffer_string::alloc(gc_heap &heap, strbuf *buf) {
+    string *str = new buffer_string(buf, buf->begin, buf->end - buf->begin);
+    heap.link(str, sizeof(buffer_string) + sizeof(strbuf) + buf->capacity);
+    return str;
+}
+
+void vm::runner::serialize(str_writer &w, const variant *v, bool quote,
+                           const writing *outer) {
+    int depth = outer ? outer->depth : 0;
+
+    switch (v->type) {
+        case bc::TYPE_VOID:
+            w.write("<Void>", 6);
+            break;
+
+        case bc::TYPE_INT:
+            w.commit(format_int(w.reserve(16), v->i32));
+            break;
+
+        case bc::TYPE_FLOAT:
+            w.commit(format_float(w.reserve(32), v->f64, _float_precision));
+            break;
+
+        case bc::TYPE_STRING: {
+            const string *str = static_cast<string*>(v->ref);
+            if (quote) w.put('"');
+            w.write(str->data(), str->length());
+            if (quote) w.put('"');
+            break;
+        }
+
+        case bc::TYPE_SYMBOL: {
+            const string *str = static_cast<string*>(v->ref);
+            w.put('#');
+            w.write(str->data(), str->length());
+            break;
+        }
+
+        case bc::TYPE_LLIST: {
+            const llist *list = static_cast<llist*>(v->ref);
+            if (depth >= MAX_DEPTH || (outer && outer->has(list))) {
+                w.write("[...]", 5);
+                break;
+            }
+
+            writing inner { list, outer, depth + 1 };
+
+            w.put('[');
+            for (size_t i = 0; i < list->count(); ++i) {
+                if (i > 0) w.write(", ", 2);
+                variant item = list->get(i);
+                serialize(w, &item, true, &inner);
+            }
+            w.put(']');
+            break;
+        }
+
+        case bc::TYPE_PLIST: {
+            const plist *list = static_cast<plist*>(v->ref);
+            if (depth >= MAX_DEPTH || (outer && outer->has(list))) {
+                w.write("[...]", 5);
+                break;
+            }
+
+            writing inner { list, outer, depth + 1 };
+
+            if (list->count() == 0) {
+                w.write("[:]", 3);
+                break;
+            }
+
+            w.put('[');
+            for (size_t i = 0; i < list->count(); ++i) {
+                const plist_entry &e = list->entries()[i];
+                if (i > 0) w.write(", ", 2);
+                serialize(w, &e.key, true, &inner);
+                w.write(": ", 2);
+                serialize(w, &e.value, true, &inner);
+            }
+            w.put(']');
+            break;
+        }
+
+        case bc::TYPE_QUAD:
+            // as a list of its corners
+            w.put('[');
+            for (size_t i = 0; i < 8; i += 2) {
+                variant h = geom::component(*v, i);
+                variant v2 = geom::component(*v, i + 1);
+
+                if (i > 0) w.write(", ", 2);
+                w.write("point(", 6);
+                serialize(w, &h, true, outer);
+                w.write(", ", 2);
+                serialize(w, &v2, true, outer);
+                w.put(')');
+            }
+            w.put(']');
+            break;
+
+        case bc::TYPE_POINT:
+        case bc::TYPE_RECT:
+        case bc::TYPE_COLOR: {
+            size_t count = geom::component_count(v->type);
+
+            switch (v->type) {
+                case bc::TYPE_POINT: w.write("point(", 6); break;
+                case bc::TYPE_RECT: w.write("rect(", 5); break;
+                default: w.write("color( ", 7); break;
+            }
+
+            for (size_t i = 0; i < count; ++i) {
+                if (i > 0) w.write(", ", 2);
+                variant c = geom::component(*v, i);
+                serialize(w, &c, true, outer);
+            }
+
+            if (v->type == bc::TYPE_COLOR) w.put(' ');
+            w.put(')');
+            break;
+        }
+
+        case bc::TYPE_IMAGE: {
+            char buf[64];
+            int len = snprintf(buf, sizeof(buf), "<Image:%p>", (void*)v->ref);
+            w.write(buf, (size_t)len);
+            break;
+        }
+
+        default: {
+            char buf[64];
+            int len = snprintf(buf, sizeof(buf), "<%p>", (void*)v->ref);
+            w.write(buf, (size_t)len);
+            break;
+        }
+    }
+}
@@ -0,0 +1,257 @@
+#include "vm.hpp"
+#include <algorithm>
+#include <memory>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define LINGO_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace lingo;
+
+// packed lists are sorted with a bottom-up merge sort. the first pass sorts
+// runs of 4 items, 16 items at a time: the 16 items are loaded as 4 rows of
+// 4, each column is sorted with a 5-comparator network of vector min/max,
+// and the rows are transposed so each holds one sorted column. the merge
+// passes after that are branchless.
+
+#ifdef LINGO_SSE2
+// sse2 has no 32-bit min/max, so they are made from a compare and a blend
+static inline void minmax(__m128i &a, __m128i &b) {
+    __m128i gt = _mm_cmpgt_epi32(a, b);
+    __m128i lo = _mm_or_si128(_mm_and_si128(gt, b), _mm_andnot_si128(gt, a));
+    __m128i hi = _mm_or_si128(_mm_and_si128(gt, a), _mm_andnot_si128(gt, b));
+    a = lo;
+    b = hi;
+}
+
+static void sort_runs16(int32_t *items) {
+    __m128i r[4];
+    for (int i = 0; i < 4; ++i)
+        r[i] = _mm_loadu_si128((const __m128i*)(items + i * 4));
+
+    minmax(r[0], r[1]);
+    minmax(r[2], r[3]);
+    minmax(r[0], r[2]);
+    minmax(r[1], r[3]);
+    minmax(r[1], r[2]);
+
+    __m128i t0 = _mm_unpacklo_epi32(r[0], r[1]);
+    __m128i t1 = _mm_unpacklo_epi32(r[2], r[3]);
+    __m128i t2 = _mm_unpackhi_epi32(r[0], r[1]);
+    __m128i t3 = _mm_unpackhi_epi32(r[2], r[3]);
+
+    _mm_storeu_si128((__m128i*)(items + 0), _mm_unpacklo_epi64(t0, t1));
+    _mm_storeu_si128((__m128i*)(items + 4), _mm_unpackhi_epi64(t0, t1));
+    _mm_storeu_si128((__m128i*)(items + 8), _mm_unpacklo_epi64(t2, t3));
+    _mm_storeu_si128((__m128i*)(items + 12), _mm_unpackhi_epi64(t2, t3));
+}
+
+// a row of 4 doubles is two registers
+struct row_f64 {
+    __m128d lo, hi;
+};
+
+// _mm_min_pd and _mm_max_pd return the second operand from both when the
+// two don't compare, as with a NaN or 0.0 and -0.0, losing the first. so
+// these are made from a compare and a blend as well, which keeps both and
+// orders them by the same < as the merges.
+static inline __m128d blend(__m128d mask, __m128d a, __m128d b) {
+    return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b));
+}
+
+static inline void minmax(row_f64 &a, row_f64 &b) {
+    __m128d gt_lo = _mm_cmpgt_pd(a.lo, b.lo);
+    __m128d gt_hi = _mm_cmpgt_pd(a.hi, b.hi);
+    row_f64 lo = { blend(gt_lo, b.lo, a.lo), blend(gt_hi, b.hi, a.hi) };
+    row_f64 hi = { blend(gt_lo, a.lo, b.lo), blend(gt_hi, a.hi, b.hi) };
+    a = lo;
+    b = hi;
+}
+
+static void sort_runs16(double *items) {
+    row_f64 r[4];
+    for (int i = 0; i < 4; ++i) {
+        r[i].lo = _mm_loadu_pd(items + i * 4);
+        r[i].hi = _mm_loadu_pd(items + i * 4 + 2);
+    }
+
+    minmax(r[0], r[1]);
+    minmax(r[2], r[3]);
+    minmax(r[0], r[2]);
+    minmax(r[1], r[3]);
+    minmax(r[1], r[2]);
+
+    _mm_storeu_pd(items + 0, _mm_unpacklo_pd(r[0].lo, r[1].lo));
+    _mm_storeu_pd(items + 2, _mm_unpacklo_pd(r[2].lo, r[3].lo));
+    _mm_storeu_pd(items + 4, _mm_unpackhi_pd(r[0].lo, r[1].lo));
+    _mm_storeu_pd(items + 6, _mm_unpackhi_pd(r[2].lo, r[3].lo));
+    _mm_storeu_pd(items + 8, _mm_unpacklo_pd(r[0].hi, r[1].hi));
+    _mm_storeu_pd(items + 10, _mm_unpacklo_pd(r[2].hi, r[3].hi));
+    _mm_storeu_pd(items + 12, _mm_unpackhi_pd(r[0].hi, r[1].hi));
+    _mm_storeu_pd(items + 14, _mm_unpackhi_pd(r[2].hi, r[3].hi));
+}
+#endif
+
+template <typename T>
+static void insertion_sort(T *items, size_t n) {
+    for (size_t i = 1; i < n; ++i) {
+        T v = items[i];
+        size_t j = i;
+        for (; j > 0 && v < items[j - 1]; --j)
+            items[j] = items[j - 1];
+        items[j] = v;
+    }
+}
+
+template <typename T>
+static void merge(const T *a, const T *a_end, const T *b, const T *b_end,
+                  T *out) {
+    while (a < a_end && b < b_end) {
+        bool take_b = *b < *a;
+        *out++ = take_b ? *b : *a;
+        a += !take_b;
+        b += take_b;
+    }
+
+    while (a < a_end) *out++ = *a++;
+    while (b < b_end) *out++ = *b++;
+}
+
+template <typename T>
+static void merge_sort(T *items, size_t n) {
+    constexpr size_t RUN = 4;
+
+    if (n <= 16) {
+        insertion_sort(items, n);
+        return;
+    }
+
+    size_t i = 0;
+#ifdef LINGO_SSE2
+    for (; i + 16 <= n; i += 16)
+        sort_runs16(items + i);
+#endif
+    for (; i < n; i += RUN)
+        insertion_sort(items + i, std::min(RUN, n - i));
+
+    std::unique_ptr<T[]> tmp(new T[n]);
+    T *src = items;
+    T *dst = tmp.get();
+
+    for (size_t width = RUN; width < n; width *= 2) {
+        for (size_t start = 0; start < n; start += width * 2) {
+            size_t mid = std::min(start + width, n);
+            size_t end = std::min(start + width * 2, n);
+            merge(src + start, src + mid, src + mid, src + end, dst + start);
+        }
+
+        std::swap(src, dst);
+    }
+
+    if (src != items)
+        std::copy(src, src + n, items);
+}
+
+void vm::sort_ints(int32_t *items, size_t n) {
+    merge_sort(items, n);
+}
+
+void vm::sort_floats(double *items, size_t n) {
+    merge_sort(items, n);
+}
+
+// values the comparison operators can't order are ordered by type
+int vm::runner::sort_order(const variant &a, const variant &b) {
+    int order;
+    if (compare(&a, &b, &order))
+        return order;
+
+    return (int)a.type - (int)b.type;
+}
+
+void vm::runner::sort_list(llist *list) {
+    list->unshare(_heap);
+
+    switch (list->store()) {
+        case llist::STORE_INT:
+            sort_ints(list->ints(), list->count());
+            break;
+
+        case llist::STORE_FLOAT:
+            sort_floats(list->floats(), list->count());
+            break;
+
+        case llist::STORE_VARIANT:
+            std::stable_sort(list->variants(), list->variants() + list->count(),
+                [this](const variant &a, const variant &b) {
+                    return sort_order(a, b) < 0;
+                });
+            break;
+    }
+
+    list->mark_sorted();
+}
+
+void vm::runner::sort_list(plist *list) {
+    list->unshare(_heap);
+    std::stable_sort(list->entries(), list->entries() + list->count(),
+        [this](const plist_entry &a, const plist_entry &b) {
+            return sort_order(a.key, b.key) < 0;
+        });
+
+    list->reindex(_heap);
+    list->mark_sorted();
+}
+
+// binary search a sorted list for the first item that does not come before
+// v, or with after set, the first that comes after v
+size_t vm::runner::sorted_bound(const llist *list, const variant &v,
+                                bool after) {
+    size_t n = list->count();
+
+    if (list->store() == llist::STORE_INT && v.type == bc::TYPE_INT) {
+        const int32_t *items = list->ints();
+        return (after
+            ? std::upper_bound(items, items + n, v.i32)
+            : std::lower_bound(items, items + n, v.i32)) - items;
+    }
+
+    if (list->store() == llist::STORE_FLOAT && v.type == bc::TYPE_FLOAT) {
+        const double *items = list->floats();
+        return (after
+            ? std::upper_bound(items, items + n, v.f64)
+            : std::lower_bound(items, items + n, v.f64)) - items;
+    }
+
+    size_t lo = 0;
+    size_t hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int order = sort_order(list->get(mid), v);
+        if (order < 0 || (after && order == 0))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+// the bound is a slot of the list, as insert takes. removed slots keep
+// their keys, so they are still in order.
+size_t vm::runner::sorted_bound(const plist *list, const variant &key,
+                                bool after) {
+    size_t lo = 0;
+    size_t hi = list->slot_count();
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int order = sort_order(list->slots()[mid].key, key);
+        if (order < 0 || (after && order == 0))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
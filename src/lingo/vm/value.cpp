@@ -0,0 +1,291 @@
+#include "vm.hpp"
+using namespace lingo;
+
+// parses serialized lingo values (as written by string()) straight into
+// heap objects, without going through the compiler. this is what value()
+// uses, since project and level files are multi-megabyte list literals.
+//
+// nested lists are kept on an explicit stack instead of being parsed
+// recursively, so deeply nested input can't overflow the native stack.
+class lingo::vm::value_parser {
+private:
+    runner &_vm;
+    string *_src;
+    const char *_chars;
+    size_t _length;
+    size_t _pos;
+
+    enum frame_kind : uint8_t {
+        FRAME_UNKNOWN, // first element not yet read
+        FRAME_LLIST,
+        FRAME_PLIST
+    };
+
+    struct frame {
+        frame_kind kind;
+        gc_object *list; // nullptr while the kind is unknown
+        variant key;
+        bool have_key; // property list key read, value not yet read
+    };
+
+    std::vector<frame> _stack;
+
+    inline void skip_space() {
+        while (_pos < _length) {
+            char ch = _chars[_pos];
+            if (ch != ' ' && ch != '\t' && ch != '\r' && ch != '\n')
+                break;
+            ++_pos;
+        }
+    }
+
+    // skip whitespace, and return the next character or 0 at the end
+    inline char peek() {
+        skip_space();
+        return _pos < _length ? _chars[_pos] : '\0';
+    }
+
+    inline bool accept(char ch) {
+        if (peek() != ch) return false;
+        ++_pos;
+        return true;
+    }
+
+    static inline bool is_word_char(char ch) {
+        return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+               (ch >= '0' && ch <= '9') || ch == '_';
+    }
+
+    static inline bool is_digit(char ch) {
+        return ch >= '0' && ch <= '9';
+    }
+
+    bool parse_number(variant *out) {
+        size_t start = _pos;
+
+        if (_chars[_pos] == '-' || _chars[_pos] == '+') ++_pos;
+        while (_pos < _length && is_digit(_chars[_pos])) ++_pos;
+
+        if (_pos < _length && _chars[_pos] == '.') {
+            ++_pos;
+            while (_pos < _length && is_digit(_chars[_pos])) ++_pos;
+        }
+
+        if (_pos < _length && (_chars[_pos] == 'e' || _chars[_pos] == 'E')) {
+            ++_pos;
+            if (_pos < _length && (_chars[_pos] == '-' || _chars[_pos] == '+'))
+                ++_pos;
+            while (_pos < _length && is_digit(_chars[_pos])) ++_pos;
+        }
+
+        return vm::parse_number(_chars + start, _pos - start, out);
+    }
+
+    // point(h, v), rect(l, t, r, b) and color(r, g, b)
+    bool parse_geom(bc::vtype type, variant *out) {
+        if (!accept('(')) return false;
+
+        variant args[4];
+        uint8_t nargs = 0;
+
+        while (peek() != ')') {
+            if (nargs > 0 && !accept(',')) return false;
+            if (nargs == 4) return false;
+
+            peek();
+            if (_pos == _length || !parse_number(&args[nargs]))
+                return false;
+
+            ++nargs;
+        }
+        ++_pos;
+
+        // the arguments are all numbers, so the count is all there is to
+        // check. bi_point and the rest would report it as an error.
+        if (nargs != geom::component_count(type))
+            return false;
+
+        *out = geom::make(_vm._heap, type, args);
+        return true;
+    }
+
+    // read a value that is not a list. in_list is true if it may be the
+    // key of a property list, in which case a bare word is a symbol.
+    bool parse_scalar(variant *out, bool in_list) {
+        char ch = _chars[_pos];
+
+        if (ch == '"') {
+            size_t start = ++_pos;
+            while (_pos < _length && _chars[_pos] != '"') ++_pos;
+            if (_pos == _length) return false;
+
+            out->type = bc::TYPE_STRING;
+            out->ref = _vm.substring(_src, start, _pos - start);
+            ++_pos;
+            return true;
+        }
+
+        if (ch == '#') {
+            size_t start = ++_pos;
+            while (_pos < _length && is_word_char(_chars[_pos])) ++_pos;
+            if (_pos == start) return false;
+
+            out->type = bc::TYPE_SYMBOL;
+            out->ref = intern_word(start, _pos - start);
+            return true;
+        }
+
+        if (is_digit(ch) || ch == '-' || ch == '+' || ch == '.')
+            return parse_number(out);
+
+        // void, as written by string()
+        if (ch == '<') {
+            static const char void_str[] = "<void>";
+            if (_length - _pos < 6) return false;
+            for (size_t i = 0; i < 6; ++i) {
+                if (tolower((unsigned char)_chars[_pos + i]) != void_str[i])
+                    return false;
+            }
+
+            _pos += 6;
+            out->type = bc::TYPE_VOID;
+            return true;
+        }
+
+        if (!is_word_char(ch))
+            return false;
+
+        size_t start = _pos;
+        while (_pos < _length && is_word_char(_chars[_pos])) ++_pos;
+
+        char word[8];
+        size_t len = _pos - start;
+        if (len < sizeof(word)) {
+            for (size_t i = 0; i < len; ++i)
+                word[i] = (char)tolower((unsigned char)_chars[start + i]);
+            word[len] = '\0';
+
+            if (!strcmp(word, "point")) return parse_geom(bc::TYPE_POINT, out);
+            if (!strcmp(word, "rect")) return parse_geom(bc::TYPE_RECT, out);
+            if (!strcmp(word, "color") || !strcmp(word, "rgb"))
+                return parse_geom(bc::TYPE_COLOR, out);
+
+            if (!strcmp(word, "void")) {
+                out->type = bc::TYPE_VOID;
+                return true;
+            }
+
+            if (!strcmp(word, "true") || !strcmp(word, "false")) {
+                out->type = bc::TYPE_INT;
+                out->i32 = word[0] == 't';
+                return true;
+            }
+        }
+
+        // [key: value]
+        if (in_list && peek() == ':') {
+            out->type = bc::TYPE_SYMBOL;
+            out->ref = intern_word(start, len);
+            return true;
+        }
+
+        return false;
+    }
+
+    string* intern_word(size_t start, size_t len) {
+        char buf[64];
+        if (len > sizeof(buf)) {
+            std::string word(_chars + start, len);
+            for (char &ch : word) ch = (char)tolower((unsigned char)ch);
+            return _vm.intern_symbol(word.data(), len);
+        }
+
+        for (size_t i = 0; i < len; ++i)
+            buf[i] = (char)tolower((unsigned char)_chars[start + i]);
+        return _vm.intern_symbol(buf, len);
+    }
+
+public:
+    value_parser(runner &vm, string *src)
+        : _vm(vm), _src(src), _chars(src->data()), _length(src->length()),
+          _pos(0) { }
+
+    bool parse(variant *out) {
+        variant v;
+
+        while (true) {
+            // read the next value
+            if (peek() == '\0') return false;
+
+            if (_chars[_pos] == '[') {
+                ++_pos;
+
+                // empty lists
+                if (accept(']')) {
+                    v.type = bc::TYPE_LLIST;
+                    v.ref = llist::alloc(_vm._heap);
+                } else if (accept(':')) {
+                    if (!accept(']')) return false;
+                    v.type = bc::TYPE_PLIST;
+                    v.ref = plist::alloc(_vm._heap);
+                } else {
+                    _stack.push_back(frame { FRAME_UNKNOWN, nullptr, {}, false });
+                    continue;
+                }
+            } else if (!parse_scalar(&v, !_stack.empty())) {
+                return false;
+            }
+
+            // put the value into the list it is in, and close every list
+            // that ends after it
+            while (true) {
+                if (_stack.empty()) {
+                    *out = v;
+                    return peek() == '\0';
+                }
+
+                frame &top = _stack.back();
+
+                if (top.kind == FRAME_UNKNOWN) {
+                    if (accept(':')) {
+                        top.kind = FRAME_PLIST;
+                        top.list = plist::alloc(_vm._heap);
+                        top.key = v;
+                        top.have_key = true;
+                        break;
+                    }
+
+                    top.kind = FRAME_LLIST;
+                    top.list = llist::alloc(_vm._heap);
+                    static_cast<llist*>(top.list)->add(_vm._heap, v);
+                } else if (top.kind == FRAME_LLIST) {
+                    static_cast<llist*>(top.list)->add(_vm._heap, v);
+                } else if (!top.have_key) {
+                    if (!accept(':')) return false;
+                    top.key = v;
+                    top.have_key = true;
+                    break;
+                } else {
+                    static_cast<plist*>(top.list)->add(_vm._heap, top.key, v);
+                    top.have_key = false;
+                }
+
+                if (accept(',')) break;
+                if (!accept(']')) return false;
+
+                v.type = top.kind == FRAME_LLIST ? bc::TYPE_LLIST : bc::TYPE_PLIST;
+                v.ref = top.list;
+                _stack.pop_back();
+            }
+        }
+    }
+};
+
+bool vm::runner::parse_value(string *src, variant *out) {
+    value_parser parser(*this, src);
+    return parser.parse(out);
+}
+
+bool vm::runner::parse_value(const char *chars, size_t len, variant *out) {
+    return parse_value(make_string(chars, len), out);
+}
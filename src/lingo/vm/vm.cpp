@@ -1,57 +1,321 @@
 #include "vm.hpp"
 #include <iostream>
+#include <memory>
 using namespace lingo;
 
 vm::runner::runner() {
     _stack_top = _stack;
     _cstack_top = nullptr;
+
+    _empty_string = string::alloc(_heap, "", 0);
+    for (int i = 0; i < 256; ++i) {
+        char ch = (char)i;
+        _char_strings[i] = string::alloc(_heap, &ch, 1);
+    }
+
+    _sym_chunks[CHUNK_CHAR] = intern_symbol("char", 4);
+    _sym_chunks[CHUNK_WORD] = intern_symbol("word", 4);
+    _sym_chunks[CHUNK_ITEM] = intern_symbol("item", 4);
+    _sym_chunks[CHUNK_LINE] = intern_symbol("line", 4);
+    _sym_integer = intern_symbol("integer", 7);
+    _sym_count = intern_symbol("count", 5);
+    _item_delimiter = ',';
+    _float_precision = 4;
+
+    register_builtins();
 }
 
-vm::runner::~runner() {}
+// every object is freed by the heap
+vm::runner::~runner() { }
+
+void vm::runner::collect() {
+    for (variant *v = _stack; v < _stack_top; ++v)
+        _heap.mark(*v);
+
+    // symbols are never freed, since they are compared by address
+    for (auto &pair : _symbol_intern)
+        _heap.mark(pair.second);
+
+    _heap.mark(_empty_string);
+    for (int i = 0; i < 256; ++i)
+        _heap.mark(_char_strings[i]);
+
+    _heap.collect();
+}
+
+vm::string* vm::runner::make_string(const char *str, size_t len) {
+    if (len == 0) return _empty_string;
+    if (len == 1) return _char_strings[(uint8_t)str[0]];
+    return string::alloc(_heap, str, len);
+}
+
+vm::string* vm::runner::intern_symbol(const char *str, size_t len) {
+    auto it = _symbol_intern.find(std::string_view(str, len));
+    if (it != _symbol_intern.end())
+        return it->second;
+
+    // the key views the characters of the interned string itself, which
+    // never move.
+    string *sym = string::alloc(_heap, str, len);
+    _symbol_intern.emplace(std::string_view(sym->data(), len), sym);
+    return sym;
+}
 
 vm::string* vm::runner::stringify(const variant *variant) {
-    switch (variant->type) {
+    if (variant->type == bc::TYPE_STRING)
+        return static_cast<vm::string*>(variant->ref);
+
+    str_writer w;
+    serialize(w, variant, false);
+
+    if (w.length() <= 1)
+        return make_string(w.data(), w.length());
+
+    return w.finish(_heap);
+}
+
+static inline bool is_number(const vm::variant &v) {
+    return v.type == bc::TYPE_INT || v.type == bc::TYPE_FLOAT;
+}
+
+static inline bool is_text(const vm::variant &v) {
+    return v.type == bc::TYPE_STRING || v.type == bc::TYPE_SYMBOL;
+}
+
+// numbers compare by value, and strings and symbols by their characters,
+// ignoring case. a string compared with a number is read as a number if it
+// is one, and otherwise the number is compared as a string.
+bool vm::runner::compare(const variant *a, const variant *b, int *out) {
+    variant va = *a;
+    variant vb = *b;
+
+    if (is_number(va) && vb.type == bc::TYPE_STRING)
+        static_cast<string*>(vb.ref)->to_number(&vb);
+    else if (is_number(vb) && va.type == bc::TYPE_STRING)
+        static_cast<string*>(va.ref)->to_number(&va);
+
+    if (is_number(va) && is_number(vb)) {
+        if (va.type == bc::TYPE_INT && vb.type == bc::TYPE_INT) {
+            *out = (va.i32 > vb.i32) - (va.i32 < vb.i32);
+        } else {
+            double x = va.type == bc::TYPE_INT ? (double)va.i32 : va.f64;
+            double y = vb.type == bc::TYPE_INT ? (double)vb.i32 : vb.f64;
+            *out = (x > y) - (x < y);
+        }
+
+        return true;
+    }
+
+    if ((is_text(va) || is_number(va)) && (is_text(vb) || is_number(vb))) {
+        const string *str_a = is_text(va)
+            ? static_cast<string*>(va.ref)
+            : stringify(&va);
+        const string *str_b = is_text(vb)
+            ? static_cast<string*>(vb.ref)
+            : stringify(&vb);
+
+        *out = str_a->compare(*str_b);
+        return true;
+    }
+
+    return false;
+}
+
+void vm::runner::to_piece(const variant *v, str_piece &p) {
+    switch (v->type) {
         case bc::TYPE_VOID:
-            return new vm::string("<Void>");
-        
+            p.chars = "";
+            p.length = 0;
+            break;
+
         case bc::TYPE_INT:
-            return new vm::string(std::to_string(variant->i32));
+            p.length = format_int(p.buf, v->i32);
+            p.chars = p.buf;
+            break;
 
         case bc::TYPE_FLOAT:
-            return new vm::string(std::to_string(variant->f64));
+            p.length = format_float(p.buf, v->f64, _float_precision);
+            p.chars = p.buf;
+            break;
 
         case bc::TYPE_STRING:
-            return static_cast<vm::string*>(variant->ref);
-
         case bc::TYPE_SYMBOL: {
-            vm::string *src = static_cast<vm::string*>(variant->ref);
-            vm::string *out = new vm::string(src->length() + 1);
-            out->data()[0] = '#';
-            memcpy(out->data() + 1, src->data(), src->length());
-            return out;
+            const vm::string *str = static_cast<vm::string*>(v->ref);
+            p.chars = str->data();
+            p.length = str->length();
+            break;
+        }
+
+        default: {
+            const vm::string *str = stringify(v);
+            p.chars = str->data();
+            p.length = str->length();
+            break;
+        }
+    }
+}
+
+// concatenate the string forms of the given values into a new string. the
+// size of the result is computed beforehand so that it is only allocated
+// once. if the first value is already a long string, the rest is appended
+// as a rope node instead of copying it.
+vm::string* vm::runner::concat(const variant *values, size_t count) {
+    str_piece local_pieces[16];
+    std::unique_ptr<str_piece[]> heap_pieces;
+    str_piece *pieces = local_pieces;
+    if (count > 16) {
+        heap_pieces = std::make_unique<str_piece[]>(count);
+        pieces = heap_pieces.get();
+    }
+
+    size_t total_length = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        const variant *v = values + i;
+        str_piece &p = pieces[i];
+
+        // a long leading string is not read here, since it may end up as
+        // the left side of a rope
+        if (i == 0 && v->type == bc::TYPE_STRING &&
+            static_cast<vm::string*>(v->ref)->length() >= rope::MIN_LENGTH)
+        {
+            p.chars = nullptr;
+            p.length = static_cast<vm::string*>(v->ref)->length();
+        } else {
+            to_piece(v, p);
+        }
+
+        total_length += p.length;
+    }
+
+    if (count > 0 && pieces[0].chars == nullptr) {
+        vm::string *left = static_cast<vm::string*>(values[0].ref);
+        size_t rest_length = total_length - left->length();
+
+        if (rest_length == 0)
+            return left;
+
+        if (count == 2 && values[1].type == bc::TYPE_STRING)
+            return rope::alloc(_heap, left, static_cast<vm::string*>(values[1].ref));
+
+        vm::string *right = vm::string::alloc(_heap, rest_length);
+        char *dst = right->data();
+        for (size_t i = 1; i < count; ++i) {
+            memcpy(dst, pieces[i].chars, pieces[i].length);
+            dst += pieces[i].length;
         }
 
-        case bc::TYPE_LLIST:
-        case bc::TYPE_PLIST:
-        case bc::TYPE_POINT:
-        case bc::TYPE_QUAD: {
-            char buf[64];
-            snprintf(buf, 64, "<%p>", (void*)variant->ref);
-            return new vm::string(buf);
+        return rope::alloc(_heap, left, right);
+    }
+
+    if (total_length <= 1) {
+        for (size_t i = 0; i < count; ++i) {
+            if (pieces[i].length > 0)
+                return make_string(pieces[i].chars, 1);
         }
 
-        default:
-            assert(false);
-            return nullptr;
+        return _empty_string;
+    }
+
+    vm::string *out = vm::string::alloc(_heap, total_length);
+    char *dst = out->data();
+    for (size_t i = 0; i < count; ++i) {
+        memcpy(dst, pieces[i].chars, pieces[i].length);
+        dst += pieces[i].length;
     }
+
+    return out;
+}
+
+vm::string* vm::runner::substring(string *src, size_t offset, size_t len) {
+    if (len <= 1)
+        return make_string(src->data() + offset, len);
+
+    return string::substr(_heap, src, offset, len);
+}
+
+bool vm::runner::chunk_key(const variant *key, chunk_type *type) {
+    if (key->type != bc::TYPE_SYMBOL) {
+        std::cerr << "error: expected symbol key";
+        return false;
+    }
+
+    for (int i = 0; i < 4; ++i) {
+        if (key->ref == _sym_chunks[i]) {
+            *type = (chunk_type)i;
+            return true;
+        }
+    }
+
+    std::cerr << "error: unknown property #"
+              << static_cast<string*>(key->ref)->to_cpp_string();
+    return false;
+}
+
+// the string to take chunks from. strings are used directly, so that the
+// chunk table built on them is kept for later chunk expressions.
+vm::string* vm::runner::chunk_source(const variant *obj) {
+    if (obj->type == bc::TYPE_STRING)
+        return static_cast<string*>(obj->ref);
+
+    str_piece p;
+    to_piece(obj, p);
+    return make_string(p.chars, p.length);
+}
+
+// o.char[a], o.word[a..b], etc. of a string. the result views the characters
+// of the string instead of copying them. chunks out of range are empty.
+bool vm::runner::chunk_index(variant *obj, const variant *key,
+                             const variant *from, const variant *to) {
+    chunk_type type;
+    if (!chunk_key(key, &type))
+        return false;
+
+    if (from->type != bc::TYPE_INT || (to && to->type != bc::TYPE_INT)) {
+        std::cerr << "error: expected integer";
+        return false;
+    }
+
+    string *src = chunk_source(obj);
+
+    size_t start, end;
+    string *result = _empty_string;
+    if (find_chunk(_heap, src, type, _item_delimiter, from->i32,
+                   to ? to->i32 : from->i32, &start, &end))
+    {
+        result = substring(src, start, end - start);
+    }
+
+    obj->type = bc::TYPE_STRING;
+    obj->ref = result;
+    return true;
+}
+
+// o.line.count, etc.
+bool vm::runner::chunk_count(variant *obj, const variant *key) {
+    chunk_type type;
+    if (!chunk_key(key, &type))
+        return false;
+
+    size_t count = count_chunks(_heap, chunk_source(obj), type,
+                                _item_delimiter);
+
+    obj->type = bc::TYPE_INT;
+    obj->i32 = (int32_t)count;
+    return true;
 }
 
-// TODO: memory allocation creates memory leak, since I have not yet implemented
-// a garbage collector.
 bool vm::runner::run(const bc::chunk_header *start_chunk) {
     _cstack_top = _cstack;
     _cstack_top->chunk = start_chunk;
     _cstack_top->ip = bc::base_offset(start_chunk, start_chunk->instrs);
+    _cstack_top->stack_base = _stack_top;
+
+    // reserve the argument and local slots of the frame
+    for (int i = 0; i < start_chunk->nargs + start_chunk->nlocals; ++i) {
+        _stack_top->type = bc::TYPE_VOID;
+        ++_stack_top;
+    }
 
     uint16_t u16_a, u16_b;
     int16_t i16_a, i16_b;
@@ -67,6 +331,10 @@ bool vm::runner::run(const bc::chunk_header *start_chunk) {
     const bc::instr *ip = _cstack_top->ip;
 
     while (_cstack_top) {
+        // every value is on the stack in between instructions
+        if (_heap.should_collect())
+            collect();
+
         bc::instr istr = *(ip++);
         switch (istr & 0xFF) {
             case bc::OP_RET:
@@ -130,7 +398,7 @@ bool vm::runner::run(const bc::chunk_header *start_chunk) {
                         const bc::chunk_const_str *str =
                             bc::base_offset(string_pool, const_pool[u16_a].str);
                         _stack_top->type = bc::TYPE_STRING;
-                        _stack_top->ref = new string(&str->first, str->size);
+                        _stack_top->ref = make_string(&str->first, str->size);
                         ++_stack_top;
                         break;
                     }
@@ -139,19 +407,8 @@ bool vm::runner::run(const bc::chunk_header *start_chunk) {
                         const bc::chunk_const_str *cstr =
                             bc::base_offset(string_pool, const_pool[u16_a].str);
 
-                        string temp_str(&cstr->first, cstr->size);
-                        string *gc_str;
-
-                        auto it = _symbol_intern.find(temp_str);
-                        if (it == _symbol_intern.end()) {
-                            gc_str = new string(temp_str);
-                            _symbol_intern.emplace(std::move(temp_str), gc_str);
-                        } else {
-                            gc_str = it->second;
-                        }
-
                         _stack_top->type = bc::TYPE_SYMBOL;
-                        _stack_top->ref = gc_str;
+                        _stack_top->ref = intern_symbol(&cstr->first, cstr->size);
                         ++_stack_top;
                         break;
                     }
@@ -198,8 +455,8 @@ bool vm::runner::run(const bc::chunk_header *start_chunk) {
                         break;
 
                     default:
-                        std::cerr << "unm invalid operand";
-                        return 1;
+                        if (!negate(v)) return 1;
+                        break;
                 }
                 break;
             }
@@ -209,27 +466,24 @@ bool vm::runner::run(const bc::chunk_header *start_chunk) {
                 variant *const b = _stack_top - 1;
                 variant result;
 
-                if (a->type == bc::TYPE_INT) {
+                if (!is_number(*a) || !is_number(*b)) {
+                    if (!arith(bc::OP_ADD, a, b, &result))
+                        return 1;
+                } else if (a->type == bc::TYPE_INT) {
                     if (b->type == bc::TYPE_FLOAT) {
                         result.type = bc::TYPE_FLOAT;
                         result.f64 = (double)a->i32 + b->f64;
-                    } else if (b->type == bc::TYPE_INT) {
+                    } else {
                         result.type = bc::TYPE_INT;
                         result.i32 = a->i32 + b->i32;
-                    } else {
-                        std::cerr << "add invalid operand types";
-                        return 1;
                     }
-                } else if (a->type == bc::TYPE_FLOAT) {
+                } else {
                     if (b->type == bc::TYPE_FLOAT) {
                         result.type = bc::TYPE_FLOAT;
                         result.f64 = a->f64 + b->f64;
-                    } else if (b->type == bc::TYPE_INT) {
+                    } else {
                         result.type = bc::TYPE_FLOAT;
                         result.f64 = a->f64 + (double)b->i32;
-                    } else {
-                        std::cerr << "add invalid operand types";
-                        return 1;
                     }
                 }
 
@@ -243,27 +497,24 @@ bool vm::runner::run(const bc::chunk_header *start_chunk) {
                 variant *const b = _stack_top - 1;
                 variant result;
 
-                if (a->type == bc::TYPE_INT) {
+                if (!is_number(*a) || !is_number(*b)) {
+                    if (!arith(bc::OP_SUB, a, b, &result))
+                        return 1;
+                } else if (a->type == bc::TYPE_INT) {
                     if (b->type == bc::TYPE_FLOAT) {
                         result.type = bc::TYPE_FLOAT;
                         result.f64 = (double)a->i32 - b->f64;
-                    } else if (b->type == bc::TYPE_INT) {
+                    } else {
                         result.type = bc::TYPE_INT;
                         result.i32 = a->i32 - b->i32;
-                    } else {
-                        std::cerr << "add invalid operand types";
-                        return 1;
                     }
-                } else if (a->type == bc::TYPE_FLOAT) {
+                } else {
                     if (b->type == bc::TYPE_FLOAT) {
                         result.type = bc::TYPE_FLOAT;
                         result.f64 = a->f64 - b->f64;
-                    } else if (b->type == bc::TYPE_INT) {
+                    } else {
                         result.type = bc::TYPE_FLOAT;
                         result.f64 = a->f64 - (double)b->i32;
-                    } else {
-                        std::cerr << "sub invalid operand types";
-                        return 1;
                     }
                 }
 
@@ -277,27 +528,24 @@ bool vm::runner::run(const bc::chunk_header *start_chunk) {
                 variant *const b = _stack_top - 1;
                 variant result;
 
-                if (a->type == bc::TYPE_INT) {
+                if (!is_number(*a) || !is_number(*b)) {
+                    if (!arith(bc::OP_MUL, a, b, &result))
+                        return 1;
+                } else if (a->type == bc::TYPE_INT) {
                     if (b->type == bc::TYPE_FLOAT) {
                         result.type = bc::TYPE_FLOAT;
                         result.f64 = (double)a->i32 * b->f64;
-                    } else if (b->type == bc::TYPE_INT) {
+                    } else {
                         result.type = bc::TYPE_INT;
                         result.i32 = a->i32 * b->i32;
-                    } else {
-                        std::cerr << "mul invalid operand types";
-                        return 1;
                     }
-                } else if (a->type == bc::TYPE_FLOAT) {
+                } else {
                     if (b->type == bc::TYPE_FLOAT) {
                         result.type = bc::TYPE_FLOAT;
                         result.f64 = a->f64 * b->f64;
-                    } else if (b->type == bc::TYPE_INT) {
+                    } else {
                         result.type = bc::TYPE_FLOAT;
                         result.f64 = a->f64 * (double)b->i32;
-                    } else {
-                        std::cerr << "mul invalid operand types";
-                        return 1;
                     }
                 }
 
@@ -311,27 +559,24 @@ bool vm::runner::run(const bc::chunk_header *start_chunk) {
                 variant *const b = _stack_top - 1;
                 variant result;
 
-                if (a->type == bc::TYPE_INT) {
+                if (!is_number(*a) || !is_number(*b)) {
+                    if (!arith(bc::OP_DIV, a, b, &result))
+                        return 1;
+                } else if (a->type == bc::TYPE_INT) {
                     if (b->type == bc::TYPE_FLOAT) {
                         result.type = bc::TYPE_FLOAT;
                         result.f64 = (double)a->i32 / b->f64;
-                    } else if (b->type == bc::TYPE_INT) {
+                    } else {
                         result.type = bc::TYPE_INT;
                         result.i32 = a->i32 / b->i32;
-                    } else {
-                        std::cerr << "div invalid operand types";
-                        return 1;
                     }
-                } else if (a->type == bc::TYPE_FLOAT) {
+                } else {
                     if (b->type == bc::TYPE_FLOAT) {
                         result.type = bc::TYPE_FLOAT;
                         result.f64 = a->f64 / b->f64;
-                    } else if (b->type == bc::TYPE_INT) {
+                    } else {
                         result.type = bc::TYPE_FLOAT;
                         result.f64 = a->f64 / (double)b->i32;
-                    } else {
-                        std::cerr << "div invalid operand types";
-                        return 1;
                     }
                 }
 
@@ -341,63 +586,30 @@ bool vm::runner::run(const bc::chunk_header *start_chunk) {
             }
 
             case bc::OP_EQ: {
-                variant *a = _stack_top - 2;
-                variant *b = _stack_top - 1;
-                bool res = false;
-
-                if (b->type < a->type) {
-                    variant *const tmp = a;
-                    a = b;
-                    b = tmp;
-                }
+                bool res = equal(*(_stack_top - 2), *(_stack_top - 1));
 
-                if (a->type == bc::TYPE_VOID) {
-                    res = b->type == bc::TYPE_VOID;
-                }
-                else if (a->type == bc::TYPE_INT) {
-                    if (b->type == bc::TYPE_INT) {
-                        res = a->i32 == b->i32;
-                    } else if (b->type == bc::TYPE_FLOAT) {
-                        res = (double)a->i32 == b->f64;
-                    } else if (b->type == bc::TYPE_STRING) {
-                        vm::string *str_b = static_cast<vm::string*>(b->ref);
-
-                        // determine if string describes a real or an integer
-                        bool is_real = false;
-                        for (size_t i = 0; i < str_b->length(); ++i) {
-                            if (str_b->data()[i] == '.') {
-                                is_real = true;
-                                break;
-                            }
-                        }
+                --_stack_top;
+                (_stack_top - 1)->type = bc::TYPE_INT;
+                (_stack_top - 1)->i32 = res;
+                break;
+            }
 
-                        if (is_real) {
-                            res = (double)a->i32 == std::stod(str_b->to_cpp_string());
-                        } else {
-                            res = a->i32 == std::stoi(str_b->to_cpp_string());
-                        }
-                    }
-                }
-                else if (a->type == bc::TYPE_FLOAT) {
-                    if (b->type == bc::TYPE_STRING) {
-                        vm::string *str_b = static_cast<vm::string*>(b->ref);
-                        res = a->f64 == std::stod(str_b->to_cpp_string());
-                    }
-                }
-                else if (a->type == bc::TYPE_STRING) {
-                    if (b->type == bc::TYPE_STRING || b->type == bc::TYPE_SYMBOL) {
-                        vm::string *str_a = static_cast<vm::string*>(a->ref);
-                        vm::string *str_b = static_cast<vm::string*>(b->ref);
-                        res = *str_a == *str_b;
-                    }
-                }
-                else if (a->type == bc::TYPE_SYMBOL) {
-                    if (b->type == bc::TYPE_SYMBOL) {
-                        res = a->ref == b->ref;
-                    }
+            case bc::OP_LT:
+            case bc::OP_GT:
+            case bc::OP_LTE:
+            case bc::OP_GTE: {
+                int order;
+                if (!compare(_stack_top - 2, _stack_top - 1, &order)) {
+                    std::cerr << "compare invalid operand types";
+                    return 1;
                 }
-                else {
-                    res = false;
+
+                bool res;
+                switch (istr & 0xFF) {
+                    case bc::OP_LT: res = order < 0; break;
+                    case bc::OP_GT: res = order > 0; break;
+                    case bc::OP_LTE: res = order <= 0; break;
+                    default: res = order >= 0; break;
                 }
 
                 --_stack_top;
@@ -406,6 +618,20 @@ bool vm::runner::run(const bc::chunk_header *start_chunk) {
                 break;
             }
 
+            case bc::OP_CONTAINS: {
+                const string *str = stringify(_stack_top - 2);
+                const string *sub = stringify(_stack_top - 1);
+
+                size_t pos;
+                bool res = find_nocase(str->data(), str->length(),
+                                       sub->data(), sub->length(), &pos);
+
+                --_stack_top;
+                (_stack_top - 1)->type = bc::TYPE_INT;
+                (_stack_top - 1)->i32 = res;
+                break;
+            }
+
             case bc::OP_NOT: {
                 variant *v = _stack_top - 1;
 
@@ -420,10 +646,188 @@ bool vm::runner::run(const bc::chunk_header *start_chunk) {
                 break;
             }
 
+            case bc::OP_CONCAT: {
+                vm::string *str = concat(_stack_top - 2, 2);
+                --_stack_top;
+                (_stack_top - 1)->type = bc::TYPE_STRING;
+                (_stack_top - 1)->ref = str;
+                break;
+            }
+
+            case bc::OP_CONCATSP: {
+                variant values[3];
+                values[0] = *(_stack_top - 2);
+                values[1].type = bc::TYPE_STRING;
+                values[1].ref = _char_strings[' '];
+                values[2] = *(_stack_top - 1);
+
+                vm::string *str = concat(values, 3);
+                --_stack_top;
+                (_stack_top - 1)->type = bc::TYPE_STRING;
+                (_stack_top - 1)->ref = str;
+                break;
+            }
+
+            case bc::OP_CONCATN: {
+                bc::instr_decode(istr, &u8_a);
+                vm::string *str = concat(_stack_top - u8_a, u8_a);
+                _stack_top -= u8_a - 1;
+                (_stack_top - 1)->type = bc::TYPE_STRING;
+                (_stack_top - 1)->ref = str;
+                break;
+            }
+
+            case bc::OP_OIDXG:
+                if (!get_at(_stack_top - 2, _stack_top - 1))
+                    return 1;
+
+                --_stack_top;
+                break;
+
+            case bc::OP_OIDXK:
+                if (!chunk_index(_stack_top - 3, _stack_top - 2,
+                                 _stack_top - 1, nullptr))
+                    return 1;
+
+                _stack_top -= 2;
+                break;
+
+            case bc::OP_OIDXKR:
+                if (!chunk_index(_stack_top - 4, _stack_top - 3,
+                                 _stack_top - 2, _stack_top - 1))
+                    return 1;
+
+                _stack_top -= 3;
+                break;
+
+            case bc::OP_OCOUNTK:
+                if (!chunk_count(_stack_top - 2, _stack_top - 1))
+                    return 1;
+
+                --_stack_top;
+                break;
+
+            case bc::OP_THE:
+                bc::instr_decode(istr, &u8_a);
+                switch (u8_a) {
+                    case ast::EXPR_THE_ITEM_DELIMITER:
+                        _stack_top->type = bc::TYPE_STRING;
+                        _stack_top->ref = make_string(&_item_delimiter, 1);
+                        ++_stack_top;
+                        break;
+
+                    case ast::EXPR_THE_FLOAT_PRECISION:
+                        _stack_top->type = bc::TYPE_INT;
+                        _stack_top->i32 = _float_precision;
+                        ++_stack_top;
+                        break;
+
+                    default:
+                        std::cerr << "unimplemented the property " << (int)u8_a;
+                        return 1;
+                }
+                break;
+
+            case bc::OP_THESET: {
+                bc::instr_decode(istr, &u8_a);
+                const variant *v = --_stack_top;
+
+                switch (u8_a) {
+                    case ast::EXPR_THE_ITEM_DELIMITER: {
+                        if (v->type != bc::TYPE_STRING ||
+                            static_cast<string*>(v->ref)->length() == 0)
+                        {
+                            std::cerr << "error: expected a character";
+                            return 1;
+                        }
+
+                        _item_delimiter = static_cast<string*>(v->ref)->data()[0];
+                        break;
+                    }
+
+                    case ast::EXPR_THE_FLOAT_PRECISION:
+                        if (v->type != bc::TYPE_INT) {
+                            std::cerr << "error: expected integer";
+                            return 1;
+                        }
+
+                        _float_precision = v->i32 > MAX_FLOAT_PRECISION
+                            ? MAX_FLOAT_PRECISION
+                            : v->i32;
+                        break;
+
+                    default:
+                        std::cerr << "cannot set the property " << (int)u8_a;
+                        return 1;
+                }
+                break;
+            }
+
+            case bc::OP_NEWLLIST:
+                bc::instr_decode(istr, &u16_a);
+                _stack_top->type = bc::TYPE_LLIST;
+                _stack_top->ref = llist::alloc(_heap, u16_a);
+                ++_stack_top;
+                break;
+
+            case bc::OP_NEWPLIST:
+                _stack_top->type = bc::TYPE_PLIST;
+                _stack_top->ref = plist::alloc(_heap);
+                ++_stack_top;
+                break;
+
+            case bc::OP_CALL:
+            case bc::OP_OCALL: {
+                bc::instr_decode(istr, &u16_a, &u8_a);
+                const bc::chunk_const_str *name =
+                    bc::base_offset(string_pool, const_pool[u16_a].str);
+
+                // the object is passed as the first argument
+                if ((istr & 0xFF) == bc::OP_OCALL)
+                    ++u8_a;
+
+                if (!call(name, u8_a))
+                    return 1;
+
+                break;
+            }
+
+            case bc::OP_PUTAFTER:
+            case bc::OP_PUTBEFORE: {
+                variant *const target = _stack_top - 2;
+                str_piece p;
+                to_piece(_stack_top - 1, p);
+
+                vm::string *str;
+                if (target->type == bc::TYPE_STRING) {
+                    str = static_cast<vm::string*>(target->ref);
+                } else {
+                    str_piece tp;
+                    to_piece(target, tp);
+                    str = make_string(tp.chars, tp.length);
+                }
+
+                if ((istr & 0xFF) == bc::OP_PUTAFTER)
+                    str = vm::string::append(_heap, str, p.chars, p.length);
+                else
+                    str = vm::string::prepend(_heap, str, p.chars, p.length);
+
+                --_stack_top;
+                target->type = bc::TYPE_STRING;
+                target->ref = str;
+                break;
+            }
+
             case bc::OP_PUT: {
-                vm::string *str = stringify(_stack_top - 1);
+                // written straight from the serializer's buffer, which is
+                // reused by every put
+                _put_writer.clear();
+                serialize(_put_writer, _stack_top - 1, false);
+                _put_writer.put('\n');
                 --_stack_top;
-                std::cout << str->data() << "\n";
+
+                std::cout.write(_put_writer.data(),
+                                (std::streamsize)_put_writer.length());
                 break;
             }
 
@@ -1,102 +1,1186 @@
 #pragma once
 #include "../lang/lingo.hpp"
+#include <atomic>
 #include <cstdint>
+#include <cstring>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
 // data structures
 namespace lingo::vm {
+    class gc_heap;
+
+    // 64-bit hash over the full length of the given bytes.
+    size_t hash_bytes(const char *data, size_t len);
+
+    // case-insensitive hash, equality and ordering of characters, as lingo
+    // compares strings. ascii and latin-1 letters are folded to lowercase.
+    size_t hash_bytes_nocase(const char *data, size_t len);
+    bool equal_nocase(const char *a, const char *b, size_t len);
+    int compare_nocase(const char *a, size_t a_len,
+                       const char *b, size_t b_len);
+
+    // find the first occurrence of the needle in the haystack, ignoring
+    // case. an empty needle is found at position 0.
+    bool find_nocase(const char *hay, size_t hay_len,
+                     const char *needle, size_t needle_len, size_t *pos);
+
+    // write a number as lingo prints it, returning the number of characters
+    // written. buf must have room for 16 (int) or 32 (float) characters.
+    size_t format_int(char *buf, int32_t v);
+    size_t format_float(char *buf, double v, int precision);
+    size_t format_float_shortest(char *buf, double v);
+
+    constexpr int MAX_FLOAT_PRECISION = 15;
+
+    // sort packed list items in ascending order
+    void sort_ints(int32_t *items, size_t n);
+    void sort_floats(double *items, size_t n);
+
+    // out[i] = a[i] op b[i] for add, sub, mul or div of packed list items,
+    // where a side with a step of 0 is one value used for every item. out
+    // may be the same array as a or b. ints wrap, and an int division by
+    // zero is an error, which returns false. without vector, every item
+    // goes through the scalar loop, to compare against.
+    bool arith_ints(bc::opcode op, const int32_t *a, size_t a_step,
+                    const int32_t *b, size_t b_step, int32_t *out, size_t n,
+                    bool vector = true);
+    void arith_floats(bc::opcode op, const double *a, size_t a_step,
+                      const double *b, size_t b_step, double *out, size_t n,
+                      bool vector = true);
+
+    struct variant;
+
+    // read an integer or float from the characters, ignoring surrounding
+    // whitespace. returns false if they are not a number.
+    bool parse_number(const char *chars, size_t len, variant *out);
+
+    enum chunk_type : uint8_t {
+        CHUNK_CHAR,
+        CHUNK_WORD,
+        CHUNK_ITEM,
+        CHUNK_LINE
+    };
+
+    // the byte ranges of the words, items and lines of a string, each built
+    // the first time the string is indexed by that chunk type. strings are
+    // never modified: appending with put after/before makes a new string
+    // viewing more of the buffer, without a table, and leaves the characters
+    // of the old one as they were. item bounds are kept for the last few
+    // item delimiters, so switching the itemDelimiter back and forth does not
+    // rebuild them.
+    struct chunk_table {
+        struct item_bounds {
+            char delim;
+            std::vector<size_t> bounds;
+        };
+
+        static constexpr size_t ITEM_DELIMS = 4;
+
+        // start/end pairs
+        std::vector<size_t> words;
+        std::vector<size_t> lines;
+        item_bounds items[ITEM_DELIMS];
+
+        bool words_built = false;
+        bool lines_built = false;
+        size_t item_count = 0; // item delimiters with bounds
+        size_t item_next = 0; // slot replaced once all are in use
+
+        // strings shorter than this are scanned instead of indexed
+        static constexpr size_t MIN_LENGTH = 128;
+
+        // the memory the table holds, which is counted with its string
+        inline size_t bytes() const {
+            size_t n = words.capacity() + lines.capacity();
+            for (size_t i = 0; i < item_count; ++i)
+                n += items[i].bounds.capacity();
+
+            return sizeof(chunk_table) + n * sizeof(size_t);
+        }
+    };
+
     class gc_object {
+        friend class gc_heap;
+
     public:
         enum otype : uint8_t {
-            OTYPE_STRING
+            OTYPE_STRING,
+            OTYPE_LLIST,
+            OTYPE_PLIST,
+            OTYPE_GEOM,
+            OTYPE_IMAGE
         };
 
     protected:
+        gc_object *_gc_next; // next object in the heap's object list
+        std::atomic<bool> _gc_marked; // atomic for the parallel mark
         otype obj_type;
-        gc_object(otype obj_type) : obj_type(obj_type) { }
+
+        gc_object(otype obj_type)
+            : _gc_next(nullptr), _gc_marked(false), obj_type(obj_type) { }
+
+    public:
+        inline otype type() const { return obj_type; }
     };
 
+    // the characters of a flat string are stored directly after the object
+    // header, so creating a string is a single allocation. strings are only
+    // created through the alloc functions and destroyed with free.
     class string : public gc_object {
+        friend class gc_heap;
+
     protected:
+        enum kind : uint8_t {
+            KIND_FLAT,
+            KIND_ROPE,
+            KIND_BUFFER,
+            KIND_SLICE
+        };
+
+        // numeric interpretation of the characters, cached by to_number
+        enum num_kind : uint8_t {
+            NUM_UNKNOWN,
+            NUM_NONE, // not a number
+            NUM_INT,
+            NUM_FLOAT
+        };
+
+        kind _kind;
+        bool _owns_chars; // true if _chars was allocated separately
+        mutable num_kind _num_kind;
+        mutable double _num; // int32 values are exact in a double
         size_t _length;
-        char *_chars; // always null-terminated
-    
+        mutable size_t _hash; // 0 if not yet computed
+        mutable char *_chars; // nullptr if the string has yet to be flattened
+        mutable chunk_table *_chunks; // nullptr if not yet chunk-indexed
+
+        inline string(size_t len, kind k)
+            : gc_object(OTYPE_STRING), _kind(k), _owns_chars(false),
+              _num_kind(NUM_UNKNOWN), _num(0.0), _length(len), _hash(0),
+              _chars(nullptr), _chunks(nullptr) { }
+        ~string() = default;
+
+        char* flatten() const;
+
     public:
-        inline string(const char *str, size_t len)
-        : gc_object(OTYPE_STRING), _length(len) {
-            _chars = new char[len + 1];
-            memcpy(_chars, str, len);
-            _chars[len] = '\0';
+        string(const string&) = delete;
+        string(string&&) = delete;
+        string& operator=(const string&) = delete;
+
+        // allocate a zero-filled string of the given length
+        static string* alloc(gc_heap &heap, size_t len);
+        static string* alloc(gc_heap &heap, const char *str, size_t len);
+
+        static inline string* alloc(gc_heap &heap, const char *str) {
+            return alloc(heap, str, strlen(str));
         }
 
-        inline string(size_t len) : gc_object(OTYPE_STRING) {
-            _length = len;
-            _chars = new char[len + 1];
-            memset(_chars, 0, (len + 1) * sizeof(char));
+        static inline string* alloc(gc_heap &heap, const std::string &str) {
+            return alloc(heap, str.c_str(), str.length());
         }
 
-        inline string(const char *str) : string(str, strlen(str)) { }
+        static void free(string *str);
 
-        inline string(const std::string &str)
-            : string(str.c_str(), str.length()) { };
+        // return a string with the given characters appended/prepended to
+        // the target. see buffer_string.
+        static string* append(gc_heap &heap, string *target,
+                              const char *chars, size_t len);
+        static string* prepend(gc_heap &heap, string *target,
+                               const char *chars, size_t len);
 
-        inline string(const string &str)
-            : string(str._chars, str._length) { };
-        
-        inline string(string &&src) : gc_object(OTYPE_STRING) {
-            _chars = src._chars;
-            _length = src._length;
-            src._chars = nullptr;
-            src._length = 0;
-        }
+        // return the given range of the characters of a string, either as a
+        // slice of it or as a copy if it is short. see slice_string.
+        static string* substr(gc_heap &heap, string *src, size_t offset,
+                              size_t len);
 
-        inline ~string() {
-            delete[] _chars;
+        // null-terminated, unless the string is a view into the characters
+        // of another string or an append buffer
+        inline char* data() const {
+            if (_chars) return _chars;
+            return flatten();
         }
 
-        inline char* data() const { return _chars; }
         inline size_t length() const { return _length; }
+        inline bool is_flat() const { return _chars != nullptr; }
+
+        // strings that differ only in case have the same hash, and are
+        // equal
+        inline size_t hash() const {
+            if (_hash == 0) {
+                _hash = hash_bytes_nocase(data(), _length);
+                if (_hash == 0) _hash = 1;
+            }
+
+            return _hash;
+        }
 
         inline bool operator==(const string &other) const {
-            return _length == other._length &&
-                    !memcmp(_chars, other._chars, _length);
+            if (this == &other) return true;
+            if (_length != other._length) return false;
+            if (_hash && other._hash && _hash != other._hash) return false;
+            return equal_nocase(data(), other.data(), _length);
+        }
+
+        // negative, zero or positive as the string sorts before, the same
+        // as or after the other, ignoring case
+        inline int compare(const string &other) const {
+            if (this == &other) return 0;
+            return compare_nocase(data(), _length, other.data(), other._length);
         }
 
         inline std::string to_cpp_string() const {
-            return std::string(_chars, _length);
+            return std::string(data(), _length);
+        }
+
+        // the number the string reads as, as by parse_number. the result
+        // is cached, so comparing the same string with numbers repeatedly
+        // only parses it once.
+        bool to_number(variant *out) const;
+
+        // start/end pairs of every word, item or line of the string. the
+        // table is charged to the heap as it grows.
+        const std::vector<size_t>& chunk_bounds(gc_heap &heap,
+                                                chunk_type type,
+                                                char item_delim) const;
+    };
+
+    // the concatenation of two strings. the characters are only copied into
+    // a single buffer the first time they are read, so strings built up by
+    // repeated appends don't copy the whole string on every append.
+    class rope : public string {
+        friend class string;
+        friend class gc_heap;
+
+    protected:
+        string *_left;
+        string *_right; // both nullptr once flattened
+
+        inline rope(string *left, string *right)
+            : string(left->length() + right->length(), KIND_ROPE),
+              _left(left), _right(right) { }
+
+    public:
+        // strings shorter than this are always built flat, since copying
+        // them is cheaper than the rope node
+        static constexpr size_t MIN_LENGTH = 256;
+
+        static rope* alloc(gc_heap &heap, string *left, string *right);
+
+        inline string* left() const { return _left; }
+        inline string* right() const { return _right; }
+    };
+
+    // character buffer with free space on both ends, shared by all strings
+    // made by appending to or prepending to one another.
+    struct strbuf {
+        size_t refs;
+        size_t capacity;
+        size_t begin; // index of the first used byte
+        size_t end; // index past the last used byte
+
+        inline char* data() { return (char*)(this + 1); }
+    };
+
+    // a string that views a range of a strbuf. when the range reaches the
+    // used end (or start) of the buffer, nothing else has been written after
+    // (or before) it, so appending (or prepending) writes into the free space
+    // of the buffer in-place, and the new string views the larger range. the
+    // characters of the old string are left untouched. only when the space
+    // is taken by another string, or has run out, are the characters copied
+    // into a new buffer, which is grown geometrically.
+    class buffer_string : public string {
+        friend class string;
+
+    protected:
+        strbuf *_buf;
+
+        buffer_string(strbuf *buf, size_t offset, size_t len);
+
+    public:
+        // minimum capacity of a new buffer
+        static constexpr size_t MIN_CAPACITY = 64;
+
+        // a string viewing the used range of the buffer
+        static string* alloc(gc_heap &heap, strbuf *buf);
+
+        inline strbuf* buffer() const { return _buf; }
+    };
+
+    // growable character buffer. the characters can be handed over to a
+    // buffer_string without being copied, which leaves the writer empty.
+    class str_writer {
+    private:
+        strbuf *_buf; // nullptr until something is written
+
+        void grow(size_t min_free);
+
+    public:
+        inline str_writer() : _buf(nullptr) { }
+        str_writer(const str_writer&) = delete;
+        ~str_writer();
+
+        // return a pointer to at least n bytes of free space, which is
+        // claimed by calling commit
+        inline char* reserve(size_t n) {
+            if (!_buf || _buf->capacity - _buf->end < n)
+                grow(n);
+
+            return _buf->data() + _buf->end;
+        }
+
+        inline void commit(size_t n) { _buf->end += n; }
+
+        inline void write(const char *chars, size_t len) {
+            memcpy(reserve(len), chars, len);
+            _buf->end += len;
+        }
+
+        inline void put(char ch) {
+            *reserve(1) = ch;
+            ++_buf->end;
+        }
+
+        inline const char* data() const { return _buf ? _buf->data() : ""; }
+        inline size_t length() const { return _buf ? _buf->end : 0; }
+        inline void clear() { if (_buf) _buf->end = 0; }
+
+        string* finish(gc_heap &heap);
+    };
+
+    // a string that views a range of the characters of a parent string,
+    // which is kept alive by the slice. the parent is never an attached slice
+    // or an unflattened rope. the collector does not mark the parent through
+    // its slices: if nothing else reaches the parent, each slice copies its
+    // characters out of it instead, and the parent is freed.
+    class slice_string : public string {
+        friend class string;
+        friend class gc_heap;
+
+    protected:
+        string *_parent; // nullptr once detached from the parent
+
+        slice_string(string *parent, size_t offset, size_t len);
+        void detach();
+
+    public:
+        // ranges shorter than this are copied instead of sliced
+        static constexpr size_t MIN_LENGTH = 32;
+
+        inline string* parent() const { return _parent; }
+    };
+
+    // hash and equality for maps keyed by names, which are not case
+    // sensitive in lingo
+    struct string_hash {
+        inline size_t operator()(std::string_view str) const {
+            return hash_bytes_nocase(str.data(), str.size());
+        }
+    };
+
+    struct string_equal {
+        inline bool operator()(std::string_view a, std::string_view b) const {
+            return a.size() == b.size() &&
+                   equal_nocase(a.data(), b.data(), a.size());
         }
     };
 
+    // a point component, which is an int or a float as the variant's
+    // float_mask says
+    union num32 {
+        int32_t i;
+        float f;
+    };
+
     struct variant {
         bc::vtype type;
+        uint8_t float_mask; // for points, bit i is set if component i is a float
         union {
             int32_t i32;
             double f64;
             gc_object *ref;
+            num32 pt[2]; // point h and v
+            uint8_t rgb[3]; // color
         };
 
-        variant() : type(bc::TYPE_VOID), i32(0) { }
+        variant() : type(bc::TYPE_VOID), float_mask(0), i32(0) { }
+
+        // points and colors are stored in the variant itself
+        inline bool is_ref() const {
+            return type >= bc::TYPE_STRING && type != bc::TYPE_POINT &&
+                   type != bc::TYPE_COLOR;
+        }
     }; // struct variant;
-} // namespace lingo::vm
 
-template<>
-struct std::hash<lingo::vm::string> {
-    std::size_t operator()(const lingo::vm::string &k) const {
-        const char *dat = k.data();
-        size_t count = k.length();
-        if (count > 32) count = 32;
+    // item storage of a linear list. lists made by duplicate() share the
+    // buffer of the list they were copied from until one of them writes to
+    // it, at which point the writer copies the items to a buffer of its own.
+    struct listbuf {
+        size_t refs;
+        size_t capacity; // in items
+
+        // the items' hash, or 0 if it isn't known yet or can't be kept
+        // because the items include lists. cleared by the first write.
+        size_t hash;
+
+        inline void* data() { return this + 1; }
+    };
+
+    class llist;
+
+    // the list or property list that lists, property lists and images were
+    // added to, kept by each of them. duplicate() of a linear list shares
+    // its items, lists included, and the tag links those duplicates, so
+    // that changing any of the items first gives the duplicates lists of
+    // their own.
+    struct owner_tag {
+        size_t refs;
+        gc_object *owner; // nullptr once the list is freed
+        llist *lazy; // duplicates sharing the owner's items
+
+        static inline void release(owner_tag *tag) {
+            if (tag && --tag->refs == 0)
+                delete tag;
+        }
+    };
+
+    // linear list. lists of only integers or only floats are stored packed,
+    // as int32_t or double arrays, since most big lists are tile and geometry
+    // data. the first item of another type moves the list to variant
+    // storage, which it keeps from then on.
+    class llist : public gc_object {
+        friend class gc_heap;
+        friend class plist;
+
+    public:
+        enum storage : uint8_t {
+            STORE_INT,
+            STORE_FLOAT,
+            STORE_VARIANT
+        };
+
+    protected:
+        storage _storage;
+        bool _sorted; // set by sort(), and cleared by adding out of order
+
+        // a duplicate whose items are still those of _tag's owner, lists
+        // included. it duplicates the lists before it hands one out, and
+        // before it or any of them changes.
+        bool _lazy;
+
+        // this list, or a list in it, holds lists that were added to other
+        // lists as well. tags can't follow those, so duplicate() copies
+        // the items of a foreign list eagerly.
+        bool _foreign;
+
+        size_t _count;
+        listbuf *_buf; // nullptr until something is added
+        void *_data; // the items in _buf
+
+        owner_tag *_tag; // of the items, or the one this is lazy on
+        llist *_next_lazy; // on _tag, while lazy
+        owner_tag *_container; // of the list this was added to
+
+        inline llist()
+            : gc_object(OTYPE_LLIST), _storage(STORE_INT), _sorted(false),
+              _lazy(false), _foreign(false), _count(0), _buf(nullptr),
+              _data(nullptr), _tag(nullptr), _next_lazy(nullptr),
+              _container(nullptr) { }
+        ~llist();
+
+        inline size_t capacity() const { return _buf ? _buf->capacity : 0; }
+        void realloc(gc_heap &heap, size_t capacity);
+
+        owner_tag* tag();
+        void unshare_slow(gc_heap &heap);
+
+        // the tag of the list a list, property list or image is in
+        static owner_tag** container_of(const variant &v);
+        static owner_tag* container_of(const gc_object *list);
+
+        // whether a lazy duplicate of the list with the tag, or of a list
+        // it is in, shares its items
+        static bool has_lazy(const owner_tag *tag);
+
+        // the _foreign flag of a list or property list
+        static bool& foreign_of(gc_object *list);
+
+        // mark the list foreign, and the lists it is in
+        static void mark_foreign(gc_object *list);
+
+        // adopt() for the list or property list with the tag
+        static void adopt(gc_object *list, owner_tag *tag, const variant &v);
+
+        // duplicate the lists among the items, in a buffer of this list's
+        // own, and stop being lazy
+        void resolve(gc_heap &heap);
+
+        static constexpr size_t elem_size(storage s) {
+            return s == STORE_INT ? sizeof(int32_t)
+                 : s == STORE_FLOAT ? sizeof(double)
+                 : sizeof(variant);
+        }
+
+        void reserve(gc_heap &heap, size_t capacity);
+        void convert(gc_heap &heap, storage to);
+        void put(size_t i, const variant &v);
+
+        // the storage that can hold v, given the current storage
+        inline storage storage_for(const variant &v) const {
+            if (_storage == STORE_VARIANT) return STORE_VARIANT;
+
+            bc::vtype packed = _storage == STORE_INT
+                ? bc::TYPE_INT
+                : bc::TYPE_FLOAT;
+            if (v.type == packed) return _storage;
+
+            // an empty packed list can take either packed type
+            if (_count == 0) {
+                if (v.type == bc::TYPE_INT) return STORE_INT;
+                if (v.type == bc::TYPE_FLOAT) return STORE_FLOAT;
+            }
+
+            return STORE_VARIANT;
+        }
+
+    public:
+        static llist* alloc(gc_heap &heap, size_t capacity = 0);
+
+        // a list of count zeroes, or voids, with the given storage, for the
+        // caller to fill in through ints(), floats() or variants(), and
+        // adopt()
+        static llist* alloc(gc_heap &heap, storage s, size_t count);
+
+        // a copy of the list, which shares this list's buffer until either
+        // list writes to it. the lists, property lists and images in it
+        // are duplicated by the copy the first time it hands one out, or
+        // it or one of them changes. a list holding lists that are in
+        // other lists too duplicates them right away.
+        llist* duplicate(gc_heap &heap);
+
+        // give the list a buffer of its own, if it is shared, and give
+        // lazy duplicates of it, or of the lists it is in, items of their
+        // own. anything that writes to the items through ints(), floats()
+        // or variants() must call this first.
+        inline void unshare(gc_heap &heap) {
+            if (_lazy || _container || (_buf && _buf->refs > 1)) {
+                unshare_slow(heap);
+            } else if (_buf) {
+                _buf->hash = 0;
+            }
+        }
+
+        // give the lazy duplicates on the tag items of their own. the
+        // first copies the owner's items, and the rest share its copy.
+        static void resolve_lazy(gc_heap &heap, owner_tag *tag);
+
+        // before something in the list with the tag changes: resolve the
+        // lazy duplicates of that list and of the lists it is in, outermost
+        // first, since resolving a list makes its lists lazy in turn
+        static void settle(gc_heap &heap, owner_tag *tag);
+
+        // record that the value is now one of the items, if it is a list,
+        // property list or image. set, add and insert do this; items
+        // written through variants() must be passed to it.
+        void adopt(const variant &v);
+
+        inline bool lazy() const { return _lazy; }
+
+        // item by item equality, with equal() of each pair of items. lists
+        // sharing a buffer are equal without looking at the items, and
+        // strictly unequal lists usually differ by their cached hashes.
+        bool equal(const llist &other, bool strict, int depth = 0) const;
+
+        // hash_value() of the items, with lists more than a level down
+        // hashed by their count. lists of anything but lists keep it with
+        // the buffer until they change, so a duplicate has it as well.
+        size_t hash(int depth = 0) const;
+
+        inline size_t count() const { return _count; }
+        inline storage store() const { return _storage; }
+
+        inline bool sorted() const { return _sorted; }
+        inline void mark_sorted() { _sorted = true; }
+
+        // the items, if the list has the given storage
+        inline int32_t* ints() const { return (int32_t*)_data; }
+        inline double* floats() const { return (double*)_data; }
+        inline variant* variants() const { return (variant*)_data; }
+
+        inline variant get(size_t i) const {
+            variant v;
+            switch (_storage) {
+                case STORE_INT:
+                    v.type = bc::TYPE_INT;
+                    v.i32 = ints()[i];
+                    break;
+
+                case STORE_FLOAT:
+                    v.type = bc::TYPE_FLOAT;
+                    v.f64 = floats()[i];
+                    break;
+
+                case STORE_VARIANT:
+                    v = variants()[i];
+                    break;
+            }
+
+            return v;
+        }
+
+        // set and add leave the list unsorted. insert doesn't, since it
+        // is how items are added to sorted lists in order.
+        void set(gc_heap &heap, size_t i, const variant &v);
+        void add(gc_heap &heap, const variant &v);
+        void insert(gc_heap &heap, size_t i, const variant &v);
+    };
+
+    struct plist_entry {
+        variant key;
+        variant value;
+    };
+
+    // property list. entries are kept in insertion order, and the same key
+    // may appear more than once, in which case lookups find the first.
+    //
+    // small lists, which are most of them, are searched linearly; symbol
+    // keys are interned, so that is a pointer compare per entry. lists with
+    // more than INDEX_MIN entries also keep an open-addressed hash index
+    // from keys to entry slots.
+    //
+    // removing an entry from an indexed list leaves its slot in place,
+    // marked removed, so that no other entry moves and the index needs no
+    // renumbering. removed slots are dropped the next time the entries are
+    // read by position, or when the slots would otherwise grow. their keys
+    // are kept until then, so that the slots of a sorted list stay in order.
+    class plist : public gc_object {
+        friend class gc_heap;
+        friend class llist;
 
-        size_t res = *(dat++);
-        size_t fac = 53;
-        for (size_t i = 1; i < count; ++i) {
-            res += ((size_t) *(dat++)) * fac;
+    protected:
+        // slots, in order. removed ones are counted in _removed.
+        mutable std::vector<plist_entry> _entries;
+        mutable size_t _removed;
+
+        // entry slots, or EMPTY. the capacity is a power of two, and at
+        // least twice the entry count. nullptr while the list is small.
+        uint32_t *_index;
+        size_t _index_mask;
+        bool _sorted; // by key
+        bool _foreign; // as for linear lists
+
+        owner_tag *_tag; // of the values
+        owner_tag *_container; // of the list this was added to
+
+        static constexpr uint32_t EMPTY = UINT32_MAX;
+
+        // the float_mask of the value of a removed slot, which is void
+        static constexpr uint8_t REMOVED = UINT8_MAX;
+
+        inline plist()
+            : gc_object(OTYPE_PLIST), _removed(0), _index(nullptr),
+              _index_mask(0), _sorted(false), _foreign(false),
+              _tag(nullptr), _container(nullptr) { }
+        ~plist();
+
+        void build_index(gc_heap &heap, size_t capacity);
+        void index_insert(size_t i) const;
+        void index_remove(size_t i);
+        void index_shift(size_t from, size_t to);
+
+        // the slot of the first entry with the key, or -1
+        ptrdiff_t find_slot(const variant &key) const;
+
+        // drop the removed slots. this does not change the entries, so
+        // const lists are compacted too.
+        void compact() const;
+
+        owner_tag* tag();
+
+    public:
+        static constexpr size_t INDEX_MIN = 8;
+
+        static plist* alloc(gc_heap &heap, size_t capacity = 0);
+
+        // a copy of the entries, with the lists among the values duplicated
+        plist* duplicate(gc_heap &heap);
+
+        // give lazy duplicates of the lists this is in items of their own.
+        // add, insert, set and remove do this; anything that writes to the
+        // entries through entries() must call it first.
+        inline void unshare(gc_heap &heap) {
+            if (_container) llist::settle(heap, _container);
+        }
+
+        // as llist::adopt, for values written through entries()
+        void adopt(const variant &v);
+
+        // property list keys compare as the = operator does, except that
+        // values of different types are never the same key
+        // lists can be keys too, and should not be changed while they are
+        static bool key_equal(const variant &a, const variant &b);
+        static size_t key_hash(const variant &key);
+
+        // entries in order, with equal() of the keys and values
+        bool equal(const plist &other, bool strict, int depth = 0) const;
+        size_t hash(int depth = 0) const;
+
+        inline size_t count() const { return _entries.size() - _removed; }
+
+        inline bool sorted() const { return _sorted; }
+        inline void mark_sorted() { _sorted = true; }
+
+        // the entries by position. the keys must not be changed through
+        // these, other than by reordering the entries and calling reindex
+        inline plist_entry* entries() { compact(); return _entries.data(); }
+        inline const plist_entry* entries() const {
+            compact();
+            return _entries.data();
+        }
+
+        // the slots, removed ones included, for binary searches of a sorted
+        // list that don't compact it. see insert.
+        inline const plist_entry* slots() const { return _entries.data(); }
+        inline size_t slot_count() const { return _entries.size(); }
+
+        static inline bool removed(const plist_entry &e) {
+            return e.value.type == bc::TYPE_VOID &&
+                   e.value.float_mask == REMOVED;
+        }
+
+        // the position of the first entry with the key, or -1
+        ptrdiff_t find(const variant &key) const;
+
+        // the first entry with the key, or nullptr. unlike find, this does
+        // not need positions, so it leaves removed slots in place.
+        plist_entry* lookup(const variant &key);
+        const plist_entry* lookup(const variant &key) const;
+
+        void add(gc_heap &heap, const variant &key, const variant &value);
+
+        // insert before the given slot (as a position among the slots, with
+        // removed ones). a removed slot next to it is reused; otherwise the
+        // slots up to the next removed one move up by one.
+        void insert(gc_heap &heap, size_t slot, const variant &key,
+                    const variant &value);
+        void reindex(gc_heap &heap);
+
+        // change the value of the first entry with the key, or add one
+        void set(gc_heap &heap, const variant &key, const variant &value);
+
+        // remove the first entry with the key. returns false if there is
+        // none.
+        bool remove(gc_heap &heap, const variant &key);
+    };
+
+    // rect or quad. points and colors fit in a variant, but these don't, so
+    // their components are kept in records from a pool in the heap. records
+    // are never changed after they are made, so variants can share them and
+    // still behave as values.
+    //
+    // the components are stored as doubles directly after the object.
+    // integer components hold integral values.
+    class geom : public gc_object {
+        friend class gc_heap;
+
+    protected:
+        bc::vtype _type;
+        uint8_t _float_mask; // bit i is set if component i is a float
+
+        inline geom(bc::vtype type, uint8_t float_mask)
+            : gc_object(OTYPE_GEOM), _type(type), _float_mask(float_mask) { }
+
+    public:
+        static geom* alloc(gc_heap &heap, bc::vtype type, const double *c,
+                           uint8_t float_mask);
+
+        // the number of components of the given geometry type
+        static constexpr size_t component_count(bc::vtype type) {
+            return type == bc::TYPE_POINT ? 2
+                 : type == bc::TYPE_COLOR ? 3
+                 : type == bc::TYPE_QUAD ? 8
+                 : 4;
+        }
+
+        static constexpr bool is_geom(bc::vtype type) {
+            return type >= bc::TYPE_POINT && type <= bc::TYPE_COLOR;
+        }
+
+        // a point, rect, quad or color from int or float components. color
+        // components are clamped to 0-255, and point components that are
+        // floats are stored in single precision.
+        static variant make(gc_heap &heap, bc::vtype type, const variant *c);
+
+        // a component of a point, rect, quad or color, as an int or float
+        static variant component(const variant &g, size_t i);
+
+        // all the components as doubles, returning which are floats, and
+        // a value made from components in that form
+        static inline uint8_t unpack(const variant &g, double *c) {
+            switch (g.type) {
+                case bc::TYPE_POINT:
+                    for (size_t i = 0; i < 2; ++i) {
+                        c[i] = (g.float_mask & (1 << i))
+                            ? (double)g.pt[i].f
+                            : (double)g.pt[i].i;
+                    }
+                    return g.float_mask;
+
+                case bc::TYPE_COLOR:
+                    for (size_t i = 0; i < 3; ++i)
+                        c[i] = (double)g.rgb[i];
+                    return 0;
+
+                default: {
+                    const geom *obj = static_cast<geom*>(g.ref);
+                    memcpy(c, obj->components(),
+                           component_count(g.type) * sizeof(double));
+                    return obj->_float_mask;
+                }
+            }
+        }
+
+        static inline variant pack(gc_heap &heap, bc::vtype type,
+                                   const double *c, uint8_t float_mask) {
+            variant g;
+            g.type = type;
+            g.ref = nullptr; // so that unused bytes of colors compare equal
+
+            switch (type) {
+                case bc::TYPE_POINT:
+                    g.float_mask = float_mask & 3;
+                    for (size_t i = 0; i < 2; ++i) {
+                        if (float_mask & (1 << i))
+                            g.pt[i].f = (float)c[i];
+                        else
+                            g.pt[i].i = (int32_t)c[i];
+                    }
+                    break;
+
+                case bc::TYPE_COLOR:
+                    for (size_t i = 0; i < 3; ++i) {
+                        double v = c[i];
+                        g.rgb[i] = (uint8_t)(v < 0.0 ? 0
+                                           : v > 255.0 ? 255
+                                           : (int32_t)v);
+                    }
+                    break;
+
+                default:
+                    g.ref = alloc(heap, type, c, float_mask);
+                    break;
+            }
+
+            return g;
+        }
+
+        inline bc::vtype geom_type() const { return _type; }
+        inline uint8_t float_mask() const { return _float_mask; }
+        inline const double* components() const {
+            return (const double*)(this + 1);
+        }
+    };
+
+    // bitmap of 32-bit or 8-bit pixels. 32-bit pixels are 0xAARRGGBB words,
+    // and 8-bit pixels are indices into the grayscale palette, in which 0 is
+    // white and 255 is black. every row starts on a ROW_ALIGN boundary, so
+    // rows can be read and written with aligned vector loads and stores.
+    //
+    // images are not values: assigning one to another variable refers to
+    // the same pixels, as in director. duplicate() copies them.
+    class image : public gc_object {
+        friend class gc_heap;
+        friend class llist;
+
+    protected:
+        int32_t _width;
+        int32_t _height;
+        uint8_t _depth;
+        size_t _stride; // bytes from the start of one row to the next
+        uint8_t *_pixels;
+
+        // planes made from the pixels, kept until they change. they are
+        // 8-bit images of the same size that aren't on the heap themselves,
+        // but are counted with the image when it survives a collection.
+        mutable image *_mask;
+        mutable image *_matte;
+
+        owner_tag *_container; // of the list this was added to
+
+        inline image(int32_t width, int32_t height, uint8_t depth)
+            : gc_object(OTYPE_IMAGE), _width(width), _height(height),
+              _depth(depth), _stride(0), _pixels(nullptr), _mask(nullptr),
+              _matte(nullptr), _container(nullptr) { }
+        ~image();
+
+        // an image whose pixels aren't set, for alloc and the planes
+        static image* make(int32_t width, int32_t height, uint8_t depth);
+        void drop_planes();
+
+    public:
+        static constexpr size_t ROW_ALIGN = 32;
+
+        // a white image. depth must be 8 or 32.
+        static image* alloc(gc_heap &heap, int32_t width, int32_t height,
+                            uint8_t depth);
+        image* duplicate(gc_heap &heap) const;
+
+        inline int32_t width() const { return _width; }
+        inline int32_t height() const { return _height; }
+        inline uint8_t depth() const { return _depth; }
+        inline size_t stride() const { return _stride; }
+        inline size_t bytes() const { return _stride * (size_t)_height; }
+
+        inline uint8_t* row(int32_t y) const {
+            return _pixels + (size_t)y * _stride;
+        }
+
+        // how dark each pixel is, 0 for white to 0xFF for black
+        const image& mask() const;
+
+        // 0 for the white pixels that can be reached from the edges through
+        // other white pixels, and 0xFF for the rest
+        const image& matte() const;
+
+        // give lazy duplicates of the lists this is in images of their
+        // own. call before writing pixels.
+        inline void unshare(gc_heap &heap) {
+            if (_container) llist::settle(heap, _container);
+        }
+
+        // throws away the mask and matte. call after writing pixels.
+        inline void changed() {
+            if (_mask || _matte)
+                drop_planes();
+        }
+
+        // the gray level of a 0xRRGGBB color, 0 for black to 255 for white.
+        // the palette index of the nearest gray is 255 minus it.
+        static inline uint8_t gray(uint32_t rgb) {
+            uint32_t r = (rgb >> 16) & 0xFF;
+            uint32_t g = (rgb >> 8) & 0xFF;
+            uint32_t b = rgb & 0xFF;
+            return (uint8_t)((r * 77 + g * 150 + b * 29) >> 8);
+        }
+
+        // pixels as stored: 0xAARRGGBB at 32 bits, the palette index at 8.
+        // x and y must be inside the image.
+        inline uint32_t pixel(int32_t x, int32_t y) const {
+            return _depth == 32 ? ((const uint32_t*)row(y))[x] : row(y)[x];
         }
 
-        return res;
+        inline void set_pixel(int32_t x, int32_t y, uint32_t value) {
+            if (_depth == 32)
+                ((uint32_t*)row(y))[x] = value;
+            else
+                row(y)[x] = (uint8_t)value;
+            changed();
+        }
+
+        // the stored form of an opaque 0xRRGGBB color
+        inline uint32_t pixel_of(uint32_t rgb) const {
+            return _depth == 32 ? 0xFF000000 | rgb : 255u - gray(rgb);
+        }
+
+        // the 0xRRGGBB color of a stored pixel
+        inline uint32_t rgb_of(uint32_t pixel) const {
+            if (_depth == 32) return pixel & 0xFFFFFF;
+            uint32_t g = 255 - (pixel & 0xFF);
+            return g << 16 | g << 8 | g;
+        }
+
+        // set the part of rect (left, top, right, bottom) inside the image
+        // to a stored pixel value
+        void fill(const int32_t *rect, uint32_t value);
+    };
+
+    // director's ink numbers, for the inks copy_pixels supports
+    enum ink : uint8_t {
+        INK_COPY = 0,
+        INK_MATTE = 8,
+        INK_BLEND = 32,
+        INK_ADD_PIN = 33,
+        INK_ADD = 34,
+        INK_SUBTRACT_PIN = 35,
+        INK_BACKGROUND_TRANSPARENT = 36,
+        INK_LIGHTEST = 37,
+        INK_SUBTRACT = 38,
+        INK_DARKEST = 39
+    };
+
+    // the params of copyPixels. colors are 0xRRGGBB.
+    struct blit_params {
+        uint8_t ink = INK_COPY;
+        int32_t blend = 100; // percent, for INK_BLEND
+        bool colorize = false; // map black to color and white to bg_color
+        uint32_t color = 0x000000;
+        uint32_t bg_color = 0xFFFFFF;
+
+        // an 8-bit image the size of the source. only pixels whose mask
+        // pixel is not white are drawn.
+        const image *mask = nullptr;
+    };
+
+    // copy the src_rect part of src into the dst_rect part of dst, scaled
+    // to fit with nearest-neighbour sampling and converted to the depth of
+    // dst, through the ink. rects are left, top, right, bottom; what falls
+    // outside either image is not drawn. returns false if the ink isn't
+    // supported.
+    bool copy_pixels(image &dst, const int32_t *dst_rect, const image &src,
+                     const int32_t *src_rect, const blit_params &params);
+
+    // the same into a quad of dst, given as the x, y of its top left, top
+    // right, bottom right and bottom left corners. the source rect is
+    // mapped onto it in perspective, and each pixel whose center falls
+    // inside is drawn. large quads are drawn by several threads.
+    bool copy_pixels_quad(image &dst, const double *dst_quad,
+                          const image &src, const int32_t *src_rect,
+                          const blit_params &params);
+
+    // the most threads a blit may use. it starts as the number of hardware
+    // threads; 1 draws every blit on the calling thread.
+    void set_blit_threads(size_t n);
+
+    // running totals, for the runtime stats. the bytes copied by a single
+    // operation are the difference in the totals before and after it.
+    struct heap_stats {
+        size_t collections = 0;
+        size_t parallel_marks = 0; // collections marked by several threads
+        size_t mark_us = 0; // time spent marking, in microseconds
+        size_t duplicates = 0; // lists made by duplicate()
+        size_t duplicate_bytes = 0; // copied by duplicate() itself
+        size_t cow_copies = 0; // shared list buffers copied on write
+        size_t cow_bytes = 0;
+    };
+
+    // owns every gc object. at a collection, the runner marks its roots,
+    // then calls collect to free everything that was not reached from them.
+    class gc_heap {
+    private:
+        gc_object *_objects;
+        size_t _debt; // bytes allocated since the last collection
+        size_t _threshold;
+        heap_stats _stats;
+
+        std::vector<gc_object*> _gray; // marked, children not yet marked
+        std::vector<slice_string*> _slices; // marked slices
+        size_t _live; // bytes that survived the last collection
+        size_t _mark_threads;
+
+        // the children of obj still to be marked, from item number from.
+        // the items of a big list are marked a chunk at a time, so that its
+        // tasks can be shared between threads.
+        struct mark_task {
+            gc_object *obj;
+            size_t from;
+        };
+
+        struct serial_marker;
+        struct mark_worker;
+
+        template <typename Marker>
+        static void scan(Marker &m, const mark_task &task);
+
+        void mark_serial();
+        void mark_parallel(size_t threads);
+        static void mark_thread(mark_worker *workers, size_t count,
+                                size_t self, std::atomic<size_t> &idle);
+
+        // rect and quad records are cut from blocks of GEOM_BLOCK bytes.
+        // free ones are linked through _gc_next, by size class.
+        static constexpr size_t GEOM_BLOCK = 4096;
+        gc_object *_geom_free[2];
+        std::vector<void*> _geom_blocks;
+
+        static size_t object_size(const gc_object *obj);
+        void free_object(gc_object *obj);
+
+    public:
+        // a collection is never triggered before this many bytes have been
+        // allocated
+        static constexpr size_t MIN_THRESHOLD = 4 * 1024 * 1024;
+
+        // the mark phase is split across threads when the heap is at least
+        // this big at a collection
+        static constexpr size_t PARALLEL_MARK_MIN = 32 * 1024 * 1024;
+
+        gc_heap();
+        gc_heap(const gc_heap&) = delete;
+        ~gc_heap();
+
+        inline void link(gc_object *obj, size_t size) {
+            obj->_gc_next = _objects;
+            _objects = obj;
+            _debt += size;
+        }
+
+        // count memory allocated by an object after it was created
+        inline void grow(size_t size) { _debt += size; }
+
+        // memory for a geom with the given number of components, which is
+        // 4 or 8
+        void* alloc_geom(size_t components);
+        static constexpr size_t geom_size(size_t components) {
+            return sizeof(geom) + components * sizeof(double);
+        }
+
+        inline bool should_collect() const { return _debt >= _threshold; }
+
+        // the most threads the mark phase may use. it starts as the number
+        // of hardware threads; 1 turns parallel marking off.
+        inline void set_mark_threads(size_t n) {
+            _mark_threads = n > 0 ? n : 1;
+        }
+
+        inline heap_stats& stats() { return _stats; }
+        inline const heap_stats& stats() const { return _stats; }
+
+        inline void mark(gc_object *obj) {
+            if (!obj->_gc_marked.load(std::memory_order_relaxed)) {
+                obj->_gc_marked.store(true, std::memory_order_relaxed);
+                _gray.push_back(obj);
+            }
+        }
+
+        inline void mark(const variant &v) {
+            if (v.is_ref()) mark(v.ref);
+        }
+
+        void collect();
+    };
+
+    // find the range of bytes spanned by chunks [from, to] (1-indexed) of the
+    // given type. returns false if the range is out of bounds.
+    bool find_chunk(gc_heap &heap, const string *str, chunk_type type,
+                    char item_delim, int32_t from, int32_t to, size_t *start,
+                    size_t *end);
+
+    // the number of chunks of the given type in the string
+    size_t count_chunks(gc_heap &heap, const string *str, chunk_type type,
+                        char item_delim);
+
+    // whether duplicate() copies values of the type. lists and images are
+    // mutable, everything else is returned as is.
+    inline bool copied_by_duplicate(bc::vtype type) {
+        return type == bc::TYPE_LLIST || type == bc::TYPE_PLIST ||
+               type == bc::TYPE_IMAGE;
     }
-};
+
+    // duplicate() of a value. lists and images are copied, everything else
+    // is immutable and returned as is.
+    variant duplicate(gc_heap &heap, const variant &v);
+
+    // the = operator, which compares lists and geometry by their contents.
+    // strict is equality of property list keys, which never equates values
+    // of different types.
+    bool equal(const variant &a, const variant &b, bool strict = false,
+               int depth = 0);
+
+    // a hash that agrees with strict equality
+    size_t hash_value(const variant &v, int depth = 0);
+} // namespace lingo::vm
 
 // runner class
 namespace lingo::vm {
@@ -112,7 +1196,11 @@ namespace lingo::vm {
             static_assert(false, "unimplemented/invalid type_enum_of");
     }
 
+    class value_parser;
+
     class runner {
+        friend class value_parser;
+
     public:
         struct call_info {
             const bc::chunk_header *chunk;
@@ -126,9 +1214,152 @@ namespace lingo::vm {
         call_info _cstack[256];
         call_info *_cstack_top;
 
-        std::unordered_map<string, string*> _symbol_intern;
+        gc_heap _heap;
+
+        // #foo and #FOO are the same symbol, spelled as first interned
+        std::unordered_map<std::string_view, string*, string_hash,
+                           string_equal> _symbol_intern;
+
+        // symbols for the keys of chunk expressions
+        string *_sym_chunks[4];
+        string *_sym_integer; // getPixel's #integer
+        string *_sym_count; // list.count
+        char _item_delimiter;
+
+        // strings of length 0 and 1 are shared instead of being allocated
+        // each time they are created.
+        string *_empty_string;
+        string *_char_strings[256];
+
+        string* make_string(const char *str, size_t len);
+        string* intern_symbol(const char *str, size_t len);
+        // the characters of a value, as they would be concatenated
+        struct str_piece {
+            const char *chars;
+            size_t length;
+            char buf[32];
+        };
+
+        void to_piece(const variant *value, str_piece &piece);
 
         string* stringify(const variant *variant);
+
+        // order two values for the comparison operators, as negative, zero
+        // or positive. returns false if they can't be compared.
+        bool compare(const variant *a, const variant *b, int *out);
+
+        // +, -, * and / where an operand is not a number, and unary minus
+        // of something other than a number
+        bool arith(bc::opcode op, const variant *a, const variant *b,
+                   variant *out);
+        bool list_arith(bc::opcode op, const variant *a, const variant *b,
+                        variant *out);
+        bool negate(variant *v);
+
+        // ordering of list items for sort(), and binary search of lists
+        // that are sorted
+        int sort_order(const variant &a, const variant &b);
+        void sort_list(llist *list);
+        void sort_list(plist *list);
+        size_t sorted_bound(const llist *list, const variant &v, bool after);
+        size_t sorted_bound(const plist *list, const variant &key, bool after);
+
+        // the number of decimal places floats are printed with
+        int _float_precision;
+
+        // the lists serialize() is writing, innermost first
+        struct writing {
+            const gc_object *list;
+            const writing *outer;
+            int depth;
+
+            inline bool has(const gc_object *obj) const {
+                for (const writing *w = this; w; w = w->outer) {
+                    if (w->list == obj) return true;
+                }
+                return false;
+            }
+        };
+
+        // write a value in the textual form of string(). strings are
+        // quoted if they are inside a list, or if quote is true.
+        void serialize(str_writer &w, const variant *v, bool quote,
+                       const writing *outer = nullptr);
+        str_writer _put_writer;
+        string* concat(const variant *values, size_t count);
+        string* substring(string *src, size_t offset, size_t len);
+        bool chunk_key(const variant *key, chunk_type *type);
+        string* chunk_source(const variant *obj);
+        bool chunk_index(variant *obj, const variant *key,
+                         const variant *from, const variant *to);
+        bool chunk_count(variant *obj, const variant *key);
+
+        void collect();
+
+        bool get_at(variant *obj, const variant *index);
+
+        // builtin handlers, called by CALL and OCALL. the arguments are
+        // args[0] to args[nargs - 1]; for OCALL args[0] is the object.
+        typedef bool (runner::*builtin)(variant *args, uint8_t nargs,
+                                         variant *ret);
+        std::unordered_map<std::string_view, builtin, string_hash,
+                           string_equal> _builtins;
+
+        // the builtins last called, by the address of the name string in
+        // the chunk, so that a call site only looks its builtin up by name
+        // once. an entry's name is checked before it is used, in case the
+        // chunk it came from was freed and its memory reused.
+        struct call_cache_entry {
+            const bc::chunk_const_str *name = nullptr;
+            std::string_view key;
+            builtin fn = nullptr;
+        };
+
+        static constexpr size_t CALL_CACHE_SIZE = 64;
+        call_cache_entry _call_cache[CALL_CACHE_SIZE];
+
+        void register_builtins();
+        bool call(const bc::chunk_const_str *name, uint8_t nargs);
+
+        // parse a serialized lingo value. returns false if it is malformed.
+        bool parse_value(string *src, variant *out);
+
+        bool bi_value(variant *args, uint8_t nargs, variant *ret);
+        bool bi_string(variant *args, uint8_t nargs, variant *ret);
+        bool bi_offset(variant *args, uint8_t nargs, variant *ret);
+        bool bi_point(variant *args, uint8_t nargs, variant *ret);
+        bool bi_rect(variant *args, uint8_t nargs, variant *ret);
+        bool bi_color(variant *args, uint8_t nargs, variant *ret);
+        bool bi_intersect(variant *args, uint8_t nargs, variant *ret);
+        bool bi_union(variant *args, uint8_t nargs, variant *ret);
+        bool bi_inside(variant *args, uint8_t nargs, variant *ret);
+        bool bi_map(variant *args, uint8_t nargs, variant *ret);
+        bool bi_intersectall(variant *args, uint8_t nargs, variant *ret);
+        bool bi_insideall(variant *args, uint8_t nargs, variant *ret);
+        bool bi_image(variant *args, uint8_t nargs, variant *ret);
+        bool bi_copypixels(variant *args, uint8_t nargs, variant *ret);
+        bool bi_createmask(variant *args, uint8_t nargs, variant *ret);
+        bool bi_creatematte(variant *args, uint8_t nargs, variant *ret);
+        bool bi_getpixel(variant *args, uint8_t nargs, variant *ret);
+        bool bi_setpixel(variant *args, uint8_t nargs, variant *ret);
+        bool bi_fill(variant *args, uint8_t nargs, variant *ret);
+        bool bi_getpixelrow(variant *args, uint8_t nargs, variant *ret);
+        bool bi_setpixelrow(variant *args, uint8_t nargs, variant *ret);
+        bool offset_geom(variant *args, variant *ret);
+        bool bi_count(variant *args, uint8_t nargs, variant *ret);
+        bool bi_getat(variant *args, uint8_t nargs, variant *ret);
+        bool bi_setat(variant *args, uint8_t nargs, variant *ret);
+        bool bi_getprop(variant *args, uint8_t nargs, variant *ret);
+        bool bi_getaprop(variant *args, uint8_t nargs, variant *ret);
+        bool bi_setaprop(variant *args, uint8_t nargs, variant *ret);
+        bool bi_deleteprop(variant *args, uint8_t nargs, variant *ret);
+        bool bi_add(variant *args, uint8_t nargs, variant *ret);
+        bool bi_append(variant *args, uint8_t nargs, variant *ret);
+        bool bi_sort(variant *args, uint8_t nargs, variant *ret);
+        bool bi_getpos(variant *args, uint8_t nargs, variant *ret);
+        bool bi_findpos(variant *args, uint8_t nargs, variant *ret);
+        bool bi_duplicate(variant *args, uint8_t nargs, variant *ret);
+        bool bi_addprop(variant *args, uint8_t nargs, variant *ret);
     public:
         runner();
         runner(const runner&) = delete;
@@ -136,5 +1367,11 @@ namespace lingo::vm {
         ~runner();
 
         bool run(const bc::chunk_header *chunk);
+
+        // value() of the characters, parsed as by the value() builtin. the
+        // result is only kept from being collected while a handler holds it.
+        bool parse_value(const char *chars, size_t len, variant *out);
+
+        inline const heap_stats& stats() const { return _heap.stats(); }
     };
 } // namespace lingo::vm
\ No newline at end of file
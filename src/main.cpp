@@ -203,6 +203,14 @@ int main(int argc, const char *argv[]) {
         if (chunks.size() == 1) {
             auto runner = std::make_unique<lingo::vm::runner>();
             runner->run((lingo::bc::chunk_header *)chunks[0].data());
+
+            const lingo::vm::heap_stats &stats = runner->stats();
+            std::cout << "collections: " << stats.collections << " ("
+                      << stats.parallel_marks << " marked in parallel)\n";
+            std::cout << "duplicates: " << stats.duplicates << " ("
+                      << stats.duplicate_bytes << " bytes copied)\n";
+            std::cout << "copies on write: " << stats.cow_copies << " ("
+                      << stats.cow_bytes << " bytes copied)\n";
         }
 
         // std::string chunk_name = std::string("@") + FILE_NAME;
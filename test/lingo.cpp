@@ -0,0 +1,237 @@
+// compiles and runs small handlers, and checks what they put. run as
+// test_lingo, or with meson test -C builddir.
+#include "lingo/lang/lingo.hpp"
+#include "lingo/vm/vm.hpp"
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <sstream>
+
+using namespace lingo;
+
+// 160 characters, long enough for chunk lookups to build the offset table
+#define ROW "a,b;c,d;e,f;g,h "
+#define LONG_STRING ROW ROW ROW ROW ROW ROW ROW ROW ROW ROW
+
+struct test_case {
+    const char *name;
+    const char *source; // the body of a handler
+    const char *expected; // everything it puts
+};
+
+static const test_case tests[] = {
+    { "dot index of a property list member",
+      "p = [#tiles: [10, 20, 30]]\n"
+      "put p.tiles[2]\n"
+      "put p.tiles[3] + 1\n",
+      "20\n31\n" },
+
+    { "count of a property list member",
+      "p = [#tiles: [10, 20, 30]]\n"
+      "put p.tiles.count\n"
+      "s = \"a,b,c\"\n"
+      "put s.item.count\n"
+      "put s.char.count\n",
+      "3\n3\n5\n" },
+
+    { "chunk index by key",
+      "s = \"one,two three\"\n"
+      "put s.item[2]\n"
+      "put s.word[1]\n"
+      "put s.char[1..3]\n",
+      "two three\none,two\none\n" },
+
+    // lists of more than INDEX_MIN entries are hash indexed, and leave
+    // removed slots in place until they are read by position
+    { "deleting from a large property list",
+      "p = [1: 10, 2: 20, 3: 30, 4: 40, 5: 50, 6: 60, 7: 70, "
+      "8: 80, 9: 90, 10: 100, 11: 110, 12: 120, 13: 130, "
+      "14: 140, 15: 150, 16: 160, 17: 170, 18: 180, 19: 190, "
+      "20: 200]\n"
+      "deleteProp(p, 5)\n"
+      "deleteProp(p, 12)\n"
+      "put getaProp(p, 6)\n"
+      "put p.count\n"
+      "addProp(p, 5, 55)\n"
+      "put getaProp(p, 12)\n"
+      "put getAt(p, 5)\n"
+      "put findPos(p, 5)\n"
+      "put getProp(p, 5)\n",
+      "60\n18\n<Void>\n60\n19\n55\n" },
+
+    { "a list that is in itself twice as a key",
+      "p = [1: 1, 2: 2, 3: 3, 4: 4, 5: 5, 6: 6, 7: 7, 8: 8, 9: 9]\n"
+      "a = [1]\n"
+      "add(a, a)\n"
+      "add(a, a)\n"
+      "addProp(p, a, 10)\n"
+      "put getaProp(p, a)\n"
+      "put p.count\n",
+      "10\n10\n" },
+
+    { "printing a list that is in itself",
+      "a = [1]\n"
+      "add(a, a)\n"
+      "add(a, a)\n"
+      "p = [#a: a]\n"
+      "add(a, p)\n"
+      "put a\n"
+      "put string(p)\n",
+      "[1, [...], [...], [#a: [...]]]\n[#a: [1, [...], [...], [...]]]\n" },
+
+    // malformed input is void, without an error
+    { "value of malformed geometry",
+      "put value(\"[rect(1, 2, 3), 5]\")\n"
+      "put value(\"point(1)\")\n"
+      "put value(\"[color(1, 2, 3), rect(1, 2, 3, 4)]\")\n",
+      "<Void>\n<Void>\n[color( 1, 2, 3 ), rect(1, 2, 3, 4)]\n" },
+
+    { "the floatPrecision",
+      "put 1.0 / 3\n"
+      "the floatPrecision = -2\n"
+      "put 1.0 / 3\n"
+      "put 2.5\n"
+      "put 3.0\n"
+      "the floatPrecision = 0\n"
+      "put 2.75\n",
+      "0.3333\n0.33\n2.5\n3\n3\n" },
+
+    { "adding to a large sorted property list",
+      "s = [2: 1, 4: 2, 6: 3, 8: 4, 10: 5, 12: 6, 14: 7, 16: 8, "
+      "18: 9, 20: 10, 22: 11, 24: 12, 26: 13, 28: 14, 30: 15, "
+      "32: 16, 34: 17, 36: 18, 38: 19, 40: 20]\n"
+      "sort(s)\n"
+      "deleteProp(s, 10)\n"
+      "deleteProp(s, 12)\n"
+      "addProp(s, 11, \"x\")\n"
+      "setaProp(s, 13, \"y\")\n"
+      "put findPos(s, 11)\n"
+      "put getAt(s, 7)\n"
+      "put s.count\n"
+      "put getaProp(s, 14)\n",
+      "5\n7\n20\n7\n" },
+
+    // the copy shares the lists in it until one of them changes, through
+    // the copy, the original, or a variable taken before duplicate()
+    { "duplicate of a list of lists",
+      "l = [[1, 2], [3]]\n"
+      "y = l[1]\n"
+      "d = duplicate(l)\n"
+      "setAt(y, 1, 99)\n"
+      "add(getAt(d, 2), 4)\n"
+      "add(getAt(l, 2), 5)\n"
+      "put d\n"
+      "put l\n"
+      "put getPos(d, y)\n"
+      "put getPos(l, y)\n",
+      "[[1, 2], [3, 4]]\n[[99, 2], [3, 5]]\n0\n1\n" },
+
+    { "duplicate of nested lists and property lists",
+      "l = [[[1], [#a: 1]], 2]\n"
+      "z = l[1][1]\n"
+      "p = l[1][2]\n"
+      "d = duplicate(l)\n"
+      "e = duplicate(d)\n"
+      "add(z, 2)\n"
+      "setaProp(p, #a, 3)\n"
+      "put d\n"
+      "put e\n"
+      "setAt(d[1][1], 1, 7)\n"
+      "put d\n"
+      "put e\n"
+      "put l\n",
+      "[[[1], [#a: 1]], 2]\n[[[1], [#a: 1]], 2]\n"
+      "[[[7], [#a: 1]], 2]\n[[[1], [#a: 1]], 2]\n"
+      "[[[1, 2], [#a: 3]], 2]\n" },
+
+    // setaProp of a property that is already there writes in place
+    { "setaProp in a duplicated list",
+      "l = [[#a: 1], [1]]\n"
+      "p = l[1]\n"
+      "d = duplicate(l)\n"
+      "setaProp(p, #a, 3)\n"
+      "put d\n"
+      "q = [#x: 0]\n"
+      "setaProp(q, #x, [#b: 1])\n"
+      "m = [q]\n"
+      "e = duplicate(m)\n"
+      "setaProp(getProp(q, #x), #b, 9)\n"
+      "put e\n"
+      "put m\n",
+      "[[#a: 1], [1]]\n[[#x: [#b: 1]]]\n[[#x: [#b: 9]]]\n" },
+
+    { "items of a long string with the itemDelimiter switched",
+      "s = \"" LONG_STRING "\"\n"
+      "put s.item.count\n"
+      "the itemDelimiter = \";\"\n"
+      "put s.item.count\n"
+      "put s.item[2]\n"
+      "the itemDelimiter = \",\"\n"
+      "put s.item[2]\n"
+      "put s.item.count\n",
+      "41\n31\nc,d\nb;c\n41\n" },
+
+    // the second append writes into the free space of the buffer that the
+    // first one made
+    { "chunks of a long string appended to",
+      "s = \"" LONG_STRING "\"\n"
+      "t = s\n"
+      "put s.word.count\n"
+      "put \"x y\" after s\n"
+      "put s.word.count\n"
+      "put s.word[12]\n"
+      "put t.word.count\n"
+      "u = s\n"
+      "put \" z\" after s\n"
+      "put s.word.count\n"
+      "put u.word.count\n",
+      "10\n12\ny\n10\n13\n12\n" },
+};
+
+static bool run_test(const test_case &test, std::string &output) {
+    std::stringstream src;
+    src << "on main\n" << test.source << "end\n";
+
+    parse_error error;
+    std::vector<std::vector<uint8_t>> chunks;
+    if (!compile_bytecode(src, chunks, &error)) {
+        output = "error " + std::to_string(error.pos.line) + ":" +
+                 std::to_string(error.pos.column) + ": " + error.errmsg;
+        return false;
+    }
+
+    // runtime errors are written to the output as well
+    std::stringstream out;
+    std::streambuf *cout_buf = std::cout.rdbuf(out.rdbuf());
+    std::streambuf *cerr_buf = std::cerr.rdbuf(out.rdbuf());
+
+    // run returns true if there was an error
+    auto runner = std::make_unique<vm::runner>();
+    bool failed = runner->run((const bc::chunk_header *)chunks[0].data());
+
+    std::cout.rdbuf(cout_buf);
+    std::cerr.rdbuf(cerr_buf);
+    output = out.str();
+    return !failed;
+}
+
+int main() {
+    int failed = 0;
+
+    for (const test_case &test : tests) {
+        std::string output;
+        bool ok = run_test(test, output);
+
+        if (ok && output == test.expected) {
+            printf("ok    %s\n", test.name);
+            continue;
+        }
+
+        ++failed;
+        printf("FAIL  %s\n", test.name);
+        printf("expected:\n%s", test.expected);
+        printf("got%s:\n%s\n", ok ? "" : " (error)", output.c_str());
+    }
+
+    return failed ? 1 : 0;
+}